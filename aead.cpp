@@ -0,0 +1,140 @@
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include "constants.hpp"
+#include "aead.hpp"
+
+static const char CLIENT_KEY_LABEL[] = "confundo client to server";
+static const char SERVER_KEY_LABEL[] = "confundo server to client";
+
+AeadCipher preferredAeadCipher()
+{
+  return (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")) ? AEAD_AES_256_GCM : AEAD_CHACHA20_POLY1305;
+}
+
+bool aeadRandom(std::string &random)
+{
+  unsigned char bytes[AEAD_RANDOM_LEN];
+  if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+    return false;
+  random = std::string((char *)bytes, sizeof(bytes));
+  return true;
+}
+
+/**
+ * @brief HKDF-SHA256 of the shared key, salted with both randoms, for the direction `label`
+ */
+static bool deriveKey(const std::string &sharedKey, const std::string &salt, const char *label, unsigned char *key)
+{
+  EVP_PKEY_CTX *context = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+  size_t keyLength = AEAD_KEY_LEN;
+  bool derived = context != nullptr && EVP_PKEY_derive_init(context) > 0 && EVP_PKEY_CTX_set_hkdf_md(context, EVP_sha256()) > 0 &&
+                 EVP_PKEY_CTX_set1_hkdf_salt(context, (const unsigned char *)salt.data(), salt.size()) > 0 &&
+                 EVP_PKEY_CTX_set1_hkdf_key(context, (const unsigned char *)sharedKey.data(), sharedKey.size()) > 0 &&
+                 EVP_PKEY_CTX_add1_hkdf_info(context, (const unsigned char *)label, strlen(label)) > 0 &&
+                 EVP_PKEY_derive(context, key, &keyLength) > 0 && keyLength == AEAD_KEY_LEN;
+  EVP_PKEY_CTX_free(context);
+  return derived;
+}
+
+// the 12 byte nonce: four zero bytes and the packet number
+static void packetNonce(uint64_t number, unsigned char *nonce)
+{
+  memset(nonce, 0, 4);
+  for (int i = 0; i < AEAD_PACKET_NUMBER_LEN; i++)
+    nonce[4 + i] = number >> (8 * (AEAD_PACKET_NUMBER_LEN - 1 - i));
+}
+
+PacketCipher::PacketCipher()
+{
+  m_cipher = AEAD_NONE;
+  m_sealContext = nullptr;
+  m_openContext = nullptr;
+  m_nextPacketNumber = 0;
+  m_highestOpened = 0;
+  m_opened = false;
+}
+
+PacketCipher::~PacketCipher()
+{
+  EVP_CIPHER_CTX_free(m_sealContext);
+  EVP_CIPHER_CTX_free(m_openContext);
+}
+
+bool PacketCipher::setup(AeadCipher cipher, const std::string &sharedKey, const std::string &clientRandom, const std::string &serverRandom, bool client)
+{
+  const EVP_CIPHER *evpCipher = (cipher == AEAD_AES_256_GCM) ? EVP_aes_256_gcm() : (cipher == AEAD_CHACHA20_POLY1305) ? EVP_chacha20_poly1305() : nullptr;
+  if (evpCipher == nullptr || clientRandom.size() != AEAD_RANDOM_LEN || serverRandom.size() != AEAD_RANDOM_LEN)
+    return false;
+
+  unsigned char clientKey[AEAD_KEY_LEN], serverKey[AEAD_KEY_LEN];
+  std::string salt = clientRandom + serverRandom;
+  if (!deriveKey(sharedKey, salt, CLIENT_KEY_LABEL, clientKey) || !deriveKey(sharedKey, salt, SERVER_KEY_LABEL, serverKey))
+    return false;
+  m_sealContext = EVP_CIPHER_CTX_new();
+  m_openContext = EVP_CIPHER_CTX_new();
+  bool keyed = m_sealContext != nullptr && m_openContext != nullptr &&
+               EVP_EncryptInit_ex(m_sealContext, evpCipher, nullptr, client ? clientKey : serverKey, nullptr) == 1 &&
+               EVP_DecryptInit_ex(m_openContext, evpCipher, nullptr, client ? serverKey : clientKey, nullptr) == 1;
+  OPENSSL_cleanse(clientKey, sizeof(clientKey));
+  OPENSSL_cleanse(serverKey, sizeof(serverKey));
+  if (keyed)
+    m_cipher = cipher;
+  return keyed;
+}
+
+int PacketCipher::seal(const char *header, const char *payload, int payloadLength, char *out)
+{
+  unsigned char nonce[12];
+  packetNonce(m_nextPacketNumber++, nonce);
+  int length;
+  EVP_EncryptInit_ex(m_sealContext, nullptr, nullptr, nullptr, nonce);
+  EVP_EncryptUpdate(m_sealContext, nullptr, &length, (const unsigned char *)header, HEADER_LEN);
+  if (payloadLength > 0)
+    EVP_EncryptUpdate(m_sealContext, (unsigned char *)out, &length, (const unsigned char *)payload, payloadLength);
+  EVP_EncryptFinal_ex(m_sealContext, (unsigned char *)out + payloadLength, &length);
+  memcpy(out + payloadLength, nonce + 4, AEAD_PACKET_NUMBER_LEN);
+  EVP_CIPHER_CTX_ctrl(m_sealContext, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_LEN, out + payloadLength + AEAD_PACKET_NUMBER_LEN);
+  return payloadLength + AEAD_TRAILER_LEN;
+}
+
+int PacketCipher::open(char *packet, int length)
+{
+  int payloadLength = length - HEADER_LEN - AEAD_TRAILER_LEN;
+  if (payloadLength < 0)
+    return -1;
+  unsigned char *payload = (unsigned char *)packet + HEADER_LEN;
+  unsigned char *trailer = payload + payloadLength;
+  uint64_t number = 0;
+  for (int i = 0; i < AEAD_PACKET_NUMBER_LEN; i++)
+    number = (number << 8) | trailer[i];
+  // a number that is too old or was already taken is dropped before any work is done on it
+  if (m_opened && number <= m_highestOpened && (m_highestOpened - number >= AEAD_REPLAY_WINDOW || m_openedNumbers[number % AEAD_REPLAY_WINDOW]))
+    return -1;
+
+  unsigned char nonce[12];
+  packetNonce(number, nonce);
+  int outLength;
+  EVP_DecryptInit_ex(m_openContext, nullptr, nullptr, nullptr, nonce);
+  EVP_DecryptUpdate(m_openContext, nullptr, &outLength, (const unsigned char *)packet, HEADER_LEN);
+  if (payloadLength > 0)
+    EVP_DecryptUpdate(m_openContext, payload, &outLength, payload, payloadLength);
+  EVP_CIPHER_CTX_ctrl(m_openContext, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_LEN, trailer + AEAD_PACKET_NUMBER_LEN);
+  if (EVP_DecryptFinal_ex(m_openContext, payload + payloadLength, &outLength) != 1)
+    return -1;
+
+  // only a packet that verified moves the window, so a forged one can not push real ones out of it
+  if (!m_opened || number > m_highestOpened)
+  {
+    if (!m_opened || number - m_highestOpened >= AEAD_REPLAY_WINDOW)
+      m_openedNumbers.reset();
+    else
+      for (uint64_t skipped = m_highestOpened + 1; skipped < number; skipped++)
+        m_openedNumbers.reset(skipped % AEAD_REPLAY_WINDOW);
+    m_highestOpened = number;
+    m_opened = true;
+  }
+  m_openedNumbers.set(number % AEAD_REPLAY_WINDOW);
+  return HEADER_LEN + payloadLength;
+}
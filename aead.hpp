@@ -0,0 +1,76 @@
+#ifndef AEAD_HPP
+#define AEAD_HPP
+
+#include <string>
+#include <bitset>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/*
+  Authenticated encryption of the packets of a connection. Client and server share a key out of
+  band; the SYN carries the cipher the client picked and a random of the client, the SYN-ACK
+  echoes the cipher with a random of the server, and each side derives one key per direction
+  with HKDF-SHA256 of the shared key, salted with both randoms. Every packet after the SYN and
+  the SYN-ACK then ends in a trailer outside the sequence space
+
+      | packet number (8 bytes, big endian) | tag (16 bytes) |
+
+  The payload is encrypted, the 12 byte header stays in the clear and is authenticated with it.
+  The packet number is the nonce: it counts the packets a side sealed, so a retransmission,
+  which may be cut differently than the first send, never reuses one. A receiver drops a packet
+  whose tag does not verify and one whose number it already accepted.
+*/
+
+enum AeadCipher
+{
+	AEAD_NONE = 0,
+	AEAD_AES_256_GCM = 1,       // with AES-NI, and VAES where OpenSSL has it
+	AEAD_CHACHA20_POLY1305 = 2  // for CPUs without AES instructions
+};
+
+const int AEAD_PACKET_NUMBER_LEN = 8;
+const int AEAD_TAG_LEN = 16;
+const int AEAD_TRAILER_LEN = AEAD_PACKET_NUMBER_LEN + AEAD_TAG_LEN;
+const int AEAD_RANDOM_LEN = 16;         // of each side, in OPTION_AEAD
+const int AEAD_KEY_LEN = 32;
+const int AEAD_MIN_SHARED_KEY_LEN = 16;
+const int AEAD_REPLAY_WINDOW = 1024;    // packet numbers this far behind the highest one accepted are still taken
+
+AeadCipher preferredAeadCipher(); // AES-GCM if the CPU has AES and carry-less multiply instructions
+bool aeadRandom(std::string &random); // AEAD_RANDOM_LEN random bytes, false if there are none
+
+/**
+ * @brief Seals the packets one side sends and opens the packets it receives. The key schedule
+ * is set up once per direction, sealing or opening a packet only loads its nonce. Each packet
+ * still costs one nonce load and one tag: every packet is its own AEAD message, and EVP has no
+ * multi buffer call for GCM or ChaCha20-Poly1305, so the packets of a segmented send are sealed
+ * one after the other with the same context rather than in one batch.
+ */
+class PacketCipher
+{
+public:
+  PacketCipher();
+  ~PacketCipher();
+  // derives the keys of both directions, false for an unknown cipher
+  bool setup(AeadCipher cipher, const std::string &sharedKey, const std::string &clientRandom, const std::string &serverRandom, bool client);
+  AeadCipher cipher() const { return m_cipher; }
+
+  // writes the encrypted payload and the trailer of a packet to `out`, which may be `payload`
+  // itself and must hold `payloadLength` + AEAD_TRAILER_LEN bytes; the header is not copied
+  // @return bytes written to `out`
+  int seal(const char *header, const char *payload, int payloadLength, char *out);
+  // verifies and decrypts a datagram in place, -1 if it is forged, damaged or replayed
+  // @return length without the trailer
+  int open(char *packet, int length);
+
+private:
+  AeadCipher m_cipher;
+  EVP_CIPHER_CTX *m_sealContext; // keyed once
+  EVP_CIPHER_CTX *m_openContext;
+  uint64_t m_nextPacketNumber;
+  uint64_t m_highestOpened; // highest packet number that verified
+  bool m_opened;            // any packet verified yet
+  std::bitset<AEAD_REPLAY_WINDOW> m_openedNumbers; // by packet number modulo the window, up to m_highestOpened
+};
+
+#endif // AEAD_HPP
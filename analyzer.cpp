@@ -0,0 +1,203 @@
+#include <string>
+#include <map>
+#include <deque>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "constants.hpp"
+#include "tracefile.hpp"
+
+// OFFLINE ANALYZER OF BINARY TRACES
+//
+// Replays a trace and rebuilds, for every connection, what the packet log only shows implicitly:
+// bytes in flight (highest sequence number sent minus the cumulative ACK), round trip times
+// (from the first transmission of a segment to the ACK that ends exactly at it, never from a
+// retransmitted one), retransmissions, and data that arrived behind later data, i.e. reordered
+// or retransmitted packets.
+
+const char *EVENT_NAMES[] = {"SEND", "SEND-DUP", "RECV", "DROP"};
+
+struct SentSegment
+{
+  uint32_t end;    // sequence number that ACKs it
+  uint64_t sentNs; // first transmission
+};
+
+struct ConnectionSeries
+{
+  bool sending = false;  // sent data, so in flight and RTT mean something
+  uint32_t sentEnd = 0;  // highest sequence number sent
+  uint32_t acked = 0;    // highest cumulative ACK received
+  bool receiving = false;
+  uint32_t receivedEnd = 0; // highest sequence number received
+  std::deque<SentSegment> unacked;
+
+  uint64_t firstNs = 0, lastNs = 0;
+  int64_t packetsOut = 0, packetsIn = 0, bytesSent = 0, bytesReceived = 0;
+  int64_t retransmissions = 0, outOfOrder = 0;
+  double rttMs = -1, rttMinMs = -1, rttMaxMs = 0, rttSumMs = 0;
+  int64_t rttSamples = 0;
+  uint32_t maxCwnd = 0;
+};
+
+/**
+ * @brief Whether sequence number a comes after b, allowing for the wrap at MAX_SEQ_NUM
+ */
+static bool seqAfter(uint32_t a, uint32_t b)
+{
+  uint32_t distance = (a + MAX_SEQ_NUM + 1 - b) % (MAX_SEQ_NUM + 1);
+  return distance != 0 && distance < (MAX_SEQ_NUM + 1) / 2;
+}
+
+static uint32_t seqDistance(uint32_t from, uint32_t to)
+{
+  return (to + MAX_SEQ_NUM + 1 - from) % (MAX_SEQ_NUM + 1);
+}
+
+/**
+ * @brief Updates the series of a connection with one record
+ */
+static void replay(ConnectionSeries &c, const TraceRecord &r)
+{
+  if (c.packetsOut + c.packetsIn == 0)
+    c.firstNs = r.timestampNs;
+  c.lastNs = r.timestampNs;
+  c.maxCwnd = std::max(c.maxCwnd, r.cwnd);
+  uint32_t end = (r.seqNum + r.payloadLen) % (MAX_SEQ_NUM + 1);
+
+  if (r.direction == TRACE_OUT)
+  {
+    c.packetsOut++;
+    if (r.payloadLen == 0 || (r.flags & TRACE_FLAG_SYN))
+      return;
+    if (r.event == TRACE_RETRANSMIT)
+    {
+      c.retransmissions++;
+      for (auto it = c.unacked.begin(); it != c.unacked.end(); it++)
+        if (it->end == end) // ambiguous now, which transmission would an ACK belong to
+        {
+          c.unacked.erase(it);
+          break;
+        }
+      return;
+    }
+    if (!c.sending || seqAfter(end, c.sentEnd))
+    {
+      if (!c.sending)
+        c.acked = r.seqNum;
+      c.sending = true;
+      c.sentEnd = end;
+    }
+    c.bytesSent += r.payloadLen;
+    c.unacked.push_back({end, r.timestampNs});
+    return;
+  }
+
+  c.packetsIn++;
+  if (r.payloadLen > 0 && !(r.flags & TRACE_FLAG_SYN))
+  {
+    c.bytesReceived += r.payloadLen;
+    if (c.receiving && !seqAfter(end, c.receivedEnd))
+      c.outOfOrder++;
+    else
+      c.receivedEnd = end;
+    c.receiving = true;
+  }
+  if ((r.flags & TRACE_FLAG_ACK) && c.sending && r.event == TRACE_RECV && seqAfter(r.ackNum, c.acked))
+  {
+    c.acked = r.ackNum;
+    while (!c.unacked.empty() && !seqAfter(c.unacked.front().end, c.acked))
+    {
+      if (c.unacked.front().end == c.acked)
+      {
+        c.rttMs = (r.timestampNs - c.unacked.front().sentNs) / 1e6;
+        c.rttMinMs = (c.rttMinMs < 0) ? c.rttMs : std::min(c.rttMinMs, c.rttMs);
+        c.rttMaxMs = std::max(c.rttMaxMs, c.rttMs);
+        c.rttSumMs += c.rttMs;
+        c.rttSamples++;
+      }
+      c.unacked.pop_front();
+    }
+  }
+}
+
+static void printUsage()
+{
+  std::cerr << "Usage: analyzer [-c <connection id>] [-s] <TRACE-FILE>" << std::endl;
+  std::cerr << "  prints one CSV row per packet with the state of its connection after it, or with -s a summary per connection" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  using namespace std;
+  int onlyConnection = -1;
+  bool summary = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:s")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      onlyConnection = atoi(optarg);
+      break;
+    case 's':
+      summary = true;
+      break;
+    default:
+      printUsage();
+      exit(1);
+    }
+  }
+  if (argc - optind != 1)
+  {
+    cerr << "ERROR: Incorrect number of arguments provided!" << endl;
+    printUsage();
+    exit(1);
+  }
+
+  TraceReader trace;
+  if (!trace.open(argv[optind]))
+  {
+    cerr << "ERROR: " << trace.error() << endl;
+    exit(1);
+  }
+  if (trace.header().written > trace.header().capacity)
+    cerr << "Trace wrapped, the first " << trace.header().written - trace.header().capacity << " records were overwritten" << endl;
+
+  map<int, ConnectionSeries> connections;
+  if (!summary)
+    printf("time_s,connection,event,flags,seq,ack,length,cwnd,ssthresh,in_flight,rtt_ms,retransmissions,out_of_order\n");
+  for (uint64_t i = 0; i < trace.size(); i++)
+  {
+    const TraceRecord &r = trace[i];
+    if (onlyConnection != -1 && r.connId != onlyConnection)
+      continue;
+    ConnectionSeries &c = connections[r.connId];
+    replay(c, r);
+    if (summary)
+      continue;
+
+    string flags = string(r.flags & TRACE_FLAG_ACK ? "A" : "") + (r.flags & TRACE_FLAG_SYN ? "S" : "") + (r.flags & TRACE_FLAG_FIN ? "F" : "");
+    string inFlight = c.sending ? to_string(seqDistance(c.acked, c.sentEnd)) : "";
+    char rtt[32] = "";
+    if (c.rttSamples > 0)
+      snprintf(rtt, sizeof(rtt), "%.3f", c.rttMs);
+    printf("%.6f,%d,%s,%s,%u,%u,%u,%u,%u,%s,%s,%lld,%lld\n", r.timestampNs / 1e9, r.connId, EVENT_NAMES[r.event % 4], flags.c_str(), r.seqNum,
+           r.ackNum, r.payloadLen, r.cwnd, r.ssthresh, inFlight.c_str(), rtt, (long long)c.retransmissions, (long long)c.outOfOrder);
+  }
+
+  if (summary)
+  {
+    printf("%-10s %9s %9s %9s %12s %12s %8s %8s %9s %9s %9s %9s\n", "connection", "seconds", "out", "in", "bytes sent", "bytes recvd",
+           "retrans", "ooo", "rtt min", "rtt avg", "rtt max", "max cwnd");
+    for (auto &entry : connections)
+    {
+      ConnectionSeries &c = entry.second;
+      printf("%-10d %9.3f %9lld %9lld %12lld %12lld %8lld %8lld %9.3f %9.3f %9.3f %9u\n", entry.first, (c.lastNs - c.firstNs) / 1e9,
+             (long long)c.packetsOut, (long long)c.packetsIn, (long long)c.bytesSent, (long long)c.bytesReceived, (long long)c.retransmissions,
+             (long long)c.outOfOrder, c.rttSamples ? c.rttMinMs : 0, c.rttSamples ? c.rttSumMs / c.rttSamples : 0, c.rttMaxMs, c.maxCwnd);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,381 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "constants.hpp"
+#include "tcp.hpp"
+#include "serverengine.hpp"
+#include "client.hpp"
+#include "datasource.hpp"
+#include "aead.hpp"
+
+// MICROBENCHMARKS OF THE PROTOCOL HOT PATHS
+//
+// Every benchmark is run BENCH_REPETITIONS times on the same input and reports the fastest and
+// the median run, so results of two builds can be compared number by number.
+
+const int BENCH_REPETITIONS = 5;
+const int BENCH_CODEC_PACKETS = 200000; // packets encoded and decoded per run
+const int BENCH_SERVER_PACKETS = 5000;  // about 2.5M received per run
+const int BENCH_CLIENT_PACKETS = 20000; // about 10M ACKed per run
+const int BENCH_OPEN_PACKETS = 20000;   // sealed up front and opened once per run, each with its own packet number
+const int BENCH_REORDER_SPAN = 8;       // reordered arrival reverses groups of this many packets
+const int BENCH_LOSS_INTERVAL = 20;     // lossy arrival loses one packet in this many
+const int BENCH_INITIAL_SEQ_NUM = 100000; // close to MAX_SEQ_NUM, so every run wraps around
+
+struct BenchResult
+{
+  std::string name;
+  std::string scenario;
+  int window;                 // packets in flight, 0 where it does not apply
+  long operations;            // packets handled per run
+  long bytes;                 // payload bytes delivered per run
+  std::vector<double> seconds; // timed part of every run
+};
+
+/**
+ * @brief Sequence number of the i-th data packet of a connection starting at BENCH_INITIAL_SEQ_NUM
+ */
+static int dataSeqNum(long i)
+{
+  return (BENCH_INITIAL_SEQ_NUM + 1 + i * MAX_PAYLOAD_LENGTH) % (MAX_SEQ_NUM + 1);
+}
+
+/**
+ * @brief Runs `run`, which returns the seconds spent in its timed part, BENCH_REPETITIONS times
+ */
+static BenchResult measure(std::string name, std::string scenario, int window, long operations, long bytes, std::function<double()> run)
+{
+  BenchResult result = {name, scenario, window, operations, bytes, std::vector<double>()};
+  for (int i = 0; i < BENCH_REPETITIONS; i++)
+    result.seconds.push_back(run());
+  std::sort(result.seconds.begin(), result.seconds.end());
+  return result;
+}
+
+static double elapsedSeconds(c_time start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// TCPPacket
+
+static double benchEncode(const char *payload)
+{
+  long checksum = 0; // keeps the work from being optimized away
+  c_time start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_CODEC_PACKETS; i++)
+  {
+    TCPPacket p(dataSeqNum(i), 0, 1, false, false, false, payload, MAX_PAYLOAD_LENGTH);
+    int length;
+    char *packet = p.getCString(length);
+    checksum += packet[length - 1] + length;
+  }
+  double seconds = elapsedSeconds(start);
+  if (checksum == 0)
+    std::cerr << "ERROR: Nothing was encoded" << std::endl;
+  return seconds;
+}
+
+static double benchDecode(const std::string &packet)
+{
+  long checksum = 0;
+  c_time start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_CODEC_PACKETS; i++)
+  {
+    TCPPacket p(packet);
+    checksum += p.getSeqNum() + p.getPayloadLength();
+  }
+  double seconds = elapsedSeconds(start);
+  if (checksum == 0)
+    std::cerr << "ERROR: Nothing was decoded" << std::endl;
+  return seconds;
+}
+
+// Packet encryption
+
+static void keyCiphers(AeadCipher cipher, PacketCipher &client, PacketCipher &server)
+{
+  std::string key(AEAD_KEY_LEN, 'k');
+  std::string clientRandom(AEAD_RANDOM_LEN, 'c');
+  std::string serverRandom(AEAD_RANDOM_LEN, 's');
+  if (!client.setup(cipher, key, clientRandom, serverRandom, true) || !server.setup(cipher, key, clientRandom, serverRandom, false))
+  {
+    std::cerr << "ERROR: Could not key the cipher" << std::endl;
+    exit(1);
+  }
+}
+
+static double benchSeal(AeadCipher cipher, const char *payload)
+{
+  PacketCipher client, server;
+  keyCiphers(cipher, client, server);
+  TCPPacket p(dataSeqNum(0), 0, 1, false, false, false, payload, MAX_PAYLOAD_LENGTH);
+  std::vector<char> sealed(MAX_PAYLOAD_LENGTH + AEAD_TRAILER_LEN);
+  long checksum = 0;
+  c_time start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_CODEC_PACKETS; i++)
+    checksum += client.seal(p.getHeader(), payload, MAX_PAYLOAD_LENGTH, &sealed[0]) + sealed[i % MAX_PAYLOAD_LENGTH];
+  double seconds = elapsedSeconds(start);
+  if (checksum == 0)
+    std::cerr << "ERROR: Nothing was sealed" << std::endl;
+  return seconds;
+}
+
+static double benchOpen(AeadCipher cipher, const char *payload)
+{
+  PacketCipher client, server;
+  keyCiphers(cipher, client, server);
+  TCPPacket p(dataSeqNum(0), 0, 1, false, false, false, payload, MAX_PAYLOAD_LENGTH);
+  const int length = HEADER_LEN + MAX_PAYLOAD_LENGTH + AEAD_TRAILER_LEN;
+  std::vector<char> packets((size_t)BENCH_OPEN_PACKETS * length);
+  for (int i = 0; i < BENCH_OPEN_PACKETS; i++)
+  {
+    char *packet = &packets[(size_t)i * length];
+    memcpy(packet, p.getHeader(), HEADER_LEN);
+    client.seal(p.getHeader(), payload, MAX_PAYLOAD_LENGTH, packet + HEADER_LEN);
+  }
+
+  long opened = 0;
+  c_time start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_OPEN_PACKETS; i++)
+    opened += server.open(&packets[(size_t)i * length], length) == HEADER_LEN + MAX_PAYLOAD_LENGTH;
+  double seconds = elapsedSeconds(start);
+  if (opened != BENCH_OPEN_PACKETS)
+    std::cerr << "ERROR: Only " << opened << " packets verified" << std::endl;
+  return seconds;
+}
+
+// Server receive path
+
+/**
+ * @brief Order in which the packets of a connection reach the server
+ *
+ * in-order: every packet once, in sequence
+ * reordered: groups of BENCH_REORDER_SPAN packets arrive back to front
+ * lossy: one packet of every BENCH_LOSS_INTERVAL is lost and go-back-N resends it together with
+ * the rest of its group, which the server already has
+ */
+static std::vector<int> arrivalOrder(std::string scenario)
+{
+  std::vector<int> order;
+  for (int first = 0; first < BENCH_SERVER_PACKETS; first += BENCH_LOSS_INTERVAL)
+  {
+    int last = std::min(first + BENCH_LOSS_INTERVAL, BENCH_SERVER_PACKETS);
+    if (scenario == "in-order")
+    {
+      for (int i = first; i < last; i++)
+        order.push_back(i);
+    }
+    else if (scenario == "reordered")
+    {
+      for (int group = first; group < last; group += BENCH_REORDER_SPAN)
+        for (int i = std::min(group + BENCH_REORDER_SPAN, last) - 1; i >= group; i--)
+          order.push_back(i);
+    }
+    else
+    {
+      int lost = first + BENCH_LOSS_INTERVAL / 4;
+      for (int i = first; i < last; i++)
+        if (i != lost)
+          order.push_back(i);
+      for (int i = lost; i < last; i++)
+        order.push_back(i);
+    }
+  }
+  return order;
+}
+
+/**
+ * @brief Feeds the packets to a new connection in `order` the way ServerEngine::receive does:
+ * each one is added to the receive buffer, which is then flushed, and the bytes handed out are
+ * written to the output file the way the server does
+ */
+static double benchReceive(std::string folder, std::vector<TCPPacket *> &packets, std::vector<int> &order)
+{
+  ServerEngine engine;
+  struct sockaddr_in clientInfo;
+  memset(&clientInfo, 0, sizeof(clientInfo));
+  clientInfo.sin_family = AF_INET;
+  clientInfo.sin_port = htons(9);
+  clientInfo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  TCPPacket syn(BENCH_INITIAL_SEQ_NUM, 0, 0, false, true, false, 0, "");
+  engine.addNewConnection(&syn, (struct sockaddr *)&clientInfo, sizeof(clientInfo));
+  ServerEvent event;
+  if (!engine.pollEvent(event) || event.type != SERVER_CONNECTION_REQUESTED)
+  {
+    std::cerr << "ERROR: Could not open a connection" << std::endl;
+    exit(1);
+  }
+  int connId = event.connId;
+  std::string path = folder + "/" + std::to_string(connId) + ".file";
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+  if (fd == -1)
+  {
+    std::cerr << "ERROR: Could not open an output file in " << folder << std::endl;
+    exit(1);
+  }
+  engine.accept(connId, ConnectionOptions());
+  Datagram datagram;
+  while (engine.pollDatagram(datagram)) // the SYN-ACK
+    ;
+
+  off_t offset = 0;
+  c_time start = std::chrono::steady_clock::now();
+  for (int index : order)
+  {
+    engine.addPacketToBuffer(connId, packets[index]);
+    engine.flushBuffer(connId);
+    while (engine.pollEvent(event))
+      offset += pwrite(fd, event.data, event.length, offset);
+  }
+  double seconds = elapsedSeconds(start);
+
+  close(fd);
+  unlink(path.c_str());
+  return seconds;
+}
+
+// Client ACK path
+
+/**
+ * @brief Sends BENCH_CLIENT_PACKETS in rounds of `window` packets and ACKs each packet of a
+ * round on its own, as Client::handlePacket does. Only markAck and shiftWindow are timed.
+ * The handshake is skipped, so the data starts right at the initial sequence number.
+ */
+static double benchAck(const char *payload, int window)
+{
+  Client client(new GeneratorSource((off_t)BENCH_CLIENT_PACKETS * MAX_PAYLOAD_LENGTH), "bench", dataSeqNum(0));
+  std::vector<TCPPacket *> acks;
+  for (int i = 0; i < BENCH_CLIENT_PACKETS; i++)
+    acks.push_back(new TCPPacket(INIT_SERVER_SEQ_NUM + 1, dataSeqNum(i + 1), 1, true, false, false, 0, ""));
+
+  double seconds = 0;
+  long shifted = 0;
+  for (int first = 0; first < BENCH_CLIENT_PACKETS; first += window)
+  {
+    int last = std::min(first + window, BENCH_CLIENT_PACKETS);
+    std::vector<TCPPacket *> packets;
+    for (int i = first; i < last; i++)
+      packets.push_back(new TCPPacket(dataSeqNum(i), 0, 1, false, false, false, payload, MAX_PAYLOAD_LENGTH));
+    client.addToBuffers(packets);
+    client.sendPackets();
+    while (client.pollTransmit() != nullptr) // nothing is sent, the datagrams are dropped
+      ;
+
+    c_time start = std::chrono::steady_clock::now();
+    for (int i = first; i < last; i++)
+    {
+      client.markAck(acks[i]);
+      shifted += client.shiftWindow(acks[i]);
+    }
+    seconds += elapsedSeconds(start);
+  }
+  if (shifted != (long)BENCH_CLIENT_PACKETS * MAX_PAYLOAD_LENGTH)
+    std::cerr << "ERROR: The ACKs moved the window by " << shifted << " bytes" << std::endl;
+
+  for (TCPPacket *ack : acks)
+    delete ack;
+  return seconds;
+}
+
+// Output
+
+static void writeJson(std::ostream &out, std::vector<BenchResult> &results)
+{
+  out << "{\n  \"repetitions\": " << BENCH_REPETITIONS << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    BenchResult &r = results[i];
+    double best = r.seconds.front();
+    double median = r.seconds[r.seconds.size() / 2];
+    out << (i ? "," : "") << "\n    {"
+        << "\"name\": \"" << r.name << "\", "
+        << "\"scenario\": \"" << r.scenario << "\", "
+        << "\"window\": " << r.window << ", "
+        << "\"operations\": " << r.operations << ", "
+        << "\"bytes\": " << r.bytes << ", "
+        << "\"best_seconds\": " << best << ", "
+        << "\"median_seconds\": " << median << ", "
+        << "\"median_ns_per_op\": " << median * 1e9 / r.operations << ", "
+        << "\"median_mb_per_s\": " << r.bytes / median / 1e6 << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+/**
+ * @brief Runs every benchmark and writes the results as JSON to the file named by the first
+ * argument, or to stdout
+ */
+int main(int argc, char *argv[])
+{
+  using namespace std;
+  vector<BenchResult> results;
+  vector<char> payload(MAX_PAYLOAD_LENGTH);
+  for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+    payload[i] = (char)(i * 31 + 7);
+
+  TCPPacket sample(dataSeqNum(0), 0, 1, false, false, false, &payload[0], MAX_PAYLOAD_LENGTH);
+  string encoded = sample.getString();
+  long codecBytes = (long)BENCH_CODEC_PACKETS * MAX_PAYLOAD_LENGTH;
+  results.push_back(measure("tcp_packet_encode", "", 0, BENCH_CODEC_PACKETS, codecBytes, [&]() { return benchEncode(&payload[0]); }));
+  results.push_back(measure("tcp_packet_decode", "", 0, BENCH_CODEC_PACKETS, codecBytes, [&]() { return benchDecode(encoded); }));
+  const AeadCipher ciphers[] = {AEAD_AES_256_GCM, AEAD_CHACHA20_POLY1305};
+  const char *cipherNames[] = {"aes-256-gcm", "chacha20-poly1305"};
+  long openBytes = (long)BENCH_OPEN_PACKETS * MAX_PAYLOAD_LENGTH;
+  for (int i = 0; i < 2; i++)
+  {
+    results.push_back(measure("packet_seal", cipherNames[i], 0, BENCH_CODEC_PACKETS, codecBytes, [&]() { return benchSeal(ciphers[i], &payload[0]); }));
+    results.push_back(measure("packet_open", cipherNames[i], 0, BENCH_OPEN_PACKETS, openBytes, [&]() { return benchOpen(ciphers[i], &payload[0]); }));
+  }
+
+  char folderTemplate[] = "/tmp/confundo-bench-XXXXXX";
+  if (mkdtemp(folderTemplate) == nullptr)
+  {
+    cerr << "ERROR: Could not create a directory for the output files" << endl;
+    exit(1);
+  }
+  string folder = folderTemplate;
+  vector<TCPPacket *> serverPackets;
+  for (int i = 0; i < BENCH_SERVER_PACKETS; i++)
+    serverPackets.push_back(new TCPPacket(dataSeqNum(i), 0, 1, false, false, false, &payload[0], MAX_PAYLOAD_LENGTH));
+  long serverBytes = (long)BENCH_SERVER_PACKETS * MAX_PAYLOAD_LENGTH;
+  const char *scenarios[] = {"in-order", "reordered", "lossy"};
+  for (const char *scenario : scenarios)
+  {
+    vector<int> order = arrivalOrder(scenario);
+    results.push_back(measure("server_receive", scenario, 0, order.size(), serverBytes,
+                              [&]() { return benchReceive(folder, serverPackets, order); }));
+  }
+  for (TCPPacket *p : serverPackets)
+    delete p;
+  rmdir(folder.c_str());
+
+  long clientBytes = (long)BENCH_CLIENT_PACKETS * MAX_PAYLOAD_LENGTH;
+  const int windows[] = {8, 32, MAX_CWND_BYTES / MAX_PAYLOAD_LENGTH};
+  for (int window : windows)
+    results.push_back(measure("client_ack", "", window, BENCH_CLIENT_PACKETS, clientBytes,
+                              [&]() { return benchAck(&payload[0], window); }));
+  if (argc > 1)
+  {
+    ofstream out(argv[1]);
+    writeJson(out, results);
+    if (!out)
+    {
+      cerr << "ERROR: Could not write " << argv[1] << endl;
+      exit(1);
+    }
+  }
+  else
+    writeJson(cout, results);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "busypoll.hpp"
+
+static cpu_set_t s_unpinnedCpus; // affinity of the process before enable()
+static int s_pinnedCpu = -1;
+
+static int64_t monotonicNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+BusyPoller::BusyPoller()
+{
+  m_enabled = false;
+  m_spinNs = BUSY_POLL_MIN_SPIN_NS;
+}
+
+void BusyPoller::enable(int sockFd, int cpu)
+{
+  CPU_ZERO(&s_unpinnedCpus);
+  sched_getaffinity(0, sizeof(s_unpinnedCpus), &s_unpinnedCpus);
+  cpu_set_t pinned;
+  CPU_ZERO(&pinned);
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+  {
+    std::cerr << "ERROR: CPU " << cpu << " does not exist" << std::endl;
+    exit(1);
+  }
+  CPU_SET(cpu, &pinned);
+  if (sched_setaffinity(0, sizeof(pinned), &pinned) == -1)
+  {
+    std::cerr << "ERROR: Unable to pin to CPU " << cpu << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  s_pinnedCpu = cpu;
+
+  // hints, the spin in spin() does not depend on them
+  int busyPollUs = BUSY_POLL_SOCKET_US;
+  setsockopt(sockFd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs));
+#ifdef SO_PREFER_BUSY_POLL
+  int prefer = 1;
+  setsockopt(sockFd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+  m_enabled = true;
+}
+
+/**
+ * @brief Peeks at the socket until a datagram is queued or the spin budget, at most `maxNs`, is
+ * used up. The budget of the next spin doubles after a hit and halves after a miss.
+ */
+bool BusyPoller::spin(int sockFd, int64_t maxNs)
+{
+  int64_t budget = (m_spinNs < maxNs) ? m_spinNs : maxNs;
+  int64_t started = monotonicNs();
+  char byte;
+  for (int peeks = 0;; peeks++)
+  {
+    // a zero length datagram peeks as 0 bytes, so anything but -1 means one is queued
+    if (recv(sockFd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) != -1)
+    {
+      if (peeks > 0) // a datagram that was already queued says nothing about the gaps
+        m_spinNs = (m_spinNs * 2 < BUSY_POLL_MAX_SPIN_NS) ? m_spinNs * 2 : BUSY_POLL_MAX_SPIN_NS;
+      return true;
+    }
+    if (monotonicNs() - started >= budget)
+      break;
+  }
+
+  m_spinNs = (m_spinNs / 2 > BUSY_POLL_MIN_SPIN_NS) ? m_spinNs / 2 : BUSY_POLL_MIN_SPIN_NS;
+  return false;
+}
+
+void BusyPoller::leavePinnedCpu()
+{
+  if (s_pinnedCpu == -1)
+    return;
+  cpu_set_t cpus = s_unpinnedCpus;
+  if (CPU_COUNT(&cpus) > 1)
+    CPU_CLR(s_pinnedCpu, &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+}
@@ -0,0 +1,39 @@
+#ifndef BUSYPOLL_HPP
+#define BUSYPOLL_HPP
+
+#include <stdint.h>
+
+const int64_t BUSY_POLL_MIN_SPIN_NS = 2000;   // spin budget after spins that found nothing
+const int64_t BUSY_POLL_MAX_SPIN_NS = 200000; // spin budget while datagrams keep arriving during spins
+const int BUSY_POLL_SOCKET_US = 50;           // SO_BUSY_POLL, how long one nonblocking receive polls the device queue
+
+/**
+ * @brief Low latency receive mode. The protocol loop is pinned to one core and, before it blocks
+ * in the kernel for the next datagram, spins on nonblocking peeks at the socket, so a datagram
+ * that arrives soon is picked up without the wakeup of a sleeping thread.
+ *
+ * The spin budget adapts between BUSY_POLL_MIN_SPIN_NS and BUSY_POLL_MAX_SPIN_NS: it doubles
+ * every time a datagram shows up during a spin and halves every time a spin runs out, so the loop
+ * spins through the gaps of a packet train and blocks almost at once when the peer went quiet.
+ * Where the kernel has them the socket also gets SO_BUSY_POLL and SO_PREFER_BUSY_POLL, with
+ * which every nonblocking peek polls the device queue of the NIC instead of waiting for its
+ * interrupt. Both are hints, raising SO_BUSY_POLL needs CAP_NET_ADMIN and the spin works without.
+ */
+class BusyPoller
+{
+public:
+  BusyPoller();
+  void enable(int sockFd, int cpu); // pins the calling thread to `cpu`, exits with an error if it can not
+  bool enabled() const { return m_enabled; }
+  bool spin(int sockFd, int64_t maxNs = BUSY_POLL_MAX_SPIN_NS); // true once a datagram is queued, false if the budget ran out
+
+  // moves the calling thread off the pinned core, for helper threads that would otherwise
+  // inherit the pinning from the loop that started them
+  static void leavePinnedCpu();
+
+private:
+  bool m_enabled;
+  int64_t m_spinNs; // budget of the next spin
+};
+
+#endif // BUSYPOLL_HPP
@@ -1,143 +1,151 @@
 #include <string>
-#include <unistd.h>
-#include <fcntl.h>
 #include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
 #include <vector>
+#include <algorithm>
 #include <chrono>
-#include <iostream>
 #include <errno.h>
 #include <string.h>
 #include "constants.hpp"
 #include "tcp.hpp"
 #include "client.hpp"
-#include "utilities.hpp"
+#include "datasource.hpp"
+#include "crc32c.hpp"
 
-Client::Client(std::string hostname, std::string port, std::string fileName)
+Client::Client(DataSource *source, std::string fileName, int initialSeqNum, off_t rangeStart, off_t rangeLength, ConnectionOptions options,
+               bool earlyData)
 {
-  using namespace std;
-  struct addrinfo hints, *servInfo, *p;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET; // set to AF_INET to use IPv4
-  hints.ai_socktype = SOCK_DGRAM;
-  hints.ai_flags = AI_PASSIVE;
-  hints.ai_protocol = IPPROTO_UDP;
-
-  m_blseek = 0;
-  m_flseek = 0;
-  m_largestSeqNum = INIT_CLIENT_SEQ_NUM;
-  m_relSeqNum = INIT_CLIENT_SEQ_NUM;
+  m_source = source;
+  m_fileName = fileName;
+
+  m_blseek = rangeStart;
+  m_flseek = rangeStart;
+  m_rangeEnd = (rangeLength == -1) ? -1 : rangeStart + rangeLength;
+  m_options = options;
+  m_sendEarlyData = earlyData;
+  m_initialSeqNum = initialSeqNum;
+  m_largestSeqNum = initialSeqNum;
+  m_relSeqNum = initialSeqNum;
   m_cwnd = INIT_CWND_BYTES;
   m_avlblwnd = m_cwnd;
   m_ssthresh = INITIAL_SSTHRESH;
-  m_sequenceNumber = INIT_CLIENT_SEQ_NUM;
+  m_rwnd = RWND_BYTES;
+  m_persistTimeout = RETRANSMISSION_TIMEOUT;
+  m_probing = false;
+  m_sequenceNumber = initialSeqNum;
   m_ackNumber = 0;    // initially no ack being sent
   m_connectionId = 0; // initially connection id is 0 when client sends SYN
   m_firstPacketAcked = false;
-  int ret;
-  if ((ret = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &servInfo)) != 0)
-  {
-    cerr << "ERROR: in getaddrinfo " << strerror(errno) << endl;
-    exit(1);
-  }
-  int sockfd = -1;
-
-  for (p = servInfo; p != NULL; p = p->ai_next)
-  {
-    sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (sockfd == -1)
-    {
-      cerr << "ERROR: in socket " << strerror(errno) << endl;
-      continue;
-    }
-    break;
-  }
-  m_sockFd = sockfd;
-  // non blocking receiving
-  if (fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1)
-  {
-    cerr << "ERROR: in fcntl " << strerror(errno) << endl;
-    exit(1);
-  }
-
-  if (p == NULL)
-  {
-    cerr << "ERROR: in socket " << strerror(errno) << endl;
-    exit(1);
-  }
-
-  m_serverInfo = *p;
-  m_rememberToFree = servInfo;
-
-  // open the file
-  m_fileFd = open(fileName.c_str(), O_RDONLY);
-  if (m_fileFd == -1)
-  {
-    cerr << "ERROR: Unable to open file " << strerror(errno) << endl;
-    exit(1);
-  }
+  m_fileRead = false;
+  m_sourceStarved = false;
+  m_state = CLIENT_CLOSED;
+  m_exitCode = 0;
+  m_timedOut = false;
+  m_checksums = false;
+  m_digest = 0;
+  m_cipher = nullptr;
+  m_fecMinGroup = 0;
+  m_fecGroup = 0;
+  m_fecGroupStart = 0;
+  m_fecGroupCount = 0;
+  m_fecSent = 0;
+  m_fecLosses = 0;
+  m_lossEpisode = false;
+  m_lossRate = 0;
+  m_synPacket = nullptr;
+  m_finPacket = nullptr;
+  m_clientAckPacket = nullptr;
+  m_now = c_time(); // the driver sets the clock before start()
+  m_rto = timeoutDuration(RETRANSMISSION_TIMEOUT);
+  m_startTime = m_now;
+  m_srtt = c_duration::zero();
+  m_rttTiming = false;
+  m_rttSeqEnd = 0;
+  m_stages = nullptr;
+  m_segmentationOffload = false;
+  m_transmitCount = 0;
+  m_transmitsPolled = 0;
+  m_packetLog = false;
+  m_logPolled = 0;
 }
 
 Client::~Client()
 {
-  freeaddrinfo(m_rememberToFree);
-  // assumption is that closeConnections() was called before already, so the destructor has to do nothing
+  while (!m_packetBuffer.empty())
+  {
+    delete m_packetBuffer.back();
+    m_packetBuffer.pop_back();
+  }
+  delete m_synPacket;
+  delete m_finPacket;
+  delete m_clientAckPacket;
+  delete m_source;
+  delete m_cipher;
 }
 
 /**
  * @brief Reading Available Window and Create TCP Packets
+ *
+ * The packets reference the payload in m_source directly, nothing is copied
  * 
  * @return std::vector<TCPPacket *> 
  */
 std::vector<TCPPacket *> Client::readAndCreateTCPPackets()
 {
-  std::vector<TCPPacket *> packets;              //Creating Packets to send
-  char *fileBuffer = new char[m_avlblwnd];       //File buffer of size Available Window
-  int bytesRead;                                 // Bytes Read
-  if (lseek(m_fileFd, m_flseek, SEEK_SET) == -1) // SEEK_SET start from start of file
-  {
-    std::string errorMessage = "ERROR: File lseek error : " + std::string(strerror(errno));
-    std::cerr << errorMessage << std::endl;
-    exit(1);
-  }
-
-  if ((bytesRead = read(m_fileFd, fileBuffer, m_avlblwnd)) == -1)
-  {
-    std::string errorMessage = "ERROR: File write Error: " + std::string(strerror(errno));
-    std::cerr << errorMessage << std::endl;
-    exit(1);
-  }
-  m_flseek += bytesRead;       //Next time start reading from this position
-  int indexIntoFileBuffer = 0; //Index to specify packet starting point
-  while (indexIntoFileBuffer < bytesRead)
+  std::vector<TCPPacket *> packets; //Creating Packets to send
+  int bytesRead = 0;                // Bytes Read
+  int window = sendWindow();
+  m_sourceStarved = false;
+  while (bytesRead < window)
   {
-    int length = ((bytesRead - indexIntoFileBuffer) > MAX_PAYLOAD_LENGTH) ? MAX_PAYLOAD_LENGTH : bytesRead - indexIntoFileBuffer;
+    int length = ((window - bytesRead) > MAX_PAYLOAD_LENGTH) ? MAX_PAYLOAD_LENGTH : window - bytesRead;
+    if (m_rangeEnd != -1 && m_rangeEnd - m_flseek < length)
+      length = m_rangeEnd - m_flseek; // stop at the end of this connection's stripe
+    const char *payload;
+    uint64_t stageStarted = stageStart();
+    length = m_source->view(m_flseek, length, &payload);
+    stageStop(CLIENT_READ, stageStarted);
+    if (length == -1)
+    {
+      fail("ERROR: File read Error: " + std::string(strerror(errno)));
+      closeConnection(1);
+      break;
+    }
+    if (length == SOURCE_WOULD_BLOCK) // stream has nothing for now, the uploader waits on it
+    {
+      m_sourceStarved = true;
+      break;
+    }
+    if (length == 0) // end of file
+    {
+      m_fileRead = true;
+      break;
+    }
 
-    TCPPacket *p = createTCPPacket(fileBuffer + indexIntoFileBuffer, length);
+    stageStarted = stageStart();
+    TCPPacket *p = createTCPPacket(payload, length);
+    stageStop(CLIENT_SEGMENT, stageStarted);
     m_sequenceNumber = (m_sequenceNumber + length) % (MAX_SEQ_NUM + 1); // Updating sequence number using packet length
     packets.push_back(p);
-    indexIntoFileBuffer += length;
+    m_flseek += length; //Next time start reading from this position
+    bytesRead += length;
   }
 
-  //  Largest sequence number should be set only after sending the packet
+  m_avlblwnd -= bytesRead; // a starved stream keeps the rest of the window for later
+  if (bytesRead > 0)
+    m_probing = false;
 
-  // if(!packets.empty())
-  //   m_largestSeqNum = packets[packets.size() - 1]->getSeqNum(); //Largest Sequence Number is the sequence_no of last packet created
-  delete fileBuffer;
+  //  Largest sequence number should be set only after sending the packet
   return packets;
 }
 
 /**
  * @brief Creates TCP Packet from payload
  * 
- * @param buffer 
+ * @param buffer payload, must stay valid until the packet is deleted
  * @param length 
  * @return TCPPacket* 
  */
-TCPPacket *Client::createTCPPacket(char *buffer, int length)
+TCPPacket *Client::createTCPPacket(const char *buffer, int length)
 {
   // Ack handler
   bool ackFlag;
@@ -147,7 +155,6 @@ TCPPacket *Client::createTCPPacket(char *buffer, int length)
     ackFlag = false;
   int ackNo = ackFlag ? m_ackNumber : 0;
 
-  std::string payload = convertCStringtoStandardString(buffer, length);
   TCPPacket *p = new TCPPacket(
       m_sequenceNumber,
       ackNo,
@@ -155,27 +162,25 @@ TCPPacket *Client::createTCPPacket(char *buffer, int length)
       ackFlag,
       false,
       false,
-      payload.size(),
-      payload);
+      buffer,
+      length);
   return p;
 }
 
 /**
  * @brief Checks retransmission timer for all packets
+ *
+ * Packets are sent in buffer order and ACKed packets are shifted out from the front, so the
+ * front of m_packetDeadlines is always the earliest deadline of any unacked packet
  * 
  * @return true 
  * @return false 
  */
 bool Client::checkTimersforDrop()
 {
-  for (long unsigned int i = 0; i < m_packetTimers.size(); i++)
-  {
-    if (!checkTimer(NORMAL_TIMER, RETRANSMISSION_TIMEOUT, i) && m_packetACK[i] == false)
-    {
-      return true;
-    }
-  }
-  return false;
+  if (m_packetDeadlines.empty() || !m_sentOnce.front() || m_packetACK.front())
+    return false;
+  return m_now >= m_packetDeadlines.front();
 }
 
 /**
@@ -195,10 +200,17 @@ void Client::dropPackets()
   m_cwnd = MAX_PAYLOAD_LENGTH;
   m_avlblwnd = m_cwnd;
   m_sentOnce.clear();
-  m_packetTimers.clear();
+  m_sentCycles.clear();
+  m_packetDeadlines.clear();
   m_packetACK.clear();
   m_sequenceNumber = m_relSeqNum; // Sequence number goes to m_blseek
   m_flseek = m_blseek;            // Forward lseek goes back to m_blseek
+  m_fileRead = false;
+  if (!m_lossEpisode) // a loss parity could not repair
+    m_fecLosses++;
+  m_lossEpisode = false;
+  m_fecGroupCount = 0;
+  m_rttTiming = false; // an ACK of a packet sent twice says nothing about the round trip
 }
 
 /**
@@ -211,6 +223,8 @@ bool Client::checkTimerAndCloseConnection()
 {
   if (!checkTimer(CONNECTION_TIMER, CONNECTION_TIMEOUT))
   {
+    fail("ERROR: Connection timed out while sending " + m_fileName);
+    m_timedOut = true;
     closeConnection(1);
     return true;
   }
@@ -223,12 +237,12 @@ bool Client::checkTimerAndCloseConnection()
  * @param type 
  * @param timerLimit 
  * @param index 
- * @return true 
- * @return false 
+ * @return false once the timer has run out, or for an unknown timer type, which is reported
+ * through pollError()
  */
 bool Client::checkTimer(TimerType type, float timerLimit, int index)
 {
-  c_time current_time = std::chrono::system_clock::now();
+  c_time current_time = m_now;
   c_time start_time;
   switch (type)
   {
@@ -237,16 +251,6 @@ bool Client::checkTimer(TimerType type, float timerLimit, int index)
     start_time = m_connectionTimer;
     break;
   }
-  case NORMAL_TIMER:
-  {
-    if (index == -1)
-    {
-      std::cerr << "ERROR: Incorrect Index for Timer" << std::endl;
-      exit(1);
-    }
-    start_time = m_packetTimers[index];
-    break;
-  }
   case SYN_PACKET_TIMER:
   {
     start_time = m_synPacketTimer;
@@ -262,10 +266,15 @@ bool Client::checkTimer(TimerType type, float timerLimit, int index)
     start_time = m_finEndTimer;
     break;
   }
+  case PERSIST_TIMER:
+  {
+    start_time = m_persistTimer;
+    break;
+  }
   default:
   {
-    std::cerr << "Incorrect Timer Type" << std::endl;
-    exit(1);
+    fail("Incorrect Timer Type " + std::to_string(type));
+    return false;
   }
   }
 
@@ -275,15 +284,15 @@ bool Client::checkTimer(TimerType type, float timerLimit, int index)
 }
 
 /**
- * @brief Close Connection
+ * @brief Close Connection. The socket belongs to the uploader and stays open
  * 
  */
 void Client::closeConnection(int exitCode)
 {
-  close(m_sockFd);
-  close(m_fileFd);
-  if(exitCode != 0 )
-    exit(exitCode);
+  if (!(m_timedOut && m_options.resume)) // the source is still needed to resume the transfer
+    m_source->close();
+  m_state = CLIENT_CLOSED;
+  m_exitCode = exitCode;
   return;
 }
 
@@ -319,6 +328,39 @@ int Client::congestionControl()
   return diff;
 }
 
+/**
+ * @brief The server's receive window bounds the bytes in flight like the congestion window. A
+ * zero window lets one segment out as a probe once the persist timer ran out and nothing is in
+ * flight whose ACK could open it.
+ */
+int Client::sendWindow()
+{
+  int inFlight = (m_sequenceNumber - m_relSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  if (m_rwnd == 0 && m_probing && inFlight == 0)
+    return std::min(m_avlblwnd, MAX_PAYLOAD_LENGTH);
+  return std::min(m_avlblwnd, m_rwnd - inFlight);
+}
+
+/**
+ * @brief Takes the receive window a server packet advertises, packets of older servers advertise
+ * none. A window that closes starts the persist timer, which backs off up to PERSIST_MAX_TIMEOUT
+ * while the probes are answered with a zero window.
+ */
+void Client::updateReceiveWindow(TCPPacket *p)
+{
+  int window = p->getWindow();
+  if (window == -1)
+    return;
+  if (window == 0 && m_rwnd > 0)
+  {
+    m_persistTimeout = RETRANSMISSION_TIMEOUT;
+    setTimer(PERSIST_TIMER);
+  }
+  if (window > 0)
+    m_probing = false;
+  m_rwnd = window;
+}
+
 /**
  * @brief Shift all resources relating to the current window forward for all inorder ACKs received from the start
  *
@@ -345,11 +387,25 @@ int Client::shiftWindow(TCPPacket* p)
   // shift the values ahead
   for (int i = 0; i < shiftedIndices; i++)
   {
-    delete m_packetBuffer[0];
-    m_packetBuffer.erase(m_packetBuffer.begin());
-    m_packetACK.erase(m_packetACK.begin());
-    m_packetTimers.erase(m_packetTimers.begin());
-    m_sentOnce.erase(m_sentOnce.begin());
+    TCPPacket *acked = m_packetBuffer.front();
+    if (m_rttTiming && (acked->getSeqNum() + acked->getPayloadLength()) % (MAX_SEQ_NUM + 1) == m_rttSeqEnd)
+    {
+      // smoothed like the SRTT of RFC 6298
+      c_duration sample = m_now - m_rttSentAt;
+      m_srtt = (m_srtt == c_duration::zero()) ? sample : (m_srtt * 7 + sample) / 8;
+      m_rttTiming = false;
+      m_metrics.rttSamples++;
+    }
+    if (m_sentCycles.front() != 0)
+      stageStop(CLIENT_RTT, m_sentCycles.front());
+    if (m_checksums) // every byte is ACKed exactly once and in order
+      m_digest = crc32c(m_digest, m_packetBuffer.front()->getPayloadData(), m_packetBuffer.front()->getPayloadLength());
+    delete m_packetBuffer.front();
+    m_packetBuffer.pop_front();
+    m_packetACK.pop_front();
+    m_packetDeadlines.pop_front();
+    m_sentOnce.pop_front();
+    m_sentCycles.pop_front();
   }
 
   // the buffer was empty, the ack may have been further
@@ -379,6 +435,8 @@ int Client::shiftWindow(TCPPacket* p)
   // else 
   // {
     m_blseek += shiftedBytes;
+    m_metrics.bytesAcked += shiftedBytes;
+    m_source->release(m_blseek);
     m_relSeqNum += shiftedBytes;
     m_relSeqNum %= MAX_SEQ_NUM + 1;
   // }
@@ -392,7 +450,7 @@ int Client::markAck(TCPPacket *p)
   using namespace std;
   if (p == nullptr)
   {
-    cerr << "Unexpected nullptr found in Client::markAck" << endl;
+    fail("Unexpected nullptr found in Client::markAck");
     return PACKET_NULL;
   }
   int ack = p->getAckNum();
@@ -403,17 +461,14 @@ int Client::markAck(TCPPacket *p)
   if (m_packetBuffer.empty())
     return PACKET_DROPPED;
 
-  bool wrapAroundAck = false;
   bool validAck = false; 
   if (m_largestSeqNum == m_relSeqNum)
   {
-    std::cerr << "LargestSeq == relSeqNum, should not have happened" << std::endl;
+    fail("LargestSeq == relSeqNum, should not have happened");
     validAck = false;
   }
   else if (m_largestSeqNum < m_relSeqNum)
   {
-    if (ack <= m_largestSeqNum && ack < m_relSeqNum)
-      wrapAroundAck = true;
     validAck = (ack <= m_largestSeqNum) || (ack > m_relSeqNum);
   }
   else
@@ -426,80 +481,129 @@ int Client::markAck(TCPPacket *p)
 
   // int windowEnd = m_packetBuffer.back()->getSeqNum();
 
+  // a packet counts as ACKed only when all of its bytes are, an ACK can end inside a packet
+  // when a retransmission was cut at other boundaries than the original
+  int ackedBytes = (ack - m_relSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  int packetEnd = 0;
+  bool anyAcked = false;
   for (int i = 0; i < (int)m_packetBuffer.size(); i++)
   {
-    if (wrapAroundAck && m_packetBuffer[i]->getSeqNum() > m_largestSeqNum)
-      m_packetACK[i] = true;
-    else if (ack <= m_packetBuffer[i]->getSeqNum())
+    packetEnd += m_packetBuffer[i]->getPayloadLength();
+    if (packetEnd > ackedBytes)
       break;
-    else
-      m_packetACK[i] = true;
+    m_packetACK[i] = true;
+    anyAcked = true;
   }
+  if (!anyAcked)
+    return PACKET_DROPPED;
 
   m_firstPacketAcked = true;
   return PACKET_ADDED; // ACK changes were successfully added to the buffer
 }
 
 /**
- * @brief Gives pointer to packet to read, if available in the socket
- *
- * @return Pointer to TCPPacket struct which the caller must delete to free the memory. If
- * If socket is empty, return nullptr.
+ * @brief Time at which the timer `type` started with setTimer() runs out
  */
-TCPPacket *Client::recvPacket()
+c_time Client::timerDeadline(TimerType type, float timerLimit)
 {
-  char buffer[MAX_PACKET_LENGTH];
-  int bytes = recvfrom(m_sockFd, buffer, MAX_PACKET_LENGTH, 0, NULL, 0); // Already have the address info of the server
-  // nothing was available to read at the socket, so no new packet arrived
-  if (bytes == -1)
-    return nullptr;
+  c_time start_time;
+  switch (type)
+  {
+  case CONNECTION_TIMER:
+    start_time = m_connectionTimer;
+    break;
+  default: // packet timers are kept as deadlines in m_packetDeadlines
+    break;
+  case SYN_PACKET_TIMER:
+    start_time = m_synPacketTimer;
+    break;
+  case FIN_PACKET_TIMER:
+    start_time = m_finPacketTimer;
+    break;
+  case FIN_END_TIMER:
+    start_time = m_finEndTimer;
+    break;
+  case PERSIST_TIMER:
+    start_time = m_persistTimer;
+    break;
+  }
+  return start_time + timeoutDuration(timerLimit);
+}
 
-  std::string stringBuffer = convertCStringtoStandardString(buffer, bytes);
-  TCPPacket *p = new TCPPacket(stringBuffer);
-  return p;
+/**
+ * @brief Converts a timeout in seconds to a clock duration
+ */
+c_duration Client::timeoutDuration(float timerLimit)
+{
+  return std::chrono::duration_cast<c_duration>(std::chrono::duration<double>(timerLimit));
 }
 
 /**
- * @brief Prints the given packet
- * 
- * @param p 
- * @param recvd 
- * @param dropped 
- * @param dup 
+ * @brief Earliest timer that the connection has to act on in its current state
  */
-void Client::printPacket(TCPPacket *p, bool recvd, bool dropped, bool dup)
+c_time Client::nextDeadline()
 {
-  std::string message;
+  switch (m_state)
+  {
+  case CLIENT_SYN_SENT:
+    return std::min(timerDeadline(CONNECTION_TIMER, CONNECTION_TIMEOUT), timerDeadline(SYN_PACKET_TIMER, RETRANSMISSION_TIMEOUT));
+  case CLIENT_FIN_SENT:
+    return std::min(timerDeadline(CONNECTION_TIMER, CONNECTION_TIMEOUT), timerDeadline(FIN_PACKET_TIMER, RETRANSMISSION_TIMEOUT));
+  case CLIENT_TIME_WAIT:
+    return timerDeadline(FIN_END_TIMER, CLIENT_CONNECTION_END_TIMEOUT);
+  case CLIENT_CLOSED:
+    return c_time::max();
+  default:
+    break;
+  }
 
-  if (recvd)
-    message = "RECV";
-  else
-    message = "SEND";
+  c_time deadline = timerDeadline(CONNECTION_TIMER, CONNECTION_TIMEOUT);
+  if (!m_packetDeadlines.empty() && m_sentOnce.front() && !m_packetACK.front())
+    deadline = std::min(deadline, m_packetDeadlines.front());
+  if (m_rwnd == 0)
+    deadline = std::min(deadline, timerDeadline(PERSIST_TIMER, m_persistTimeout));
+  return deadline;
+}
 
-  if (recvd && dropped)
-    message = "DROP";
+/**
+ * @brief Whether sendData() can make progress right now, i.e. the uploader must not block
+ */
+bool Client::canSend()
+{
+  if (m_state != CLIENT_ESTABLISHED)
+    return false;
+  return (sendWindow() > 0 && !m_fileRead && !m_sourceStarved) || (m_fileRead && allPacketsAcked());
+}
 
-  message = message + " " + std::to_string(p->getSeqNum()) + " " + std::to_string(p->getAckNum()) + " " + std::to_string(p->getConnId()) + " ";
-  if (!dropped)
-    message += std::to_string(m_cwnd) + " " + std::to_string(m_ssthresh) + " ";
-  if (p->isACK())
-    message += "ACK ";
-  if (p->isSYN())
-    message += "SYN ";
-  if (p->isFIN())
-    message += "FIN ";
-  if (dup && !recvd)
-    message += "DUP ";
+int Client::pollFd()
+{
+  if (m_state != CLIENT_ESTABLISHED || !m_sourceStarved)
+    return -1;
+  return m_source->pollFd();
+}
+
+/**
+ * @brief Adds the packet to the log with the windows as they are now, like the line
+ * traceLine() prints for it
+ */
+void Client::logPacket(TCPPacket *p, bool recvd, bool dropped, bool dup)
+{
+  if (m_packetLog)
+    m_log.push_back(tracePacketRecord(traceEvent(recvd, dropped, dup), p, m_cwnd, m_ssthresh));
+}
 
-  // message += "Payload: " + std::to_string(p->getPayloadLength()) + " ";
-  message.pop_back(); // remove the trailing space
-  std::cout << message << std::endl;
+void Client::fail(std::string message)
+{
+  m_errors.push_back(message);
 }
 
 bool Client::verifySynAck(TCPPacket *synAckPacket)
 {
-  return synAckPacket->getSeqNum() == INIT_SERVER_SEQ_NUM &&
-         synAckPacket->getAckNum() == INIT_CLIENT_SEQ_NUM + 1 &&
+  // the ACK covers the data in the SYN if the server took it. A SYN cookie has connection ID 0
+  // and the cookie as its sequence number.
+  int earlyDataAck = (m_initialSeqNum + 1 + m_options.earlyData.size()) % (MAX_SEQ_NUM + 1);
+  return (synAckPacket->getSeqNum() == INIT_SERVER_SEQ_NUM || synAckPacket->getConnId() == 0) &&
+         (synAckPacket->getAckNum() == (m_initialSeqNum + 1) % (MAX_SEQ_NUM + 1) || synAckPacket->getAckNum() == earlyDataAck) &&
          synAckPacket->isACK() == true &&
          synAckPacket->isSYN() == true &&
          synAckPacket->isFIN() == false;
@@ -515,99 +619,159 @@ bool Client::verifyFinAck(TCPPacket *finAckPacket)
 }
 
 /**
- * @brief This performs a 2 way handshake (i.e Client sends a syn packet to the server and server sends
- * back a syn-ack packet). The Client will then set the ack flag on for the first packet sent with payload
- * to the server. This function is blocking and will not return until connection is established. 
- * 
- * It will set a timer for 10s and if no reply comes from the server it will also call closeConnection()
- * 
- * If this function returns then this means that a connection is established with the client. 
+ * @brief Starts the 2 way handshake by sending the SYN (i.e Client sends a syn packet to the server and
+ * server sends back a syn-ack packet). The Client will then set the ack flag on for the first packet
+ * sent with payload to the server.
+ *
+ * The SYN is retransmitted from handleTimers() and the SYN-ACK is processed in handlePacket()
  */
-void Client::handshake()
+void Client::start()
 {
+  // fill the rest of the SYN with data, unless it is resumed from an offset the server decides
+  if (m_sendEarlyData && !m_options.resume)
+  {
+    int length = MAX_PAYLOAD_LENGTH - m_options.encode().size() - EARLY_DATA_OPTION_LEN;
+    if (m_rangeEnd != -1 && m_rangeEnd - m_flseek < length)
+      length = m_rangeEnd - m_flseek;
+    const char *data;
+    if (length > 0 && (length = m_source->view(m_flseek, length, &data)) > 0)
+      m_options.earlyData.assign(data, length);
+  }
+
   // Create the SYN packet
-  TCPPacket *synPacket = new TCPPacket(
-      m_sequenceNumber, // sequence number
-      m_ackNumber,      // ack number
-      m_connectionId,   // connection id
-      false,            // is not an ACK
-      true,             // is SYN
-      false,            // is not FIN
-      0,                // no payload
-      "");
+  std::string synPayload = m_options.encode();
+  m_synPacket = new TCPPacket(
+      m_sequenceNumber,  // sequence number
+      m_ackNumber,       // ack number
+      m_connectionId,    // connection id
+      false,             // is not an ACK
+      true,              // is SYN
+      false,             // is not FIN
+      synPayload.size(), // connection options only
+      synPayload);
 
   // send the packet to server
-  sendPacket(synPacket);
-  printPacket(synPacket, false, false, false);
+  sendPacket(m_synPacket);
+  logPacket(m_synPacket, false, false, false);
   m_largestSeqNum = (m_sequenceNumber + 1) % (MAX_SEQ_NUM + 1);
   m_sequenceNumber = (m_sequenceNumber + 1) % (MAX_SEQ_NUM + 1); // as syn is 1 byte
 
+  m_startTime = m_now;
   setTimer(CONNECTION_TIMER); // set the connection timer as the first packet
   setTimer(SYN_PACKET_TIMER); // set the syn packet timer
+  m_state = CLIENT_SYN_SENT;
+}
 
-  TCPPacket *synAckPacket = nullptr;
-  while (true)
-  {
-    synAckPacket = recvPacket(); // recv the synAck packet
-
-    // if packet received and is in good form then break from loop
-    if (synAckPacket != nullptr && verifySynAck(synAckPacket))
-    {
-      // reset connection timer as packet received
-      setTimer(CONNECTION_TIMER);
-      printPacket(synAckPacket, true, false, false);
-      break; // received valid syn-ack packet -> now process it
-    }
-
-    // if connection timeout -> close connection
-    if (!checkTimer(CONNECTION_TIMER, CONNECTION_TIMEOUT))
-    {
-      // delete syn and synAck ptrs
-      // NOTE: synAck doesn't need to be deleted except in the rare case
-      // when I receive an ill formed synAck packet
-      delete synPacket;
-      synPacket = nullptr;
-      delete synAckPacket;
-      synAckPacket = nullptr;
+/**
+ * @brief Processes the SYN-ACK of the server. If this returns true then a connection is established
+ * and the first packet can be sent with payload.
+ */
+bool Client::handshake(TCPPacket *synAckPacket)
+{
+  // if packet is not in good form then ignore it
+  if (!verifySynAck(synAckPacket))
+    return false;
 
-      closeConnection(1);
-      return;
-    }
+  // reset connection timer as packet received
+  setTimer(CONNECTION_TIMER);
+  logPacket(synAckPacket, true, false, false);
 
-    // if connection timeout -> close connection
-    if (!checkTimer(SYN_PACKET_TIMER, RETRANSMISSION_TIMEOUT))
-    {
-      // send packets and reset timers
-      sendPacket(synPacket);
-      printPacket(synPacket, false, false, true);
-      setTimer(SYN_PACKET_TIMER);
-    }
+  // a busy server opens the connection once the SYN comes again with its cookie
+  if (synAckPacket->getConnId() == 0)
+  {
+    std::string synPayload = m_synPacket->getPayload();
+    delete m_synPacket;
+    m_synPacket = new TCPPacket(m_initialSeqNum, (synAckPacket->getSeqNum() + 1) % (MAX_SEQ_NUM + 1), 0, true, true, false, synPayload.size(),
+                                synPayload);
+    sendPacket(m_synPacket);
+    logPacket(m_synPacket, false, false, false);
+    setTimer(SYN_PACKET_TIMER);
+    return false;
   }
 
-  /* 
-    if we reach here then this means that client has received
-    the syn ack packet in valid form
-    this implies that the work of handshake is done and now the 
-    first packet can be sent with payload.
-  */
+  updateReceiveWindow(synAckPacket);
 
   // set connection Id and ack no.
   m_ackNumber = (synAckPacket->getSeqNum() + 1) % (MAX_SEQ_NUM + 1); // +1 as SYN-ACK packet is 1 byte
   m_connectionId = synAckPacket->getConnId();
   m_relSeqNum = synAckPacket->getAckNum();
-  // delete syn and syn-ack packets
-  delete synPacket;
-  synPacket = nullptr;
-  delete synAckPacket;
-  synAckPacket = nullptr;
+  // syn packet is not needed anymore
+  delete m_synPacket;
+  m_synPacket = nullptr;
+  m_state = CLIENT_ESTABLISHED;
+
+  // the server echoes the options it accepted
+  ConnectionOptions accepted;
+  accepted.decode(synAckPacket->getPayload());
+  if (m_options.stripe && !accepted.stripe)
+  {
+    fail("ERROR: Server does not support striped transfers");
+    closeConnection(1);
+    return false;
+  }
+  if (m_options.compression != CODEC_NONE && accepted.compression != m_options.compression)
+  {
+    fail("ERROR: Server does not support compressed transfers");
+    closeConnection(1);
+    return false;
+  }
+  if (m_options.session && !accepted.session)
+  {
+    fail("ERROR: Server does not support sessions");
+    closeConnection(1);
+    return false;
+  }
+  m_checksums = accepted.checksums;
+  if (m_options.checksums && !m_checksums)
+  {
+    fail("ERROR: Server does not support checksums");
+    closeConnection(1);
+    return false;
+  }
+  // nothing goes out in the clear once the SYN-ACK is in
+  if (m_options.aead != AEAD_NONE)
+  {
+    m_cipher = new PacketCipher();
+    if (accepted.aead != m_options.aead || !m_cipher->setup((AeadCipher)accepted.aead, m_sharedKey, m_options.aeadRandom, accepted.aeadRandom, true))
+    {
+      fail("ERROR: Server does not support encryption");
+      delete m_cipher;
+      m_cipher = nullptr;
+      closeConnection(1);
+      return false;
+    }
+  }
+  // data in the SYN that the server took is not sent again, otherwise it goes out as usual
+  if (m_relSeqNum != (m_initialSeqNum + 1) % (MAX_SEQ_NUM + 1))
+  {
+    m_sequenceNumber = m_relSeqNum;
+    m_largestSeqNum = m_relSeqNum;
+    m_blseek += m_options.earlyData.size();
+    m_flseek = m_blseek;
+    m_source->release(m_blseek);
+    m_metrics.bytesSent += m_options.earlyData.size();
+    m_metrics.bytesAcked += m_options.earlyData.size();
+    if (m_checksums)
+      m_digest = crc32c(m_digest, m_options.earlyData.data(), m_options.earlyData.size());
+  }
+
+  // without forward error correction at the server the transfer simply runs without it
+  m_fecMinGroup = (m_options.fecGroup != 0) ? accepted.fecGroup : 0;
+  m_fecGroup = m_fecMinGroup;
+  // continue after the bytes the server already has, it never has less than was ACKed
+  if (m_options.resume && accepted.resume && accepted.resumeToken == m_options.resumeToken && accepted.resumeOffset > 0)
+  {
+    m_blseek = accepted.resumeOffset;
+    m_flseek = accepted.resumeOffset;
+    m_source->release(m_blseek);
+  }
+  return true;
 }
 
 /**
- * @brief This performs a 4 way handwave at the end to gracefully
+ * @brief This starts the 4 way handwave at the end to gracefully
  * close the connection. This function is called when the entire 
- * file is read. 
- * 
- * this will be called in run
+ * file is read and ACKed.
  */
 void Client::handwave()
 {
@@ -615,83 +779,81 @@ void Client::handwave()
   // NOTE: I am assuming that m_sequence here is the next available
   // sequence number that I can send in the fin packet (so I won't
   // increment it by 1)
-  // Create the FIN packet
-  TCPPacket *finPacket = new TCPPacket(
-      m_sequenceNumber, // sequence number
-      0,                // ack number is 0 as ack flag is not set
-      m_connectionId,   // connection id
-      false,            // is not an ACK
-      false,            // is not SYN
-      true,             // is FIN
-      0,                // no payload
-      "");
+  // Create the FIN packet, with checksums it carries the digest of everything the server ACKed
+  std::string finPayload;
+  if (m_checksums)
+  {
+    uint32_t digest = htonl(m_digest);
+    finPayload = std::string((char *)&digest, sizeof(digest));
+  }
+  m_finPacket = new TCPPacket(
+      m_sequenceNumber,  // sequence number
+      0,                 // ack number is 0 as ack flag is not set
+      m_connectionId,    // connection id
+      false,             // is not an ACK
+      false,             // is not SYN
+      true,              // is FIN
+      finPayload.size(), // digest only
+      finPayload);
 
   m_sequenceNumber = (m_sequenceNumber + 1) % (MAX_SEQ_NUM + 1);
 
   // send the packet to server
-  sendPacket(finPacket);
-  printPacket(finPacket, false, false, false);
+  sendPacket(m_finPacket);
+  logPacket(m_finPacket, false, false, false);
   setTimer(FIN_PACKET_TIMER); // set the fin packet timer
+  m_source->close();          // everything has been ACKed
+  m_state = CLIENT_FIN_SENT;
+}
 
-  // NOTE: We need to handle both the cases when server
-  // just sends ack or sends fin-ack combined
-  TCPPacket *ackPacket;
-  while (true)
-  {
-    ackPacket = recvPacket(); // recv the ack/fin-ack packet
-
-    // if packet received and is in good form then break from loop
-    if (ackPacket != nullptr && ackPacket->isFIN())
-    {
-      // reset connection timer as packet received
-      setTimer(CONNECTION_TIMER);
+/**
+ * @brief Handles a packet of the server while waiting for its FIN (FIN_SENT) or during the
+ * final 2 second wait (TIME_WAIT)
+ *
+ * NOTE: We need to handle both the cases when server
+ * just sends ack or sends fin-ack combined
+ */
+void Client::handleFin(TCPPacket *ackPacket)
+{
+  if (!ackPacket->isFIN())
+    return; // plain ack of our fin, keep waiting for the fin
 
-      // set the 2 sec timer at the end
-      setTimer(FIN_END_TIMER);
+  if (m_state == CLIENT_TIME_WAIT)
+  {
+    /*
+      On piazza it says that for every Fin recieved in the 2s, 
+      client sends an ack 
+    */
+    logPacket(ackPacket, true, false, false);
+    sendPacket(m_clientAckPacket);
+    logPacket(m_clientAckPacket, false, false, true);
+    return;
+  }
 
-      // update seq no. and ack no.
-      m_ackNumber = (ackPacket->getSeqNum() + 1) % (MAX_SEQ_NUM + 1); // +1 as ACK packet is 1 byte
-      m_sequenceNumber = ackPacket->getAckNum();                      // set the sequence no. for the next ack packet to be sent by client (NOT NEEDED JUST ASSURANCE)
-      printPacket(ackPacket, true, false, false);
-      break; // received valid ack packet -> now process it
-    }
+  // reset connection timer as packet received
+  setTimer(CONNECTION_TIMER);
 
-    // if connection timeout -> close connection
-    if (!checkTimer(CONNECTION_TIMER, CONNECTION_TIMEOUT))
-    {
-      // delete syn and synAck ptrs
-      // NOTE: synAck doesn't need to be deleted except in the rare case
-      // when I receive an ill formed synAck packet
-      delete finPacket;
-      finPacket = nullptr;
-      delete ackPacket;
-      ackPacket = nullptr;
+  // set the 2 sec timer at the end
+  setTimer(FIN_END_TIMER);
 
-      closeConnection(1);
-      return;
-    }
+  // update seq no. and ack no.
+  m_ackNumber = (ackPacket->getSeqNum() + 1) % (MAX_SEQ_NUM + 1); // +1 as ACK packet is 1 byte
+  m_sequenceNumber = ackPacket->getAckNum();                      // set the sequence no. for the next ack packet to be sent by client (NOT NEEDED JUST ASSURANCE)
+  logPacket(ackPacket, true, false, false);
 
-    // if connection timeout -> close connection
-    if (!checkTimer(FIN_PACKET_TIMER, RETRANSMISSION_TIMEOUT))
+  // the server confirms the data with its own digest
+  if (m_checksums)
+  {
+    uint32_t digest = htonl(m_digest);
+    if (ackPacket->getPayload() != std::string((char *)&digest, sizeof(digest)))
     {
-      // send packets and reset timers
-      sendPacket(finPacket);
-      printPacket(finPacket, false, false, true);
-      setTimer(FIN_PACKET_TIMER);
+      fail("ERROR: Digest mismatch, the server's copy of " + m_fileName + " is corrupt");
+      m_exitCode = 1;
     }
   }
 
-  // if reach here then ack or fin ack recevied
-
-  // if fin not received -> receive fin
-  /*
-    On piazza it says that for every Fin recieved in the 2s, 
-    client sends an ack 
-  */
-  bool serverFinRevd = ackPacket->isFIN();
-
   // create ACK PACKET
-  TCPPacket *clientAckPacket = new TCPPacket(
+  m_clientAckPacket = new TCPPacket(
       m_sequenceNumber, // sequence number
       m_ackNumber,      // ack number set as this is an ack packet
       m_connectionId,   // connection id
@@ -701,45 +863,63 @@ void Client::handwave()
       0,                // no payload
       "");
 
-  if (serverFinRevd)
+  // send ack packet
+  sendPacket(m_clientAckPacket);
+  logPacket(m_clientAckPacket, false, false, false);
+  // NOTE: NO retransmission timers need to set
+  // we only retransmit if we recieve a fin
+  m_state = CLIENT_TIME_WAIT;
+}
+
+/**
+ * @brief XORs a newly sent segment into the open parity group. Groups are made of full
+ * segments that follow each other; once a group holds m_fecGroup segments its parity goes
+ * out with the group size in header byte 10. Parity takes no sequence space and is never
+ * retransmitted.
+ */
+void Client::addToParity(TCPPacket *p)
+{
+  m_fecSent++;
+  if (p->getPayloadLength() != MAX_PAYLOAD_LENGTH) // the short last segment is left unprotected
   {
-    // send ack packet
-    sendPacket(clientAckPacket);
-    printPacket(clientAckPacket, false, false, false);
-    // NOTE: NO retransmission timers need to set
-    // we only retransmit if we recieve a fin
+    m_fecGroupCount = 0;
+    return;
   }
 
-  TCPPacket *serverFinPacket;
-  while (true)
+  int nextSeqNum = (m_fecGroupStart + m_fecGroupCount * MAX_PAYLOAD_LENGTH) % (MAX_SEQ_NUM + 1);
+  if (m_fecGroupCount == 0 || p->getSeqNum() != nextSeqNum)
   {
-    if (!checkTimer(FIN_END_TIMER, CLIENT_CONNECTION_END_TIMEOUT))
-      break;
-    serverFinPacket = recvPacket(); // recv the fin packet
-
-    // if packet received and is in good form then break from loop
-    if (serverFinPacket != nullptr && serverFinPacket->isFIN())
-    {
-      printPacket(serverFinPacket, true, false, false);
-      sendPacket(clientAckPacket);
-      printPacket(clientAckPacket, false, false, true);
-      delete serverFinPacket;
-      serverFinPacket = nullptr;
-    }
+    adaptFecGroup();
+    m_fecGroupStart = p->getSeqNum();
+    m_fecGroupCount = 0;
+    m_fecParity.assign(MAX_PAYLOAD_LENGTH, 0);
   }
 
-  // if we reach here close connection and free memory
-  delete finPacket;
-  finPacket = nullptr;
-  delete ackPacket;
-  ackPacket = nullptr;
-  delete clientAckPacket;
-  clientAckPacket = nullptr;
-  delete serverFinPacket;
-  serverFinPacket = nullptr;
+  const char *payload = p->getPayloadData();
+  for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+    m_fecParity[i] ^= payload[i];
+  if (++m_fecGroupCount < m_fecGroup)
+    return;
 
-  closeConnection();
-  return;
+  TCPPacket parity(m_fecGroupStart, 0, m_connectionId, false, false, false, MAX_PAYLOAD_LENGTH, m_fecParity);
+  parity.setFecGroup(m_fecGroup);
+  sendPacket(&parity, true);
+  m_fecGroupCount = 0;
+}
+
+/**
+ * @brief Sizes the parity groups so that about two groups pass per loss, within the group
+ * size the server accepted and FEC_MAX_GROUP. One parity segment repairs one loss per group.
+ */
+void Client::adaptFecGroup()
+{
+  if (m_fecSent < FEC_ADAPT_PACKETS)
+    return;
+  m_lossRate = (m_lossRate + (double)m_fecLosses / m_fecSent) / 2;
+  int group = (m_lossRate > 0) ? (int)(1 / (2 * m_lossRate)) : FEC_MAX_GROUP;
+  m_fecGroup = std::max(m_fecMinGroup, std::min(FEC_MAX_GROUP, group));
+  m_fecSent = 0;
+  m_fecLosses = 0;
 }
 
 /**
@@ -754,14 +934,16 @@ void Client::addToBuffers(std::vector<TCPPacket *> packets)
   {
     m_packetBuffer.push_back(packet);
     m_packetACK.push_back(false);
-    m_packetTimers.push_back(std::chrono::system_clock::now()); // setting to now as no default value of c_time
+    m_packetDeadlines.push_back(m_now); // set for real when the packet is sent
     m_sentOnce.push_back(false);
+    m_sentCycles.push_back(0);
   }
 }
 
 /**
  * @brief This functions send all the packets that haven't been sent even once to the server 
  * It utilizes the bool values in m_sentOnce buffers to send the packets that haven't been sent even once
+ * With segmentation offload consecutive packets are handed to the kernel as one buffer, see queueSegment()
  * 
  * The function then determines if a packet is a dup or not
  */
@@ -774,12 +956,17 @@ int Client::sendPackets()
     // We send the packets which are marked as false in sentOnce
     if (!m_sentOnce[i])
     {
-      sendPacket(m_packetBuffer[i]);
+      uint64_t sentAt = stageStart();
+      if (m_segmentationOffload)
+        queueSegment(m_packetBuffer[i]);
+      else
+        sendPacket(m_packetBuffer[i]);
       count++;                                              // send packets
       m_sentOnce[i] = true;                                 // set sentOnce to true
-      m_packetTimers[i] = std::chrono::system_clock::now(); // start timer
+      m_packetDeadlines[i] = m_now + m_rto;                 // start timer
 
       bool isDuplicate = isDup(m_packetBuffer[i]); // check if the packet is a duplicate packet;
+      m_sentCycles[i] = isDuplicate ? 0 : sentAt;
       // I have seen the largest sequence to this point
       // NOW if i send it again, THEN It's a duplicate
       // if (m_largestSeqNum <= m_packetBuffer[i]->getSeqNum())
@@ -790,10 +977,32 @@ int Client::sendPackets()
       //     (m_largestSeqNum < m_relSeqNum && m_largestSeqNum <= seqNum && seqNum < m_relSeqNum) 
       // )
       if (!isDuplicate)
+      {
         m_largestSeqNum = (m_packetBuffer[i]->getSeqNum() + m_packetBuffer[i]->getPayloadLength()) % (MAX_SEQ_NUM + 1) ; 
-      printPacket(m_packetBuffer[i], false, false, isDuplicate);
+        m_metrics.packetsSent++;
+        m_metrics.bytesSent += m_packetBuffer[i]->getPayloadLength();
+        if (!m_rttTiming)
+        {
+          m_rttTiming = true;
+          m_rttSeqEnd = m_largestSeqNum;
+          m_rttSentAt = m_now;
+        }
+      }
+      else
+      {
+        m_metrics.retransmissions++;
+        m_metrics.bytesRetransmitted += m_packetBuffer[i]->getPayloadLength();
+        // a retransmission cut at other boundaries than the original can reach past the largest byte sent
+        int packetEnd = (m_packetBuffer[i]->getSeqNum() + m_packetBuffer[i]->getPayloadLength()) % (MAX_SEQ_NUM + 1);
+        if ((packetEnd - m_relSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1) > (m_largestSeqNum - m_relSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1))
+          m_largestSeqNum = packetEnd;
+      }
+      logPacket(m_packetBuffer[i], false, false, isDuplicate);
+      if (!isDuplicate && m_fecGroup != 0) // retransmissions are not protected again
+        addToParity(m_packetBuffer[i]);
     }
   }
+  flushSegments();
 
   return count;
 }
@@ -821,29 +1030,155 @@ bool Client::isDup(TCPPacket *p)
 }
 
 /**
- * @brief sends TCP packet 
+ * @brief Queues a TCP packet for sending, as a run of its own
+ *
+ * The header and the payload go out as two iovecs so the payload is handed to the
+ * kernel straight from the file source
  * 
  * @param p The TCP Packet to send 
- * @return int bytes send 
+ * @param copy the packet does not outlive the call, its bytes go into the run
  */
-int Client::sendPacket(TCPPacket *p)
+void Client::sendPacket(TCPPacket *p, bool copy)
 {
-  int packetLength;
-  char *packetCString;
-  int bytesSent;
-
-  packetCString = p->getCString(packetLength);
   if (p == nullptr)
+    return;
+  flushSegments();
+  sendSegments(&p, 1, copy);
+}
+
+/**
+ * @brief Bytes of the datagram of `p`: header, payload and, with checksums or encryption, the trailer
+ */
+int Client::wireLength(TCPPacket *p)
+{
+  if (p->isSYN())
+    return HEADER_LEN + p->getPayloadLength();
+  return HEADER_LEN + p->getPayloadLength() + (m_checksums ? CHECKSUM_LEN : 0) + (m_cipher != nullptr ? AEAD_TRAILER_LEN : 0);
+}
+
+/**
+ * @brief Queues `p` behind the packets waiting for a segmented send. The kernel cuts a
+ * segmented send into datagrams of one size and only the last may be shorter, so a packet that
+ * is longer than the first, or follows a short one, or one too many, queues the run first.
+ */
+void Client::queueSegment(TCPPacket *p)
+{
+  if (!m_segments.empty())
   {
-    return -1;
+    int segmentSize = wireLength(m_segments.front());
+    if ((int)m_segments.size() == GSO_MAX_SEGMENTS || wireLength(p) > segmentSize || wireLength(m_segments.back()) < segmentSize)
+      flushSegments();
   }
-  bytesSent = sendto(m_sockFd, packetCString, packetLength, 0, m_serverInfo.ai_addr, m_serverInfo.ai_addrlen);
-  if ((bytesSent == -1))
+  m_segments.push_back(p);
+}
+
+void Client::flushSegments()
+{
+  if (m_segments.empty())
+    return;
+  sendSegments(m_segments.data(), m_segments.size());
+  m_segments.clear();
+}
+
+/**
+ * @brief Queues `count` packets as one Transmit for the driver, which sends them back to back
+ * in one sendmsg with UDP_SEGMENT set to the length of the first if there are several.
+ * Transmits are reused once the driver has taken them, so the steady state allocates nothing.
+ */
+void Client::sendSegments(TCPPacket **packets, int count, bool copy)
+{
+  if (m_transmitCount == (int)m_transmits.size())
+    m_transmits.emplace_back();
+  Transmit &t = m_transmits[m_transmitCount++];
+  t.iov.clear();
+  t.datagrams = count;
+  t.segmentSize = wireLength(packets[0]);
+
+  // every byte the iovecs can not point at in place goes into the scratch of the run
+  size_t scratchBytes = 0;
+  for (int i = 0; i < count; i++)
   {
-    std::string errorMessage = "Packet send Error: " + std::string(strerror(errno));
-    std::cerr << "ERROR: " << errorMessage << std::endl;
+    TCPPacket *p = packets[i];
+    if (m_cipher != nullptr && !p->isSYN())
+      scratchBytes += p->getPayloadLength() + AEAD_TRAILER_LEN;
+    else if (m_checksums && !p->isSYN())
+      scratchBytes += CHECKSUM_LEN;
+    if (copy)
+      scratchBytes += HEADER_LEN + p->getPayloadLength();
+  }
+  t.scratch.resize(scratchBytes);
+  char *scratch = t.scratch.data();
+
+  for (int i = 0; i < count; i++)
+  {
+    TCPPacket *p = packets[i];
+    const char *header = p->getHeader();
+    const char *payload = p->getPayloadData();
+    if (copy)
+    {
+      memcpy(scratch, header, HEADER_LEN);
+      memcpy(scratch + HEADER_LEN, payload, p->getPayloadLength());
+      header = scratch;
+      payload = scratch + HEADER_LEN;
+      scratch += HEADER_LEN + p->getPayloadLength();
+    }
+    t.iov.push_back({(void *)header, HEADER_LEN});
+
+    // encrypted, the payload is sealed from the source into the scratch and leaves from there;
+    // one call per packet with the context keyed at the handshake, see PacketCipher
+    if (m_cipher != nullptr && !p->isSYN())
+    {
+      int sealedLength = m_cipher->seal(header, payload, p->getPayloadLength(), scratch);
+      t.iov.push_back({scratch, (size_t)sealedLength});
+      scratch += sealedLength;
+      continue;
+    }
+    if (p->getPayloadLength() > 0)
+      t.iov.push_back({(void *)payload, (size_t)p->getPayloadLength()});
+
+    // with checksums every packet after the SYN ends in the CRC32C of header and payload
+    if (m_checksums && !p->isSYN())
+    {
+      uint32_t trailer = htonl(crc32c(crc32c(0, header, HEADER_LEN), payload, p->getPayloadLength()));
+      memcpy(scratch, &trailer, CHECKSUM_LEN);
+      t.iov.push_back({scratch, CHECKSUM_LEN});
+      scratch += CHECKSUM_LEN;
+    }
   }
-  return bytesSent;
+}
+
+/**
+ * @brief Hands out the queued runs in order. Once all were handed out the queue starts over, so
+ * a run stays valid until the next call into the client.
+ */
+Transmit *Client::pollTransmit()
+{
+  if (m_transmitsPolled < m_transmitCount)
+    return &m_transmits[m_transmitsPolled++];
+  m_transmitCount = 0;
+  m_transmitsPolled = 0;
+  return nullptr;
+}
+
+bool Client::pollLog(TraceRecord &record)
+{
+  if (m_logPolled < m_log.size())
+  {
+    record = m_log[m_logPolled++];
+    return true;
+  }
+  m_log.clear();
+  m_logPolled = 0;
+  return false;
+}
+
+bool Client::pollError(std::string &message)
+{
+  if (m_errors.empty())
+    return false;
+  message = m_errors.front();
+  m_errors.pop_front();
+  return true;
 }
 
 // SYN_PACKET_TIMER,
@@ -861,22 +1196,26 @@ void Client::setTimer(TimerType type, int index)
   {
   case SYN_PACKET_TIMER:
     /* code */
-    m_synPacketTimer = std::chrono::system_clock::now();
+    m_synPacketTimer = m_now;
     break;
 
   case CONNECTION_TIMER:
     /* code */
-    m_connectionTimer = std::chrono::system_clock::now();
+    m_connectionTimer = m_now;
     break;
 
   case FIN_PACKET_TIMER:
     /* code */
-    m_finPacketTimer = std::chrono::system_clock::now();
+    m_finPacketTimer = m_now;
     break;
 
   case FIN_END_TIMER:
     /* code */
-    m_finEndTimer = std::chrono::system_clock::now();
+    m_finEndTimer = m_now;
+    break;
+
+  case PERSIST_TIMER:
+    m_persistTimer = m_now;
     break;
 
   default:
@@ -886,88 +1225,258 @@ void Client::setTimer(TimerType type, int index)
 
 bool Client::allPacketsAcked()
 {
-  for (auto i : m_packetACK)
+  // ACKs are cumulative, so the last packet being ACKed means all of them are
+  return m_packetACK.empty() || m_packetACK.back();
+}
+
+/**
+ * @brief Dispatches a packet received from the server according to the connection state.
+ * The caller keeps ownership of the packet.
+ */
+void Client::handlePacket(TCPPacket *p)
+{
+  switch (m_state)
   {
-    if (!i)
-      return false;
+  case CLIENT_SYN_SENT:
+    handshake(p);
+    break;
+
+  case CLIENT_ESTABLISHED:
+  {
+    setTimer(CONNECTION_TIMER); // received a message from the server, reset the connection timer
+    updateReceiveWindow(p); // also from duplicate ACKs, they may open the window
+
+    uint64_t stageStarted = stageStart();
+    int packetStatus = markAck(p);
+    stageStop(CLIENT_ACK, stageStarted);
+
+    bool packetDropped = packetStatus == PACKET_DROPPED;
+    logPacket(p, true, packetDropped, false);
+    if (packetDropped)
+    {
+      m_metrics.duplicateAcks++;
+      // the first duplicate ACK of a run reports a hole, which parity may fill before the timeout
+      if (p->getAckNum() == m_relSeqNum && !m_packetBuffer.empty() && !m_lossEpisode)
+      {
+        m_fecLosses++;
+        m_lossEpisode = true;
+      }
+      break;
+    }
+    m_lossEpisode = false;
+    stageStarted = stageStart();
+    int shifted = shiftWindow(p);
+    stageStop(CLIENT_WINDOW, stageStarted);
+    stageStarted = stageStart();
+    int cwndChange = congestionControl();
+    stageStop(CLIENT_CONGESTION, stageStarted);
+    m_avlblwnd += shifted + cwndChange;
+    break;
+  }
+
+  case CLIENT_FIN_SENT:
+  case CLIENT_TIME_WAIT:
+    handleFin(p);
+    break;
+
+  default:
+    break;
   }
-  return true;
 }
 
 /**
- * @brief Entry point for running client services
- * 
+ * @brief Acts on every timer that has run out in the current state
+ *
+ * connection closing here were close due to timeout and will
+ * not involve sending of any fin packets
  */
-void Client::run()
+void Client::handleTimers()
 {
-
-  using namespace std;
-  handshake();
-  while (true)
+  switch (m_state)
   {
-    // connection closing here were close due to timeout and will
-    // not involve sending of any fin packets
+  case CLIENT_SYN_SENT:
     if (checkTimerAndCloseConnection())
       return;
-    bool drop = checkTimersforDrop();
-    if (drop)
+    if (!checkTimer(SYN_PACKET_TIMER, RETRANSMISSION_TIMEOUT))
+    {
+      // send packets and reset timers
+      sendPacket(m_synPacket);
+      logPacket(m_synPacket, false, false, true);
+      setTimer(SYN_PACKET_TIMER);
+    }
+    break;
+
+  case CLIENT_ESTABLISHED:
+    if (checkTimerAndCloseConnection())
+      return;
+    if (checkTimersforDrop())
     {
       m_avlblwnd = MAX_PAYLOAD_LENGTH; // reset available window to 1 packet size in case of drop
       dropPackets();
     }
-    vector<TCPPacket *> newPackets = readAndCreateTCPPackets();
-    if (newPackets.size() == 0 && allPacketsAcked())
+    if (m_rwnd == 0 && !checkTimer(PERSIST_TIMER, m_persistTimeout))
     {
-      break; // reached end of file, nothing more to read, and nothing new to receive
+      m_probing = true; // the ACK of the probe says whether the window opened
+      m_persistTimeout = std::min(2 * m_persistTimeout, PERSIST_MAX_TIMEOUT);
+      setTimer(PERSIST_TIMER);
     }
+    break;
 
-    addToBuffers(newPackets);
-    sendPackets();
-    m_avlblwnd = 0;
-    // recvs only 1 packet per iteration of the loop
-    TCPPacket *p;
-    while ((p = recvPacket()) != nullptr)
+  case CLIENT_FIN_SENT:
+    if (checkTimerAndCloseConnection())
+      return;
+    if (!checkTimer(FIN_PACKET_TIMER, RETRANSMISSION_TIMEOUT))
     {
-      setTimer(CONNECTION_TIMER); // received a message from the server, reset the connection timer
-
-      // call handle fin
-      int packetStatus = markAck(p);
-
-      bool packetDropped = packetStatus == PACKET_DROPPED;
-      printPacket(p, true, packetDropped, false);
-      if (packetDropped) 
-        continue; 
-      int shifted = shiftWindow(p);
-      int cwndChange = congestionControl();
-      if (packetDropped)
-        cwndChange = 0;
-      m_avlblwnd += shifted + cwndChange;
-      p = nullptr;
+      // send packets and reset timers
+      sendPacket(m_finPacket);
+      logPacket(m_finPacket, false, false, true);
+      setTimer(FIN_PACKET_TIMER);
     }
+    break;
+
+  case CLIENT_TIME_WAIT:
+    if (!checkTimer(FIN_END_TIMER, CLIENT_CONNECTION_END_TIMEOUT))
+      closeConnection(m_exitCode); // a digest mismatch in the FIN exchange already set it
+    break;
+
+  default:
+    break;
   }
-  handwave();
 }
 
-int main(int argc, char *argv[])
+/**
+ * @brief Reads the available window from the file and sends it. Once the file is read
+ * and every packet is ACKed the handwave is started.
+ */
+void Client::sendData()
 {
-  using namespace std;
-  if (argc != 4)
-  {
-    cerr << "ERROR: Incorrect number of arguments provided!" << endl;
-    exit(1);
-  }
+  if (m_state != CLIENT_ESTABLISHED)
+    return;
 
-  if (!(atoi(argv[2])))
+  std::vector<TCPPacket *> newPackets = readAndCreateTCPPackets();
+  if (m_state != CLIENT_ESTABLISHED) // the source failed
   {
-    cerr << "ERROR: Incorrect format of ports provided" << endl;
-    exit(1); //TODO: need to change and implement the exact exit functions with different exit codes.
+    for (TCPPacket *p : newPackets)
+      delete p;
+    return;
   }
-  int port = atoi(argv[2]);
-  if (port < 0 || port > 65535)
+  if (newPackets.size() == 0 && m_fileRead && allPacketsAcked())
   {
-    cerr << "ERROR: Incorrect port number provided" << endl;
+    handwave(); // reached end of file, nothing more to read, and nothing new to receive
+    return;
   }
 
-  Client client(argv[1], argv[2], argv[3]);
-  client.run();
+  addToBuffers(newPackets);
+  sendPackets();
+}
+
+void Client::setClock(c_time now)
+{
+  m_now = now;
+}
+
+ClientConnectionState Client::getState()
+{
+  return m_state;
+}
+
+int Client::getConnectionId()
+{
+  return m_connectionId;
+}
+
+int Client::getInitialSeqNum()
+{
+  return m_initialSeqNum;
+}
+
+int Client::getExitCode()
+{
+  return m_exitCode;
+}
+
+std::string Client::getFileName()
+{
+  return m_fileName;
+}
+
+bool Client::timedOut()
+{
+  return m_timedOut;
+}
+
+DataSource *Client::takeSource()
+{
+  DataSource *source = m_source;
+  m_source = nullptr;
+  return source;
+}
+
+void Client::setPacketLog(bool on)
+{
+  m_packetLog = on;
+}
+
+void Client::setLatencyStages(LatencyStages *stages)
+{
+  m_stages = stages;
+}
+
+void Client::setSegmentationOffload(bool on)
+{
+  m_segmentationOffload = on;
+}
+
+void Client::setSharedKey(const std::string &key)
+{
+  m_sharedKey = key;
+}
+
+int Client::openPacket(char *packet, int length)
+{
+  if (m_cipher == nullptr)
+    return length;
+  return m_cipher->open(packet, length);
+}
+
+uint64_t Client::stageStart()
+{
+  return m_stages == nullptr ? 0 : m_stages->start();
+}
+
+void Client::stageStop(ClientStage stage, uint64_t start)
+{
+  if (m_stages != nullptr)
+    m_stages->stop(stage, start);
+}
+
+SenderMetrics Client::getMetrics()
+{
+  return m_metrics;
+}
+
+int Client::getCwnd()
+{
+  return m_cwnd;
+}
+
+int Client::getSsthresh()
+{
+  return m_ssthresh;
+}
+
+int Client::getRwnd()
+{
+  return m_rwnd;
+}
+
+double Client::getSrtt()
+{
+  return std::chrono::duration<double>(m_srtt).count();
+}
+
+double Client::getGoodput()
+{
+  double seconds = std::chrono::duration<double>(m_now - m_startTime).count();
+  return seconds > 0 ? m_metrics.bytesAcked / seconds : 0;
 }
@@ -3,78 +3,199 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <chrono>
+#include <sys/uio.h>
 #include "tcp.hpp"
-#include <netinet/in.h>
 #include "constants.hpp"
+#include "datasource.hpp"
+#include "options.hpp"
+#include "compression.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "latency.hpp"
+#include "aead.hpp"
 
-typedef std::chrono::time_point<std::chrono::system_clock> c_time;
+typedef std::chrono::steady_clock::time_point c_time;
+typedef std::chrono::steady_clock::duration c_duration;
 
+/**
+ * @brief Datagrams of one size back to back, for one sendmsg with UDP_SEGMENT set to
+ * `segmentSize` if there are several; only the last one may be shorter. The iovecs point into
+ * the packets of the connection, its data source and `scratch`, and stay valid until the next
+ * call into the Client.
+ */
+struct Transmit
+{
+  std::vector<struct iovec> iov;
+  int datagrams;
+  int segmentSize;           // bytes of every datagram but the last
+  std::vector<char> scratch; // sealed payloads, trailers and copies of packets the connection does not keep
+};
+
+/**
+ * One upload: a single file sent over a single connection, without any I/O of its own. The
+ * driver (the Uploader) feeds the time with setClock() and the packets of the server with
+ * handlePacket(), and after every call takes out the datagrams to send with pollTransmit(), the
+ * packet log with pollLog() and errors with pollError(); nextDeadline() says when
+ * handleTimers() has to run next. The payload is read from the DataSource the client is given.
+ */
 class Client
 {
 public:
-  Client(std::string hostname, std::string port, std::string fileName);
+  // sends the bytes [rangeStart, rangeStart + rangeLength) of `source`, rangeLength -1 means up to the end.
+  // The client takes ownership of the source.
+  // With `earlyData` the SYN carries as much of the data as fits.
+  Client(DataSource *source, std::string fileName, int initialSeqNum, off_t rangeStart = 0, off_t rangeLength = -1, ConnectionOptions options = ConnectionOptions(), bool earlyData = false);
   ~Client();
-  void run(); // lol
-  void handleConnection();
+  void start();                       // sends the SYN
+  void handlePacket(TCPPacket *p);    // dispatch a packet of this connection, caller keeps ownership
+  void handleTimers();                // act on expired timers
+  void sendData();                    // read and send whatever the window allows
+  void setClock(c_time now);          // current time used by all timers until the next call
+  c_time nextDeadline();              // earliest timer that the connection has to act on
+  bool canSend();                     // true if sendData() would make progress without waiting
+  Transmit *pollTransmit();           // next run of datagrams to send, nullptr once every queued one was handed out
+  bool pollLog(TraceRecord &record);  // next packet sent or received, false once the log is empty; timestamp left 0
+  bool pollError(std::string &message); // next error to report, false if there is none
+  int pollFd();                       // fd of a starved stream source to wait on, -1 if none
+  ClientConnectionState getState();
+  bool verifySynAck(TCPPacket *synAckPacket); // verifies the syn-ack packet of server
+  int getConnectionId();
+  int getInitialSeqNum();
+  int getExitCode();
+  std::string getFileName();
+  bool timedOut();                    // closed because the server stopped answering
+  DataSource *takeSource();           // hands the source of a closed connection to the one resuming it
+  void setPacketLog(bool on);         // keep a log of every packet for pollLog(), off by default
+  void setLatencyStages(LatencyStages *stages); // times the send and ACK paths into the uploader's histograms
+  void setSegmentationOffload(bool on); // new packets are queued in runs for UDP_SEGMENT, see sendPackets()
+  void setSharedKey(const std::string &key); // keys the encryption the options ask for, see aead.hpp
+  int openPacket(char *packet, int length); // verifies and decrypts a datagram from the server in place, -1 to drop it
+  SenderMetrics getMetrics();
+  int getCwnd();
+  int getSsthresh();
+  int getRwnd();
+  double getSrtt();                   // smoothed round trip time in seconds, 0 before the first sample
+  double getGoodput();                // bytes ACKed per second since the SYN
+
   bool checkTimerAndCloseConnection();                 // Returns true if connection closed
   bool checkTimersforDrop();                           //Return true if packets are to be dropped
   void dropPackets();                                  // also works with lseek
   void addToBuffers(std::vector<TCPPacket *> packets); // add the new packets to the buffers
   int sendPackets();                                   // send the packets ONLY THAT HAVE NOT BEEN SENT BEFORE
-  TCPPacket *recvPacket();
   std::vector<TCPPacket *> readAndCreateTCPPackets(); // -> return vector<TCPPacket*> of the new packets created
-  // potential sub function: createTCPPackets(vector<char> &, int startIndex, int endIndex) that creates TCP Packets from the byte buffer
-  //unlike in the server, since there is only one connection at a given time, we can ensure that each function has complete autonomy over the that connection state
-  TCPPacket *createTCPPacket(char *buffer, int length);
-  void handshake(); // hi!
-  void handwave();  // bye!
+  TCPPacket *createTCPPacket(const char *buffer, int length);
+  bool handshake(TCPPacket *synAckPacket); // hi!
+  void handwave();                         // bye!
+  void handleFin(TCPPacket *ackPacket);
   void setTimer(TimerType type, int index = -1);
   bool checkTimer(TimerType type, float timerLimit, int index = -1);
-  // potential sub function: createTCPPackets(vector<char> &, int startIndex, int endIndex) that creates TCP Packets from the byte buffer
-  //unlike in the server, since there is only one connection at a given time, we can ensure that each function has complete autonomy over the that connection state
+  c_time timerDeadline(TimerType type, float timerLimit);
+  c_duration timeoutDuration(float timerLimit);
   void closeConnection(int exitCode=0); // should handle both cases where server or client needs to do FIN
   // close connection should not be called by client until all packets are not ack'ed
   int congestionControl(); // change by 1 ACK, return the amount the CWND shifted
+  int sendWindow();        // bytes that may go out now, the available CWND capped by what the receive window leaves
+  void updateReceiveWindow(TCPPacket *p); // takes the receive window a server packet advertises
   int shiftWindow(TCPPacket *p);       // returns the number of bytes that the window has shifted
   int markAck(TCPPacket *p);
-  int sendPacket(TCPPacket *p);
+  // queues the segments waiting for a run first, so packets leave in order. A packet that is
+  // not kept by the connection must be copied
+  void sendPacket(TCPPacket *p, bool copy = false);
+  void queueSegment(TCPPacket *p);     // sent with the next packets of the same size in one run
+  void flushSegments();
+  void sendSegments(TCPPacket **packets, int count, bool copy = false);
   bool isDup(TCPPacket *p);
   bool allPacketsAcked();
+  void addToParity(TCPPacket *p);      // XOR a new segment into the parity group, sends the parity once complete
+  void adaptFecGroup();
+  uint64_t stageStart();                              // cycle counter if the stages are timed
+  void stageStop(ClientStage stage, uint64_t start);
 
 private:
-  int m_fileFd;
-  int m_sockFd;
+  DataSource *m_source;     // payload of every packet points into this
+  std::string m_fileName;
+  off_t m_rangeEnd;             // file offset to stop sending at, -1 for end of file
+  ConnectionOptions m_options;  // requested in the SYN
+  bool m_sendEarlyData;         // put the first bytes of the data in the SYN
   int m_connectionId;
+  int m_initialSeqNum;
   int m_sequenceNumber;
   int m_largestSeqNum;      // sequence number of the largest packet sent
   int m_relSeqNum;          // next expected sequence number to be ACKed
   int m_ackNumber;        
   int m_cwnd;
   int m_ssthresh;
+  int m_rwnd;               // receive window the server advertised, RWND_BYTES until it does
+  float m_persistTimeout;   // seconds from the persist timer to the next probe of a zero receive window
+  bool m_probing;           // the persist timer ran out, one segment may probe the zero receive window
   int m_avlblwnd;
+  ClientConnectionState m_state;
+  int m_exitCode;
+  bool m_timedOut;
+  bool m_checksums;  // accepted by the server: packets carry a CRC32C trailer
+  uint32_t m_digest; // CRC32C of every byte ACKed so far
+  std::string m_sharedKey;
+  PacketCipher *m_cipher; // accepted by the server: packets after the SYN-ACK are sealed, else nullptr
 
+  // forward error correction, off while m_fecMinGroup is 0
+  int m_fecMinGroup;        // accepted by the server
+  int m_fecGroup;           // segments per parity packet, adapted to the loss rate
+  std::string m_fecParity;  // XOR of the segments of the open group
+  int m_fecGroupStart;      // sequence number of the first segment of the open group
+  int m_fecGroupCount;      // segments in the open group
+  int m_fecSent;            // new segments sent since the last adaptation
+  int m_fecLosses;          // losses seen since the last adaptation
+  bool m_lossEpisode;       // duplicate ACKs are reporting a hole
+  double m_lossRate;        // smoothed losses per segment
+
+  // counted as packets go out and ACKs come in, read by the uploader for the metrics file
+  SenderMetrics m_metrics;
+  c_time m_startTime;       // the SYN went out
+  c_duration m_srtt;        // zero until the first sample
+  bool m_rttTiming;         // a packet is being timed, only one at a time
+  int m_rttSeqEnd;          // sequence number that ACKs the timed packet
+  c_time m_rttSentAt;
+  LatencyStages *m_stages;  // nullptr if the stages are not timed
+
+  c_time m_now;      // set by the driver, all timers compare against it
+  c_duration m_rto;  // retransmission timeout
   c_time m_connectionTimer;
   c_time m_synPacketTimer;
   c_time m_finPacketTimer;
   c_time m_finEndTimer;
-  struct addrinfo m_serverInfo; // needed since we use sendto() and might have to provide server info each time
-  bool m_fileRead;              // file has been completely read and the winodw can't move any forward; can be a local variable in handleConnection() also
+  c_time m_persistTimer;
+  bool m_fileRead;              // file has been completely read and the winodw can't move any forward
+  bool m_sourceStarved;         // the stream source had no data for the last read
+
+  TCPPacket *m_synPacket;       // kept for retransmission until the SYN-ACK arrives
+  TCPPacket *m_finPacket;       // kept for retransmission until the server FIN arrives
+  TCPPacket *m_clientAckPacket; // ACK of the server FIN, resent for every FIN in TIME_WAIT
 
   bool m_firstPacketAcked; //Set in Constructor as false, update when first packet acked
-  std::vector<TCPPacket *> m_packetBuffer;
-  std::vector<bool> m_packetACK;
-  std::vector<c_time> m_packetTimers;
-  std::vector<bool> m_sentOnce;
-  int m_blseek;
-  int m_flseek;
+  std::deque<TCPPacket *> m_packetBuffer;
+  std::deque<bool> m_packetACK;
+  std::deque<c_time> m_packetDeadlines; // retransmission deadline of each packet, in send order
+  std::deque<bool> m_sentOnce;
+  std::vector<TCPPacket *> m_segments; // queued for one segmented send, all of the size of the first but the last
+  bool m_segmentationOffload;
+  std::vector<Transmit> m_transmits;   // reused, the first m_transmitCount are queued
+  int m_transmitCount;
+  int m_transmitsPolled;
+  bool m_packetLog;
+  std::vector<TraceRecord> m_log;
+  size_t m_logPolled;
+  std::deque<std::string> m_errors;
+  std::deque<uint64_t> m_sentCycles; // cycle counter at the first transmission for the rtt stage, 0 if untimed or resent
+  off_t m_blseek;           // source offset of the first byte not ACKed, the sequence number m_relSeqNum unwrapped
+  off_t m_flseek;           // source offset of the next byte to send
 
   // private function
-  void printPacket(TCPPacket *p, bool recvd, bool dropped, bool dup);
-  bool verifySynAck(TCPPacket *synAckPacket); // verifies the syn-ack packet of server
+  int wireLength(TCPPacket *p); // datagram bytes of a packet
+  void logPacket(TCPPacket *p, bool recvd, bool dropped, bool dup);
+  void fail(std::string message); // queued for pollError()
   bool verifyFinAck(TCPPacket *finAckPacket); // verifies fin-ack packet of server
-
-  struct addrinfo *m_rememberToFree;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,117 @@
+#include <string.h>
+#include "constants.hpp"
+#include "compressedsource.hpp"
+
+CompressedSource::CompressedSource(DataSource *source, off_t rawStart, off_t rawEnd)
+{
+  m_source = source;
+  m_rawOffset = rawStart;
+  m_rawEnd = rawEnd;
+  m_encodedOffset = 0;
+  m_eof = false;
+}
+
+CompressedSource::~CompressedSource()
+{
+  delete m_source;
+}
+
+void CompressedSource::close()
+{
+  m_chunks.clear();
+  m_raw.clear();
+  m_source->close();
+}
+
+int CompressedSource::pollFd()
+{
+  return m_source->pollFd();
+}
+
+/**
+ * @brief Gathers up to COMPRESSION_CHUNK_BYTES from the inner source and encodes them. A stream
+ * that runs dry encodes what it has, so a slow producer is not held back by a half filled chunk.
+ */
+int CompressedSource::encodeChunk()
+{
+  while (!m_eof && (int)m_raw.size() < COMPRESSION_CHUNK_BYTES)
+  {
+    int maxLen = COMPRESSION_CHUNK_BYTES - m_raw.size();
+    if (m_rawEnd != -1 && m_rawEnd - m_rawOffset < maxLen)
+      maxLen = m_rawEnd - m_rawOffset;
+    const char *data;
+    int length = (maxLen == 0) ? 0 : m_source->view(m_rawOffset, maxLen, &data);
+    if (length == -1)
+      return -1;
+    if (length == SOURCE_WOULD_BLOCK)
+    {
+      if (m_raw.empty())
+        return SOURCE_WOULD_BLOCK;
+      break;
+    }
+    if (length == 0)
+    {
+      m_eof = true;
+      break;
+    }
+    m_raw.append(data, length);
+    m_rawOffset += length;
+    m_source->release(m_rawOffset);
+  }
+  if (m_raw.empty())
+    return 0;
+
+  // a chunk starts at a packet boundary: the unaligned tail of the last chunk is repeated at its start
+  off_t start = m_encodedOffset - m_encodedOffset % MAX_PAYLOAD_LENGTH;
+  m_chunks.push_back({start, std::string()});
+  Chunk &chunk = m_chunks.back();
+  if (start < m_encodedOffset)
+  {
+    Chunk &last = m_chunks[m_chunks.size() - 2];
+    chunk.data.assign(last.data, start - last.offset, m_encodedOffset - start);
+  }
+  m_encoder.encode(m_raw.data(), m_raw.size(), chunk.data);
+  m_encodedOffset = start + chunk.data.size();
+  m_raw.clear();
+  return 1;
+}
+
+/**
+ * @brief Views never end short of `maxLen` before the end of the data, so every packet but
+ * the last is full and retransmissions after a timeout cut the stream at the same offsets
+ */
+int CompressedSource::view(off_t offset, int maxLen, const char **data)
+{
+  while (true)
+  {
+    if (offset < m_encodedOffset)
+    {
+      // the newest chunk holding `offset` has the most bytes after it
+      for (auto chunk = m_chunks.rbegin(); chunk != m_chunks.rend(); ++chunk)
+      {
+        if (offset < chunk->offset)
+          continue;
+        int available = chunk->offset + chunk->data.size() - offset;
+        *data = chunk->data.data() + (offset - chunk->offset);
+        if (available >= maxLen || m_eof)
+          return (available < maxLen) ? available : maxLen;
+        break;
+      }
+      if (m_chunks.empty() || offset < m_chunks.front().offset)
+        return -1; // offset was already released
+    }
+
+    int ret = encodeChunk();
+    if (ret == 0 && offset < m_encodedOffset)
+      continue; // end of data, the short view is the last one
+    if (ret != 1)
+      return ret;
+  }
+}
+
+void CompressedSource::release(off_t offset)
+{
+  // the last chunk is kept, the next one starts with its tail
+  while (m_chunks.size() > 1 && m_chunks.front().offset + (off_t)m_chunks.front().data.size() <= offset)
+    m_chunks.pop_front();
+}
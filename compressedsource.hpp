@@ -0,0 +1,45 @@
+#ifndef COMPRESSEDSOURCE_HPP
+#define COMPRESSEDSOURCE_HPP
+
+#include <deque>
+#include <string>
+#include <sys/types.h>
+#include "datasource.hpp"
+#include "compression.hpp"
+
+/**
+ * @brief The frame stream of a compressed connection, encoded from another source one chunk
+ * at a time as the window asks for it. Offsets of view() and release() are offsets into the
+ * frame stream; the raw bytes of a chunk are released from the inner source once encoded.
+ */
+class CompressedSource : public DataSource
+{
+public:
+  // encodes the bytes [rawStart, rawEnd) of `source`, rawEnd -1 means up to the end. Takes ownership of the source.
+  CompressedSource(DataSource *source, off_t rawStart, off_t rawEnd);
+  ~CompressedSource();
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset);
+  void close();
+  int pollFd();
+
+private:
+  struct Chunk
+  {
+    off_t offset;     // frame stream offset of data[0]
+    std::string data; // one or more frames
+  };
+
+  int encodeChunk(); // 1 if a frame was added, 0 at end of data, -1 on error, SOURCE_WOULD_BLOCK
+
+  DataSource *m_source;
+  std::deque<Chunk> m_chunks; // frames covering [released offset, m_encodedOffset)
+  std::string m_raw;          // file bytes of the chunk being gathered
+  FrameEncoder m_encoder;
+  off_t m_rawOffset;          // next byte to read from m_source
+  off_t m_rawEnd;
+  off_t m_encodedOffset;      // frame stream offset after the last frame
+  bool m_eof;
+};
+
+#endif // COMPRESSEDSOURCE_HPP
@@ -0,0 +1,96 @@
+#include <zlib.h>
+#include "compression.hpp"
+
+static void putUint32(std::string &out, uint32_t value)
+{
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back((char)((value >> shift) & 0xff));
+}
+
+static uint32_t getUint32(const std::string &in, int pos)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++)
+    value = (value << 8) | (unsigned char)in[pos + i];
+  return value;
+}
+
+FrameEncoder::FrameEncoder()
+{
+  m_backoff = 1;
+  m_skip = 0;
+}
+
+/**
+ * @brief Compresses one chunk. A chunk that does not shrink by at least 1/16 is sent raw and
+ * the next chunks are sent raw without trying, for twice as many chunks each time in a row,
+ * so incompressible data costs little CPU. A chunk that compresses resets the backoff.
+ */
+void FrameEncoder::encode(const char *raw, int len, std::string &out)
+{
+  size_t frameStart = out.size();
+  if (m_skip > 0)
+    m_skip--;
+  else
+  {
+    uLongf encodedLen = compressBound(len);
+    out.resize(frameStart + FRAME_HEADER_LEN + encodedLen);
+    char *encoded = &out[frameStart + FRAME_HEADER_LEN];
+    if (compress2((Bytef *)encoded, &encodedLen, (const Bytef *)raw, len, COMPRESSION_LEVEL) == Z_OK &&
+        encodedLen < (uLongf)(len - len / 16))
+    {
+      std::string header;
+      header.push_back((char)FRAME_ZLIB);
+      putUint32(header, len);
+      putUint32(header, encodedLen);
+      out.replace(frameStart, FRAME_HEADER_LEN, header);
+      out.resize(frameStart + FRAME_HEADER_LEN + encodedLen);
+      m_backoff = 1;
+      return;
+    }
+    out.resize(frameStart);
+    m_skip = m_backoff;
+    m_backoff = (m_backoff * 2 > MAX_COMPRESSION_BACKOFF) ? MAX_COMPRESSION_BACKOFF : m_backoff * 2;
+  }
+
+  out.push_back((char)FRAME_RAW);
+  putUint32(out, len);
+  putUint32(out, len);
+  out.append(raw, len);
+}
+
+/**
+ * @brief Decodes every frame completed by `data`; the rest is kept for the next call
+ */
+bool FrameDecoder::decode(const char *data, int len, std::string &out)
+{
+  m_pending.append(data, len);
+  size_t pos = 0;
+  while (m_pending.size() - pos >= (size_t)FRAME_HEADER_LEN)
+  {
+    int type = (unsigned char)m_pending[pos];
+    uint32_t rawLen = getUint32(m_pending, pos + 1);
+    uint32_t encodedLen = getUint32(m_pending, pos + 5);
+    if (rawLen > (uint32_t)COMPRESSION_CHUNK_BYTES || encodedLen > compressBound(COMPRESSION_CHUNK_BYTES))
+      return false;
+    if (m_pending.size() - pos - FRAME_HEADER_LEN < encodedLen)
+      break;
+
+    const char *encoded = m_pending.data() + pos + FRAME_HEADER_LEN;
+    if (type == FRAME_RAW && rawLen == encodedLen)
+      out.append(encoded, rawLen);
+    else if (type == FRAME_ZLIB)
+    {
+      size_t outStart = out.size();
+      out.resize(outStart + rawLen);
+      uLongf decodedLen = rawLen;
+      if (uncompress((Bytef *)&out[outStart], &decodedLen, (const Bytef *)encoded, encodedLen) != Z_OK || decodedLen != rawLen)
+        return false;
+    }
+    else
+      return false;
+    pos += FRAME_HEADER_LEN + encodedLen;
+  }
+  m_pending.erase(0, pos);
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <string>
+#include <stdint.h>
+
+/*
+  A compressed connection carries a stream of frames instead of the file bytes:
+
+      | type (1 byte) | raw length (4 bytes) | encoded length (4 bytes) | encoded bytes |
+
+  Every frame holds one chunk of at most COMPRESSION_CHUNK_BYTES file bytes and decodes on its
+  own, so the server can write a chunk as soon as its frame is complete. Chunks that do not
+  compress are sent as FRAME_RAW.
+*/
+enum FrameType
+{
+  FRAME_RAW = 0,
+  FRAME_ZLIB = 1
+};
+
+enum CompressionCodec // value of OPTION_COMPRESS
+{
+  CODEC_NONE = 0,
+  CODEC_ZLIB = 1
+};
+
+const int COMPRESSION_CHUNK_BYTES = 65536;  // file bytes per frame
+const int FRAME_HEADER_LEN = 9;
+const int COMPRESSION_LEVEL = 1;            // zlib level, speed matters more than ratio
+const int MAX_COMPRESSION_BACKOFF = 64;     // most chunks sent raw before compression is tried again
+
+class FrameEncoder
+{
+public:
+  FrameEncoder();
+  void encode(const char *raw, int len, std::string &out); // appends the frame of one chunk to `out`
+
+private:
+  int m_backoff;    // chunks to skip after the next chunk that does not compress
+  int m_skip;       // chunks left to send raw without trying
+};
+
+class FrameDecoder
+{
+public:
+  bool decode(const char *data, int len, std::string &out); // appends decoded bytes to `out`, false if corrupt
+
+private:
+  std::string m_pending; // start of a frame that is not complete yet
+};
+
+#endif // COMPRESSION_HPP
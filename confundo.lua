@@ -29,6 +29,9 @@ function confundo.dissector(tvb, pInfo, root) -- Tvb, Pinfo, TreeItem
    if bit.band(flag, 4) ~= 0 then
       f:add(tvb(11,1), "ACK")
    end
+   if bit.band(flag, 8) ~= 0 then
+      f:add(tvb(10,1), "Window: " .. tvb(10,1):uint() * 512)
+   end
   
    pInfo.cols.protocol = "Confundo"
 end
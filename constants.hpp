@@ -5,11 +5,19 @@
 const int MAX_CWND_BYTES = 51200;
 
 // server constants
-const int RWND_BYTES = 51200;
+const int RWND_BYTES = 51200;               // largest receive window of a connection
+const int RWND_INIT_BYTES = 16384;          // receive window of a new connection
+const int RWND_MIN_BYTES = 4096;            // a slow disk never shrinks a window below this
+const int RECEIVE_BUDGET_BYTES = 64 << 20;  // default limit of the receive windows of all connections together
 const int INIT_SERVER_SEQ_NUM = 4321;
+const int SYN_COOKIE_HALF_OPEN = 64; // half-open connections from which new SYNs are answered with a cookie
+const int SYN_COOKIE_SLOT = 4;       // seconds, a cookie is valid in its slot and the next one
 
 // client constants
 const int INIT_CLIENT_SEQ_NUM = 12345;
+const int DEFAULT_MAX_ACTIVE_CONNECTIONS = 32; // concurrent uploads of the multi-file client
+const int MAX_STRIPES = 64;                    // connections a single file can be split across
+const int MAX_RESUME_ATTEMPTS = 5;             // reconnects of a resumable transfer after connection timeouts
 
 enum ConnectionState // Connection States enum
 {
@@ -18,6 +26,15 @@ enum ConnectionState // Connection States enum
 	FIN_RECEIVED
 };
 
+enum ClientConnectionState // Client side connection states
+{
+	CLIENT_SYN_SENT,
+	CLIENT_ESTABLISHED,
+	CLIENT_FIN_SENT,
+	CLIENT_TIME_WAIT,
+	CLIENT_CLOSED
+};
+
 enum AddToBufferReturn
 {
 	PACKET_ADDED,
@@ -32,7 +49,8 @@ enum TimerType
 	CONNECTION_TIMER,
 	NORMAL_TIMER,
 	FIN_PACKET_TIMER,
-	FIN_END_TIMER
+	FIN_END_TIMER,
+	PERSIST_TIMER
 };
 
 // common constants
@@ -40,12 +58,28 @@ const int MAX_PACKET_LENGTH = 524;
 const int MAX_PAYLOAD_LENGTH = 512;
 const int MAX_SEQ_NUM = 102400;
 const int MAX_ACK_NUM = 102400;
+// concurrent uploads of the client: the initial sequence numbers of its pending SYNs are kept more
+// than a payload apart, so fewer than one SYN per two payloads of the sequence space always leaves one free
+const int MAX_ACTIVE_CONNECTIONS = (MAX_SEQ_NUM + 1) / (2 * MAX_PAYLOAD_LENGTH + 2);
 const int HEADER_LEN = 12;
+const int CHECKSUM_LEN = 4;     // CRC32C trailer of the packets of a connection with checksums
+const char WINDOW_FLAG = 8;     // header flag bit next to ACK, SYN and FIN: byte 10 holds a receive window
 const int INIT_CWND_BYTES = 512;
 const float CONNECTION_TIMEOUT = 10; //seconds
 const float RETRANSMISSION_TIMEOUT = 0.5;
 const float CLIENT_CONNECTION_END_TIMEOUT = 2;
+const float PERSIST_MAX_TIMEOUT = 4; // longest wait between probes of a zero window, well below CONNECTION_TIMEOUT
 const int INITIAL_SSTHRESH = 10000;
 
+// UDP segmentation and receive offload
+const int GSO_MAX_SEGMENTS = 64;    // packets in one segmented send, UDP_MAX_SEGMENTS of the kernel
+const int GRO_BUFFER_BYTES = 65536; // a coalesced receive is at most one IP datagram
+
+// forward error correction
+const int FEC_MIN_GROUP = 2;                                  // data segments per parity packet, i.e. at most 50% overhead
+const int FEC_MAX_GROUP = 32;
+const int FEC_ADAPT_PACKETS = 256;                            // new segments between adjustments of the group size
+const int FEC_HISTORY_BYTES = FEC_MAX_GROUP * MAX_PAYLOAD_LENGTH; // flushed bytes the server keeps to rebuild segments
+
 // typedefs
 #endif
\ No newline at end of file
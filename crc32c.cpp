@@ -0,0 +1,64 @@
+#include <string.h>
+#include "crc32c.hpp"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static const uint32_t CRC32C_POLYNOMIAL = 0x82f63b78; // reflected
+
+struct Crc32cTable
+{
+  uint32_t entries[256];
+  Crc32cTable()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+      entries[i] = crc;
+    }
+  }
+};
+
+static uint32_t crc32cTable(uint32_t crc, const unsigned char *data, size_t len)
+{
+  static const Crc32cTable table;
+  while (len--)
+    crc = table.entries[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(uint32_t crc, const unsigned char *data, size_t len)
+{
+  uint64_t crc64 = crc;
+  for (; len >= 8; data += 8, len -= 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  while (len--)
+    crc = _mm_crc32_u8(crc, *data++);
+  return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunction)(uint32_t, const unsigned char *, size_t);
+
+static Crc32cFunction pickCrc32c()
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2"))
+    return crc32cHardware;
+#endif
+  return crc32cTable;
+}
+
+uint32_t crc32c(uint32_t crc, const char *data, size_t len)
+{
+  static const Crc32cFunction function = pickCrc32c();
+  return ~function(~crc, (const unsigned char *)data, len);
+}
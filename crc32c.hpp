@@ -0,0 +1,14 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CRC32C (Castagnoli) of `len` bytes, continuing from the CRC of the bytes before
+ * them; 0 starts a new CRC. Uses the SSE4.2 crc32 instruction when the CPU has it and a
+ * lookup table otherwise.
+ */
+uint32_t crc32c(uint32_t crc, const char *data, size_t len);
+
+#endif // CRC32C_HPP
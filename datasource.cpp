@@ -0,0 +1,149 @@
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "datasource.hpp"
+#include "filesource.hpp"
+#include "streamsource.hpp"
+#include "prefetchsource.hpp"
+#include "constants.hpp"
+
+/*------------------------------------------------------------
+GENERATOR SOURCE
+-------------------------------------------------------------*/
+
+GeneratorSource::GeneratorSource(off_t size)
+{
+  m_size = size;
+}
+
+/**
+ * @brief The repeating pattern, followed by a copy of its first MAX_PAYLOAD_LENGTH bytes so
+ * that every view of up to a packet is contiguous
+ */
+const char *GeneratorSource::pattern()
+{
+  static char *buffer = nullptr;
+  if (buffer == nullptr)
+  {
+    buffer = new char[GENERATOR_PATTERN_BYTES + MAX_PAYLOAD_LENGTH];
+    uint32_t state = 2463534242u; // xorshift32
+    for (int i = 0; i < GENERATOR_PATTERN_BYTES; i++)
+    {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      buffer[i] = (char)state;
+    }
+    for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+      buffer[GENERATOR_PATTERN_BYTES + i] = buffer[i];
+  }
+  return buffer;
+}
+
+int GeneratorSource::view(off_t offset, int maxLen, const char **data)
+{
+  if (offset >= m_size)
+    return 0;
+  if (maxLen > MAX_PAYLOAD_LENGTH)
+    maxLen = MAX_PAYLOAD_LENGTH;
+  *data = pattern() + (offset % GENERATOR_PATTERN_BYTES);
+  return (m_size - offset < maxLen) ? m_size - offset : maxLen;
+}
+
+void GeneratorSource::release(off_t offset)
+{
+}
+
+void GeneratorSource::close()
+{
+}
+
+/*------------------------------------------------------------
+FACTORY
+-------------------------------------------------------------*/
+
+bool isSyntheticSource(std::string name)
+{
+  return name.compare(0, GENERATOR_PREFIX.size(), GENERATOR_PREFIX) == 0;
+}
+
+off_t parseSize(std::string size)
+{
+  char *end;
+  long long value = strtoll(size.c_str(), &end, 10);
+  if (end == size.c_str() || value < 0)
+    return -1;
+  std::string suffix = end;
+  if (suffix == "K" || suffix == "k")
+    value <<= 10;
+  else if (suffix == "M" || suffix == "m")
+    value <<= 20;
+  else if (suffix == "G" || suffix == "g")
+    value <<= 30;
+  else if (!suffix.empty())
+    return -1;
+  return value;
+}
+
+DataSource *openDataSource(std::string name, int streamBufferBytes, int prefetchChunks)
+{
+  if (isSyntheticSource(name))
+  {
+    off_t size = parseSize(name.substr(GENERATOR_PREFIX.size()));
+    if (size == -1)
+    {
+      errno = EINVAL;
+      return nullptr;
+    }
+    return new GeneratorSource(size);
+  }
+
+  int fd;
+  if (name == "-")
+    fd = dup(STDIN_FILENO);
+  else
+    fd = open(name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    ::close(fd);
+    return nullptr;
+  }
+
+  if (!S_ISREG(st.st_mode))
+  {
+    StreamSource *stream = new StreamSource(streamBufferBytes);
+    if (!stream->open(fd))
+    {
+      delete stream;
+      return nullptr;
+    }
+    return stream;
+  }
+
+  // a regular file, which may be stdin redirected from one, so it is read through fd
+  if (prefetchChunks > 0)
+  {
+    PrefetchSource *prefetch = new PrefetchSource(prefetchChunks);
+    if (!prefetch->open(fd))
+    {
+      delete prefetch;
+      return nullptr;
+    }
+    return prefetch;
+  }
+
+  FileSource *file = new FileSource();
+  if (!file->open(fd))
+  {
+    delete file;
+    return nullptr;
+  }
+  return file;
+}
@@ -0,0 +1,69 @@
+#ifndef DATASOURCE_HPP
+#define DATASOURCE_HPP
+
+#include <string>
+#include <sys/types.h>
+
+const int SOURCE_WOULD_BLOCK = -2;            // view(): no data yet, wait on pollFd()
+const int GENERATOR_PATTERN_BYTES = 65536;    // period of the synthetic data
+const std::string GENERATOR_PREFIX = "gen:";  // "gen:<bytes>[K|M|G]" names a synthetic source
+
+/**
+ * @brief Where the payload of a connection comes from.
+ *
+ * Sources hand out pointers into memory they own, so packets can be sent without copying.
+ * A pointer returned by view() stays valid until release() moves past it; bytes that have not
+ * been released can be viewed again, which is what retransmissions rely on.
+ */
+class DataSource
+{
+public:
+  virtual ~DataSource() {}
+
+  /**
+   * @brief Exposes the bytes starting at `offset` without copying them
+   *
+   * @param offset absolute offset into the data, must not be behind the last release()
+   * @param maxLen maximum number of bytes wanted
+   * @param data set to the first byte of the view
+   * @return number of contiguous bytes available, 0 at end of data, -1 on read error,
+   * SOURCE_WOULD_BLOCK if the data has not arrived yet
+   */
+  virtual int view(off_t offset, int maxLen, const char **data) = 0;
+  virtual void release(off_t offset) = 0; // bytes before `offset` will never be viewed again
+  virtual void close() = 0;
+  virtual int pollFd() { return -1; } // readable once a SOURCE_WOULD_BLOCK view may succeed
+};
+
+/**
+ * @brief Synthetic data of a fixed size, for measuring throughput without a disk in the loop.
+ * Byte i is a fixed pseudo random function of i % GENERATOR_PATTERN_BYTES, so the output
+ * can be verified against a second run of the generator.
+ */
+class GeneratorSource : public DataSource
+{
+public:
+  GeneratorSource(off_t size);
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset);
+  void close();
+
+private:
+  off_t m_size;
+  static const char *pattern();
+};
+
+/**
+ * @brief Opens the source named `name`: "-" for stdin, "gen:<size>" for synthetic data, pipes
+ * and other non-seekable files as streams and regular files through a FileSource, or a
+ * PrefetchSource if `prefetchChunks` is not 0
+ *
+ * @param streamBufferBytes bound of the in-memory retransmission buffer of streams
+ * @param prefetchChunks chunks a regular file is read ahead by a thread of its own
+ * @return nullptr on error, errno is set
+ */
+DataSource *openDataSource(std::string name, int streamBufferBytes, int prefetchChunks = 0);
+bool isSyntheticSource(std::string name);
+off_t parseSize(std::string size); // "<n>[K|M|G]", -1 if malformed
+
+#endif // DATASOURCE_HPP
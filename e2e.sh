@@ -0,0 +1,90 @@
+#!/bin/bash
+# End-to-end benchmark: sends a file from client to server through the impairment relay under
+# each network condition below and reports completion time, goodput and retransmissions. Exits
+# with 1 if the file did not arrive intact in one of them.
+#
+# usage: ./e2e.sh [file size in bytes] [client options...]
+#   environment: SERVER_PORT (default 6000), RELAY_PORT (6001), TIMEOUT per scenario (120 s),
+#   E2E_JSON results file (e2e.json), ONLY names of the scenarios to run (all)
+
+SIZE=${1:-1048576}
+shift
+CLIENT_OPTIONS="$@"
+SERVER_PORT=${SERVER_PORT:-6000}
+RELAY_PORT=${RELAY_PORT:-6001}
+TIMEOUT=${TIMEOUT:-120}
+E2E_JSON=${E2E_JSON:-e2e.json}
+
+# name:relay options
+SCENARIOS=(
+  "clean:"
+  "delay-20ms:-d 20"
+  "jitter-20+-5ms:-d 20 -j 5"
+  "loss-1%:-l 1"
+  "loss-5%:-l 5"
+  "reorder-5%:-d 5 -r 5"
+  "duplicate-5%:-u 5"
+  "rate-10mbit:-b 10000"
+  "wan:-d 20 -j 2 -l 1 -b 10000"
+)
+
+cd "$(dirname "$0")"
+for binary in server client relay; do
+  if [ ! -x ./$binary ]; then
+    echo "ERROR: ./$binary is missing, run make first" >&2
+    exit 1
+  fi
+done
+
+WORK=$(mktemp -d /tmp/confundo-e2e-XXXXXX)
+trap 'kill $SERVER_PID $RELAY_PID 2>/dev/null; rm -rf "$WORK"' EXIT
+head -c "$SIZE" /dev/urandom > "$WORK/input"
+
+printf "%-16s %-8s %10s %14s %8s %8s\n" scenario status seconds "goodput Mbit/s" packets retrans
+echo "[" > "$E2E_JSON"
+first=1
+failed=0
+for scenario in "${SCENARIOS[@]}"; do
+  name=${scenario%%:*}
+  relayOptions=${scenario#*:}
+  if [ -n "$ONLY" ] && [[ " $ONLY " != *" $name "* ]]; then
+    continue
+  fi
+  rm -rf "$WORK/out"
+  mkdir "$WORK/out"
+
+  ./server $SERVER_PORT "$WORK/out" > "$WORK/server.log" 2>&1 &
+  SERVER_PID=$!
+  ./relay $relayOptions $RELAY_PORT 127.0.0.1 $SERVER_PORT 2> "$WORK/relay.log" &
+  RELAY_PID=$!
+  sleep 0.3
+
+  start=$(date +%s%N)
+  timeout $TIMEOUT ./client $CLIENT_OPTIONS 127.0.0.1 $RELAY_PORT "$WORK/input" > "$WORK/client.log" 2> "$WORK/client.err"
+  rc=$?
+  end=$(date +%s%N)
+  sleep 0.2
+  kill $SERVER_PID $RELAY_PID 2>/dev/null
+  wait $SERVER_PID $RELAY_PID 2>/dev/null
+
+  if [ $rc -ne 0 ]; then
+    status=failed
+  elif cmp -s "$WORK/input" "$WORK/out/1.file"; then
+    status=ok
+  else
+    status=corrupt
+  fi
+  seconds=$(echo "$end $start" | awk '{ printf "%.3f", ($1 - $2) / 1e9 }')
+  goodput=$(echo "$SIZE $seconds" | awk '{ printf "%.2f", $1 * 8 / $2 / 1e6 }')
+  packets=$(grep -c "^SEND" "$WORK/client.log")
+  retransmissions=$(grep -c "^SEND.* DUP$" "$WORK/client.log")
+
+  [ $status = ok ] || failed=1
+  printf "%-16s %-8s %10s %14s %8s %8s\n" "$name" $status $seconds $goodput $packets $retransmissions
+  [ $first -eq 1 ] || echo "," >> "$E2E_JSON"
+  first=0
+  printf '  {"scenario": "%s", "relay": "%s", "bytes": %s, "status": "%s", "seconds": %s, "goodput_mbit_per_s": %s, "packets": %s, "retransmissions": %s}' \
+    "$name" "$relayOptions" $SIZE $status $seconds $goodput $packets $retransmissions >> "$E2E_JSON"
+done
+printf "\n]\n" >> "$E2E_JSON"
+exit $failed
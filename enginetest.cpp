@@ -0,0 +1,293 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "constants.hpp"
+#include "tcp.hpp"
+#include "options.hpp"
+#include "aead.hpp"
+#include "serverengine.hpp"
+#include "client.hpp"
+
+/*
+  Checks of the protocol engines, driven the way the drivers drive them but without a socket:
+  datagrams go in with receive(), and what comes out is compared with what the protocol says.
+  Exits with 1 if any check fails.
+*/
+
+const int TEST_INITIAL_SEQ_NUM = 12345;
+const char TEST_EARLY_DATA[] = "INJECTED-WITHOUT-KEY";
+const char TEST_SHARED_KEY[] = "0123456789abcdef0123456789abcdef";
+
+static int s_failures = 0;
+
+static void check(bool passed, std::string name)
+{
+  std::cout << (passed ? "ok      " : "FAILED  ") << name << std::endl;
+  if (!passed)
+    s_failures++;
+}
+
+static struct sockaddr_in testClientInfo()
+{
+  struct sockaddr_in clientInfo;
+  memset(&clientInfo, 0, sizeof(clientInfo));
+  clientInfo.sin_family = AF_INET;
+  clientInfo.sin_port = htons(9);
+  clientInfo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return clientInfo;
+}
+
+/**
+ * @brief What a server engine hands out for one SYN carrying `options`, once the driver accepted
+ * the connection with the options it was asked for
+ */
+struct SynResult
+{
+  bool requested = false; // a SERVER_CONNECTION_REQUESTED came out
+  int synAckAck = -1;     // ACK number of the SYN-ACK, -1 if there was none
+  std::string data;       // bytes of every SERVER_DATA event
+};
+
+static SynResult sendSyn(std::string sharedKey, ConnectionOptions options)
+{
+  SynResult result;
+  ServerEngine engine(sharedKey);
+  struct sockaddr_in clientInfo = testClientInfo();
+
+  std::string payload = options.encode();
+  TCPPacket syn(TEST_INITIAL_SEQ_NUM, 0, 0, false, true, false, payload.size(), payload);
+  std::string datagram = syn.getString();
+  engine.receive(&datagram[0], datagram.size(), (struct sockaddr *)&clientInfo, sizeof(clientInfo), std::chrono::steady_clock::now());
+
+  ServerEvent event;
+  while (engine.pollEvent(event))
+  {
+    if (event.type == SERVER_CONNECTION_REQUESTED)
+    {
+      result.requested = true;
+      engine.accept(event.connId, *event.options);
+    }
+    else if (event.type == SERVER_DATA)
+      result.data.append(event.data, event.length);
+  }
+  Datagram out;
+  while (engine.pollDatagram(out))
+  {
+    TCPPacket synAck(std::string(out.data, out.length));
+    if (synAck.isSYN() && synAck.isACK())
+      result.synAckAck = synAck.getAckNum();
+  }
+  return result;
+}
+
+static ConnectionOptions earlyDataOptions(bool encrypted)
+{
+  ConnectionOptions options;
+  options.earlyData = TEST_EARLY_DATA;
+  if (encrypted)
+  {
+    options.aead = AEAD_AES_256_GCM;
+    options.aeadRandom = std::string(AEAD_RANDOM_LEN, 'r');
+  }
+  return options;
+}
+
+/**
+ * @brief Nothing authenticates the SYN, so a sender without the key must not get its early
+ * data into the output file of an encrypting server
+ */
+static void testEarlyData()
+{
+  int withoutData = (TEST_INITIAL_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  int withData = (TEST_INITIAL_SEQ_NUM + 1 + sizeof(TEST_EARLY_DATA) - 1) % (MAX_SEQ_NUM + 1);
+
+  SynResult plain = sendSyn("", earlyDataOptions(false));
+  check(plain.requested && plain.data == TEST_EARLY_DATA && plain.synAckAck == withData, "early data of a plain connection is taken");
+
+  SynResult keyed = sendSyn(TEST_SHARED_KEY, earlyDataOptions(true));
+  check(keyed.requested && keyed.data.empty() && keyed.synAckAck == withoutData,
+        "early data of a keyless SYN to a keyed server is dropped and not ACKed");
+
+  SynResult encrypted = sendSyn("", earlyDataOptions(true));
+  check(encrypted.data.empty() && (encrypted.synAckAck == -1 || encrypted.synAckAck == withoutData),
+        "early data of an encrypted connection is dropped and not ACKed");
+
+  SynResult unencrypted = sendSyn(TEST_SHARED_KEY, earlyDataOptions(false));
+  check(unencrypted.data.empty() && unencrypted.synAckAck == -1, "a plain SYN to a keyed server is refused with its early data");
+}
+
+/**
+ * @brief Window of the last ACK the engine has to send, -2 if there is none
+ */
+static int lastAckWindow(ServerEngine &engine)
+{
+  int window = -2;
+  Datagram out;
+  while (engine.pollDatagram(out))
+  {
+    TCPPacket ack(std::string(out.data, out.length));
+    if (ack.isACK())
+      window = ack.getWindow();
+  }
+  return window;
+}
+
+/**
+ * @brief Feeds one full segment of a connection at `now` and reports its write as taking
+ * `writeSeconds`, the way the server writes what the engine hands out
+ */
+static int sendSegment(ServerEngine &engine, int connId, int seqNum, int ackNum, c_time now, double writeSeconds)
+{
+  struct sockaddr_in clientInfo = testClientInfo();
+
+  TCPPacket segment(seqNum, ackNum, connId, true, false, false, MAX_PAYLOAD_LENGTH, std::string(MAX_PAYLOAD_LENGTH, 'd'));
+  std::string datagram = segment.getString();
+  engine.receive(&datagram[0], datagram.size(), (struct sockaddr *)&clientInfo, sizeof(clientInfo), now);
+  ServerEvent event;
+  while (engine.pollEvent(event))
+    if (event.type == SERVER_DATA)
+      engine.reportWrite(connId, event.length, writeSeconds);
+  return lastAckWindow(engine);
+}
+
+/**
+ * @brief Only packets with the window flag advertise a window, and 0 is a closed one. A disk
+ * too slow for even the smallest window closes it, and the engine opens it again with an ACK of
+ * its own once a round trip passed without slow writes.
+ */
+static void testZeroWindow()
+{
+  TCPPacket plain(1, 0, 1, true, false, false, 0, "");
+  TCPPacket closed(1, 0, 1, true, false, false, 0, "");
+  closed.setWindow(0);
+  check(plain.getWindow() == -1 && TCPPacket(closed.getString()).getWindow() == 0 && TCPPacket(plain.getString()).getWindow() == -1,
+        "a zero window is told apart from no advertisement");
+
+  ServerEngine engine("");
+  struct sockaddr_in clientInfo = testClientInfo();
+  c_time start = std::chrono::steady_clock::now();
+  std::chrono::milliseconds rtt(10);
+
+  std::string payload = ConnectionOptions().encode();
+  TCPPacket syn(TEST_INITIAL_SEQ_NUM, 0, 0, false, true, false, payload.size(), payload);
+  std::string datagram = syn.getString();
+  engine.receive(&datagram[0], datagram.size(), (struct sockaddr *)&clientInfo, sizeof(clientInfo), start);
+  ServerEvent event;
+  int connId = -1;
+  while (engine.pollEvent(event))
+    if (event.type == SERVER_CONNECTION_REQUESTED)
+    {
+      connId = event.connId;
+      engine.accept(connId, *event.options);
+    }
+  check(connId != -1 && lastAckWindow(engine) == RWND_INIT_BYTES, "the SYN-ACK advertises the initial window");
+
+  int seqNum = (TEST_INITIAL_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  int ackNum = INIT_SERVER_SEQ_NUM + 1;
+  sendSegment(engine, connId, seqNum, ackNum, start + rtt, 1.0); // times the round trip
+  seqNum = (seqNum + MAX_PAYLOAD_LENGTH) % (MAX_SEQ_NUM + 1);
+  check(sendSegment(engine, connId, seqNum, ackNum, start + 3 * rtt, 0.0001) == 0, "a disk that takes a second for a segment closes the window");
+
+  check(engine.nextDeadline() == start + 4 * rtt, "a closed window is checked again a round trip later");
+  engine.handleTimers(start + 4 * rtt);
+  check(lastAckWindow(engine) > 0, "the window opens with an ACK of its own once the disk caught up");
+}
+
+/**
+ * @brief Bytes of a string, served the way a memory mapped file is
+ */
+class StringSource : public DataSource
+{
+public:
+  StringSource(std::string data) : m_data(data) {}
+  int view(off_t offset, int maxLen, const char **data)
+  {
+    *data = m_data.data() + offset;
+    return std::min((off_t)maxLen, (off_t)m_data.size() - offset);
+  }
+  void release(off_t) {}
+  void close() {}
+
+private:
+  std::string m_data;
+};
+
+/**
+ * @brief Datagrams the client has to send, as its packets
+ */
+static std::vector<TCPPacket> takeTransmits(Client &client)
+{
+  std::vector<TCPPacket> packets;
+  while (Transmit *transmit = client.pollTransmit())
+  {
+    std::string datagrams;
+    for (const struct iovec &iov : transmit->iov)
+      datagrams.append((const char *)iov.iov_base, iov.iov_len);
+    for (size_t at = 0; at < datagrams.size(); at += transmit->segmentSize)
+      packets.push_back(TCPPacket(datagrams.substr(at, transmit->segmentSize)));
+  }
+  return packets;
+}
+
+static TCPPacket serverAck(int ackNum, bool syn, int window)
+{
+  std::string payload = syn ? ConnectionOptions().encode() : "";
+  TCPPacket ack(INIT_SERVER_SEQ_NUM, ackNum, 1, true, syn, false, payload.size(), payload);
+  ack.setWindow(window);
+  return ack;
+}
+
+/**
+ * @brief A client facing a zero window sends nothing new until its persist timer runs out, then
+ * one segment as a probe, and backs the timer off while the probes find the window closed
+ */
+static void testPersistTimer()
+{
+  Client client(new StringSource(std::string(16 * MAX_PAYLOAD_LENGTH, 'p')), "persist", TEST_INITIAL_SEQ_NUM);
+  c_time start = std::chrono::steady_clock::now();
+  std::chrono::milliseconds persist((int)(RETRANSMISSION_TIMEOUT * 1000));
+  client.setClock(start);
+  client.start();
+  takeTransmits(client);
+
+  int seqNum = (TEST_INITIAL_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  TCPPacket synAck = serverAck(seqNum, true, 0);
+  client.handlePacket(&synAck);
+  client.sendData();
+  std::vector<TCPPacket> sent = takeTransmits(client);
+  bool nothingNew = true;
+  for (TCPPacket &p : sent)
+    nothingNew = nothingNew && p.getPayloadLength() == 0;
+  check(nothingNew && !client.canSend(), "a zero window holds the data back");
+  check(client.nextDeadline() == start + persist, "the persist timer runs out after the retransmission timeout");
+
+  client.setClock(start + persist);
+  client.handleTimers();
+  client.sendData();
+  sent = takeTransmits(client);
+  check(sent.size() == 1 && sent[0].getPayloadLength() == MAX_PAYLOAD_LENGTH && sent[0].getSeqNum() == seqNum,
+        "one segment probes the window once the persist timer ran out");
+
+  seqNum = (seqNum + MAX_PAYLOAD_LENGTH) % (MAX_SEQ_NUM + 1);
+  TCPPacket closed = serverAck(seqNum, false, 0);
+  client.handlePacket(&closed);
+  client.sendData();
+  check(takeTransmits(client).empty() && client.nextDeadline() == start + 3 * persist, "a probe that finds the window closed backs the timer off");
+
+  TCPPacket opened = serverAck(seqNum, false, RWND_INIT_BYTES);
+  client.handlePacket(&opened);
+  client.sendData();
+  check(!takeTransmits(client).empty(), "a window update lets the data go again");
+}
+
+int main()
+{
+  testEarlyData();
+  testZeroWindow();
+  testPersistTimer();
+  return s_failures == 0 ? 0 : 1;
+}
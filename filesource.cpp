@@ -0,0 +1,153 @@
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "filesource.hpp"
+
+FileSource::FileSource()
+{
+  m_fd = -1;
+  m_map = nullptr;
+  m_mapLength = 0;
+  m_readOffset = 0;
+  m_eof = false;
+}
+
+FileSource::~FileSource()
+{
+  close();
+}
+
+bool FileSource::open(std::string fileName)
+{
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  return fd != -1 && open(fd);
+}
+
+bool FileSource::open(int fd)
+{
+  m_fd = fd;
+  struct stat st;
+  if (fstat(m_fd, &st) == -1)
+    return false;
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (map != MAP_FAILED)
+    {
+      m_map = (char *)map;
+      m_mapLength = st.st_size;
+      madvise(m_map, m_mapLength, MADV_SEQUENTIAL); // only a hint, failure is harmless
+    }
+  }
+  return true;
+}
+
+void FileSource::close()
+{
+  if (m_map != nullptr)
+    munmap(m_map, m_mapLength);
+  m_map = nullptr;
+  m_mapLength = 0;
+
+  for (auto &chunk : m_chunks)
+    delete[] chunk.data;
+  m_chunks.clear();
+  for (auto buffer : m_spare)
+    delete[] buffer;
+  m_spare.clear();
+
+  if (m_fd != -1)
+    ::close(m_fd);
+  m_fd = -1;
+}
+
+bool FileSource::isMapped()
+{
+  return m_map != nullptr;
+}
+
+/**
+ * @brief Reads the next chunk of the file into a recycled buffer
+ *
+ * @return false on read error
+ */
+bool FileSource::readChunk()
+{
+  char *buffer;
+  if (m_spare.empty())
+    buffer = new char[FILE_SOURCE_CHUNK_BYTES];
+  else
+  {
+    buffer = m_spare.back();
+    m_spare.pop_back();
+  }
+
+  int bytesRead = 0;
+  while (bytesRead < FILE_SOURCE_CHUNK_BYTES) // short reads are normal for pipes
+  {
+    int ret = read(m_fd, buffer + bytesRead, FILE_SOURCE_CHUNK_BYTES - bytesRead);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1)
+    {
+      m_spare.push_back(buffer);
+      return false;
+    }
+    if (ret == 0)
+    {
+      m_eof = true;
+      break;
+    }
+    bytesRead += ret;
+  }
+
+  if (bytesRead == 0)
+  {
+    m_spare.push_back(buffer);
+    return true;
+  }
+  m_chunks.push_back({m_readOffset, bytesRead, buffer});
+  m_readOffset += bytesRead;
+  return true;
+}
+
+int FileSource::view(off_t offset, int maxLen, const char **data)
+{
+  if (m_map != nullptr)
+  {
+    if (offset >= m_mapLength)
+      return 0;
+    *data = m_map + offset;
+    return (m_mapLength - offset < maxLen) ? m_mapLength - offset : maxLen;
+  }
+
+  while (offset >= m_readOffset && !m_eof)
+  {
+    if (!readChunk())
+      return -1;
+  }
+
+  for (auto &chunk : m_chunks)
+  {
+    if (offset >= chunk.offset && offset < chunk.offset + chunk.length)
+    {
+      int available = chunk.offset + chunk.length - offset; // never straddles two chunks
+      *data = chunk.data + (offset - chunk.offset);
+      return (available < maxLen) ? available : maxLen;
+    }
+  }
+  return 0;
+}
+
+void FileSource::release(off_t offset)
+{
+  while (!m_chunks.empty() && m_chunks.front().offset + m_chunks.front().length <= offset)
+  {
+    m_spare.push_back(m_chunks.front().data);
+    m_chunks.pop_front();
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef FILESOURCE_HPP
+#define FILESOURCE_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include "datasource.hpp"
+
+const int FILE_SOURCE_CHUNK_BYTES = 65536; // read size of the fallback path, multiple of MAX_PAYLOAD_LENGTH
+
+/**
+ * @brief Read only view of the file being uploaded.
+ *
+ * The file is memory mapped whenever possible so packets can point straight into the
+ * page cache. If mapping fails (empty files, pipes, special files) the source falls back to
+ * reading FILE_SOURCE_CHUNK_BYTES chunks into buffers that are recycled once released.
+ * Either way a pointer returned by view() stays valid until release() moves past it.
+ */
+class FileSource : public DataSource
+{
+public:
+  FileSource();
+  ~FileSource();
+  bool open(std::string fileName); // false on error, errno is set
+  bool open(int fd);               // takes ownership of fd, e.g. stdin redirected from a file
+  void close();
+
+  /**
+   * @brief Exposes the bytes of the file starting at `offset` without copying them
+   *
+   * @param offset absolute file offset, must not be behind the last release()
+   * @param maxLen maximum number of bytes wanted
+   * @param data set to the first byte of the view
+   * @return number of contiguous bytes available (0 at end of file, -1 on read error)
+   */
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset); // bytes before `offset` will never be viewed again
+  bool isMapped();
+
+private:
+  struct Chunk
+  {
+    off_t offset; // file offset of data[0]
+    int length;   // valid bytes in data
+    char *data;
+  };
+
+  bool readChunk(); // appends the next chunk of the file to m_chunks
+
+  int m_fd;
+  char *m_map;
+  off_t m_mapLength;
+
+  // fallback path
+  std::deque<Chunk> m_chunks;    // chunks covering [released offset, read offset)
+  std::vector<char *> m_spare;   // recycled chunk buffers
+  off_t m_readOffset;            // next offset to read() from
+  bool m_eof;
+};
+
+#endif // FILESOURCE_HPP
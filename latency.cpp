@@ -0,0 +1,144 @@
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "latency.hpp"
+
+const char *SERVER_STAGE_NAMES[SERVER_STAGES] = {"delivery", "recv", "parse", "lookup", "insert", "flush", "ack_build", "ack_send"};
+const char *CLIENT_STAGE_NAMES[CLIENT_STAGES] = {"read", "segment", "send", "delivery", "ack", "window", "congestion", "rtt"};
+
+static double steadySeconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+  m_counts = std::vector<uint64_t>(LATENCY_BUCKETS, 0);
+  m_count = 0;
+  m_sum = 0;
+  m_max = 0;
+}
+
+int LatencyHistogram::bucket(uint64_t cycles)
+{
+  if (cycles < (uint64_t)LATENCY_SUB_BUCKETS)
+    return cycles;
+  int shift = 63 - __builtin_clzll(cycles) - LATENCY_SUB_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + (int)(cycles >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::bucketStart(int bucket)
+{
+  if (bucket < LATENCY_SUB_BUCKETS)
+    return bucket;
+  int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+  return m_count;
+}
+
+double LatencyHistogram::mean() const
+{
+  return m_count == 0 ? 0 : (double)m_sum / m_count;
+}
+
+uint64_t LatencyHistogram::max() const
+{
+  return m_max;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+  if (m_count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(p / 100 * m_count);
+  if (rank >= m_count)
+    rank = m_count - 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += m_counts[i];
+    if (seen > rank)
+    {
+      uint64_t width = bucketStart(i + 1) - bucketStart(i);
+      uint64_t middle = bucketStart(i) + width / 2;
+      return middle < m_max ? middle : m_max;
+    }
+  }
+  return m_max;
+}
+
+LatencyStages::LatencyStages(const char *const *names, int stages)
+{
+  m_names = names;
+  m_enabled = false;
+  m_histograms = std::vector<LatencyHistogram>(stages);
+  m_nanoseconds = std::vector<bool>(stages, false);
+  m_startCycles = readCycles();
+  m_startSeconds = steadySeconds();
+}
+
+void LatencyStages::enable()
+{
+  m_enabled = true;
+}
+
+void LatencyStages::recordNanoseconds(int stage, uint64_t nanoseconds)
+{
+  if (!m_enabled)
+    return;
+  m_histograms[stage].record(nanoseconds);
+  m_nanoseconds[stage] = true;
+}
+
+/**
+ * @brief The kernel timestamp is wall clock time, so the delay is taken against CLOCK_REALTIME;
+ * one that comes out negative, after a clock step, is not recorded.
+ */
+void LatencyStages::recordDelivery(struct msghdr *msg, int stage)
+{
+  if (!m_enabled)
+    return;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+      continue;
+    struct timespec received, now;
+    memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t delay = (int64_t)(now.tv_sec - received.tv_sec) * 1000000000 + (now.tv_nsec - received.tv_nsec);
+    if (delay >= 0)
+      recordNanoseconds(stage, delay);
+  }
+}
+
+/**
+ * @brief Formats a table with the count, mean and percentiles of every stage in nanoseconds
+ */
+std::string LatencyStages::table()
+{
+  double elapsed = steadySeconds() - m_startSeconds;
+  uint64_t cycles = readCycles() - m_startCycles;
+  double nsPerCycle = (cycles > 0 && elapsed > 0) ? elapsed * 1e9 / cycles : 1;
+
+  std::string text;
+  char line[256];
+  snprintf(line, sizeof(line), "%-12s %10s %9s %9s %9s %9s %9s %9s %9s  (ns, %.3f GHz)\n", "stage", "count", "mean", "p50", "p90", "p99",
+           "p99.9", "p99.99", "max", 1 / nsPerCycle);
+  text += line;
+  for (int i = 0; i < (int)m_histograms.size(); i++)
+  {
+    const LatencyHistogram &h = m_histograms[i];
+    double scale = m_nanoseconds[i] ? 1 : nsPerCycle; // to nanoseconds
+    snprintf(line, sizeof(line), "%-12s %10llu %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f\n", m_names[i], (unsigned long long)h.count(),
+             h.mean() * scale, h.percentile(50) * scale, h.percentile(90) * scale, h.percentile(99) * scale,
+             h.percentile(99.9) * scale, h.percentile(99.99) * scale, h.max() * scale);
+    text += line;
+  }
+  return text;
+}
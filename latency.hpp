@@ -0,0 +1,132 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*
+  Latency histograms of the stages of packet processing. A stage is timed with two reads of the
+  cycle counter around it and the difference goes into an HDR style histogram: values below
+  2^LATENCY_SUB_BITS cycles get a bucket each, above that every power of two is split into
+  2^LATENCY_SUB_BITS buckets, so every value is kept to about 3% whatever its magnitude, in a
+  fixed 15K array and without a division. Cycles become nanoseconds only when the tables are
+  printed, from the cycles and the steady clock time elapsed since the histograms were created.
+  The delivery stages are the exception: they start at the receive timestamp the kernel puts on
+  a datagram, which is wall clock time, and go into their histograms in nanoseconds.
+*/
+
+const int LATENCY_SUB_BITS = 5;
+const int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BITS;
+const int LATENCY_BUCKETS = (64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+enum ServerStage
+{
+	SERVER_DELIVERY,  // kernel receive timestamp of a datagram to the loop holding it: queueing and wakeup
+	SERVER_RECV,      // recvfrom of a datagram that was already queued
+	SERVER_PARSE,     // checksum and TCPPacket
+	SERVER_LOOKUP,    // connection of the packet, SYN and FIN handling
+	SERVER_INSERT,    // receive buffer, FEC recovery and handing out the in order bytes
+	SERVER_FLUSH,     // in order bytes to the output file
+	SERVER_ACK_BUILD, // ACK packet
+	SERVER_ACK_SEND,  // ACK serialized and sent
+	SERVER_STAGES
+};
+
+enum ClientStage
+{
+	CLIENT_READ,       // view of the next payload in the data source
+	CLIENT_SEGMENT,    // TCPPacket around it
+	CLIENT_SEND,       // sendmsg of a packet
+	CLIENT_DELIVERY,   // kernel receive timestamp of an ACK to the loop holding it: queueing and wakeup
+	CLIENT_ACK,        // marking an ACK
+	CLIENT_WINDOW,     // shifting the window past it
+	CLIENT_CONGESTION, // congestion window update
+	CLIENT_RTT,        // first transmission of a packet to the ACK that covers it, retransmitted packets are not timed
+	CLIENT_STAGES
+};
+
+extern const char *SERVER_STAGE_NAMES[SERVER_STAGES];
+extern const char *CLIENT_STAGE_NAMES[CLIENT_STAGES];
+
+/**
+ * @brief Reads the time stamp counter, or the monotonic clock in nanoseconds where there is none
+ */
+inline uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+	void record(uint64_t cycles)
+	{
+		m_counts[bucket(cycles)]++;
+		m_count++;
+		m_sum += cycles;
+		if (cycles > m_max)
+			m_max = cycles;
+	}
+	uint64_t count() const;
+	double mean() const;
+	uint64_t max() const;
+	uint64_t percentile(double p) const; // in cycles, the middle of the bucket holding it
+
+	static int bucket(uint64_t cycles);
+	static uint64_t bucketStart(int bucket);
+
+private:
+	std::vector<uint64_t> m_counts;
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_max;
+};
+
+/**
+ * @brief One histogram per stage. start() and stop() are two reads of the cycle counter and a
+ * store when enabled, and a branch when not.
+ */
+class LatencyStages
+{
+public:
+	LatencyStages(const char *const *names, int stages);
+	void enable();
+	bool enabled() const { return m_enabled; }
+	uint64_t start() const { return m_enabled ? readCycles() : 0; }
+	void stop(int stage, uint64_t start)
+	{
+		if (m_enabled)
+			m_histograms[stage].record(readCycles() - start);
+	}
+	void recordNanoseconds(int stage, uint64_t nanoseconds); // for a stage that is not timed with the cycle counter
+	std::string table(); // percentiles of every stage in nanoseconds
+
+	// records the time since the kernel received the datagram of `msg`, a recvmsg on a socket
+	// passed to timestampReceives(), see latencysignals.hpp, into `stage`
+	void recordDelivery(struct msghdr *msg, int stage);
+
+private:
+	const char *const *m_names;
+	bool m_enabled;
+	std::vector<LatencyHistogram> m_histograms;
+	std::vector<bool> m_nanoseconds; // stages recorded in nanoseconds instead of cycles
+	uint64_t m_startCycles;
+	double m_startSeconds;
+};
+
+#endif // LATENCY_HPP
@@ -0,0 +1,54 @@
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include "latencysignals.hpp"
+
+static volatile sig_atomic_t s_dumpRequested = 0;
+static volatile sig_atomic_t s_exitRequested = 0;
+
+bool timestampReceives(int sockFd)
+{
+  int on = 1;
+  return setsockopt(sockFd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0;
+}
+
+static void requestDump(int)
+{
+  s_dumpRequested = 1;
+}
+
+static void requestExit(int)
+{
+  s_exitRequested = 1;
+}
+
+/**
+ * @brief Installs the signal handlers without SA_RESTART, so a blocking receive returns and the
+ * loop sees the request at once
+ */
+void watchLatencySignals(bool exitSignals)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = requestDump;
+  sigaction(SIGUSR1, &action, nullptr);
+  if (!exitSignals)
+    return;
+  action.sa_handler = requestExit;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+}
+
+bool takeLatencyDumpRequest()
+{
+  if (!s_dumpRequested)
+    return false;
+  s_dumpRequested = 0;
+  return true;
+}
+
+bool latencyExitRequested()
+{
+  return s_exitRequested;
+}
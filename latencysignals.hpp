@@ -0,0 +1,17 @@
+#ifndef LATENCYSIGNALS_HPP
+#define LATENCYSIGNALS_HPP
+
+/*
+  What the drivers set up around the LatencyStages of latency.hpp: receive timestamps on their
+  socket for the delivery stages, and the signals that ask for the tables.
+*/
+
+bool timestampReceives(int sockFd); // SO_TIMESTAMPNS on the socket, false if it does not take it
+
+// SIGUSR1 asks for the tables, and with exitSignals SIGINT and SIGTERM for a last one before
+// exiting. The event loop checks the flags, the handlers only set them.
+void watchLatencySignals(bool exitSignals);
+bool takeLatencyDumpRequest();
+bool latencyExitRequested();
+
+#endif // LATENCYSIGNALS_HPP
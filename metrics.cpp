@@ -0,0 +1,43 @@
+#include "metrics.hpp"
+
+ReceiverMetrics::ReceiverMetrics()
+{
+  packetsReceived = 0;
+  bytesReceived = 0;
+  bytesWritten = 0;
+  duplicatePackets = 0;
+  droppedPackets = 0;
+  outOfOrderBytes = 0;
+}
+
+void ReceiverMetrics::add(const ReceiverMetrics &other)
+{
+  packetsReceived += other.packetsReceived;
+  bytesReceived += other.bytesReceived;
+  bytesWritten += other.bytesWritten;
+  duplicatePackets += other.duplicatePackets;
+  droppedPackets += other.droppedPackets;
+  outOfOrderBytes += other.outOfOrderBytes;
+}
+
+SenderMetrics::SenderMetrics()
+{
+  packetsSent = 0;
+  bytesSent = 0;
+  retransmissions = 0;
+  bytesRetransmitted = 0;
+  bytesAcked = 0;
+  duplicateAcks = 0;
+  rttSamples = 0;
+}
+
+void SenderMetrics::add(const SenderMetrics &other)
+{
+  packetsSent += other.packetsSent;
+  bytesSent += other.bytesSent;
+  retransmissions += other.retransmissions;
+  bytesRetransmitted += other.bytesRetransmitted;
+  bytesAcked += other.bytesAcked;
+  duplicateAcks += other.duplicateAcks;
+  rttSamples += other.rttSamples;
+}
@@ -0,0 +1,39 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <stdint.h>
+
+/*
+  Server and client count what happens on every connection in plain fields that the engines
+  bump as they go, without locks or allocations. A driver reads them and exports them, see
+  metricstext.hpp.
+*/
+
+struct ReceiverMetrics // server side of a connection
+{
+  ReceiverMetrics();
+  void add(const ReceiverMetrics &other);
+
+  int64_t packetsReceived;  // data packets that reached the receive buffer check
+  int64_t bytesReceived;    // payload bytes of those packets
+  int64_t bytesWritten;     // bytes written to the output file
+  int64_t duplicatePackets; // packets whose bytes had already arrived
+  int64_t droppedPackets;   // packets beyond the receive window
+  int64_t outOfOrderBytes;  // bytes buffered behind a hole
+};
+
+struct SenderMetrics // client side of a connection
+{
+  SenderMetrics();
+  void add(const SenderMetrics &other);
+
+  int64_t packetsSent;        // first transmissions of data packets
+  int64_t bytesSent;          // their payload bytes
+  int64_t retransmissions;    // data packets sent again
+  int64_t bytesRetransmitted;
+  int64_t bytesAcked;
+  int64_t duplicateAcks;      // ACKs that did not move the window
+  int64_t rttSamples;         // round trips measured for the SRTT
+};
+
+#endif // METRICS_HPP
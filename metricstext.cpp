@@ -0,0 +1,103 @@
+#include <string>
+#include <stdio.h>
+#include <unistd.h>
+#include "metricstext.hpp"
+
+template <typename Metrics>
+struct CounterField
+{
+  const char *name;
+  const char *help;
+  int64_t Metrics::*value;
+};
+
+static const CounterField<ReceiverMetrics> RECEIVER_COUNTERS[] = {
+    {"packets_received", "Data packets received", &ReceiverMetrics::packetsReceived},
+    {"bytes_received", "Payload bytes received, including duplicates", &ReceiverMetrics::bytesReceived},
+    {"bytes_written", "Bytes written to the output file", &ReceiverMetrics::bytesWritten},
+    {"duplicate_packets", "Packets whose bytes had already arrived", &ReceiverMetrics::duplicatePackets},
+    {"dropped_packets", "Packets dropped beyond the receive window", &ReceiverMetrics::droppedPackets},
+    {"out_of_order_bytes", "Bytes that arrived behind a hole and were buffered", &ReceiverMetrics::outOfOrderBytes}};
+
+static const CounterField<SenderMetrics> SENDER_COUNTERS[] = {
+    {"packets_sent", "Data packets sent for the first time", &SenderMetrics::packetsSent},
+    {"bytes_sent", "Payload bytes sent for the first time", &SenderMetrics::bytesSent},
+    {"retransmissions", "Data packets sent again", &SenderMetrics::retransmissions},
+    {"bytes_retransmitted", "Payload bytes sent again", &SenderMetrics::bytesRetransmitted},
+    {"bytes_acked", "Payload bytes acknowledged by the server", &SenderMetrics::bytesAcked},
+    {"duplicate_acks", "ACKs that did not acknowledge anything new", &SenderMetrics::duplicateAcks},
+    {"rtt_samples", "Round trips measured for the smoothed RTT", &SenderMetrics::rttSamples}};
+
+template <typename Metrics, size_t N>
+static void addCounters(MetricsText &text, std::string prefix, const CounterField<Metrics> (&fields)[N], const Metrics &total,
+                        const std::vector<std::pair<std::string, Metrics>> &connections)
+{
+  for (const CounterField<Metrics> &field : fields)
+  {
+    std::string name = prefix + "_" + field.name + "_total";
+    text.family(name, "counter", std::string(field.help) + ", all connections");
+    text.sample(name, "", total.*field.value);
+    name = prefix + "_connection_" + field.name + "_total";
+    text.family(name, "counter", field.help);
+    for (auto &connection : connections)
+      text.sample(name, connection.first, connection.second.*field.value);
+  }
+}
+
+void MetricsText::family(std::string name, std::string type, std::string help)
+{
+  m_text += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+void MetricsText::sample(std::string name, std::string labels, double value)
+{
+  char number[32];
+  snprintf(number, sizeof(number), "%.17g", value);
+  m_text += name + (labels.empty() ? "" : "{" + labels + "}") + " " + number + "\n";
+}
+
+void MetricsText::counters(std::string prefix, const ReceiverMetrics &total, const std::vector<std::pair<std::string, ReceiverMetrics>> &connections)
+{
+  addCounters(*this, prefix, RECEIVER_COUNTERS, total, connections);
+}
+
+void MetricsText::counters(std::string prefix, const SenderMetrics &total, const std::vector<std::pair<std::string, SenderMetrics>> &connections)
+{
+  addCounters(*this, prefix, SENDER_COUNTERS, total, connections);
+}
+
+std::string MetricsText::label(std::string name, std::string value)
+{
+  std::string escaped;
+  for (char c : value)
+  {
+    if (c == '\\' || c == '"')
+      escaped += '\\';
+    if (c == '\n')
+    {
+      escaped += "\\n";
+      continue;
+    }
+    escaped += c;
+  }
+  return name + "=\"" + escaped + "\"";
+}
+
+/**
+ * @brief Writes the text next to `path` and renames it over `path`, so a reader never sees a
+ * partly written file
+ */
+bool MetricsText::writeFile(std::string path)
+{
+  std::string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "w");
+  if (file == nullptr)
+    return false;
+  bool written = fwrite(m_text.data(), 1, m_text.size(), file) == m_text.size();
+  if (fclose(file) != 0 || !written || rename(tmpPath.c_str(), path.c_str()) != 0)
+  {
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef METRICSTEXT_HPP
+#define METRICSTEXT_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "metrics.hpp"
+
+/*
+  Once per METRICS_INTERVAL the event loop of a driver formats the counters of the engines, see
+  metrics.hpp, in the Prometheus text format and atomically replaces the metrics file with it,
+  per connection and summed over every connection since start. Point a node exporter textfile
+  collector at the file, or just cat it.
+*/
+const float METRICS_INTERVAL = 1; // seconds between rewrites of the metrics file
+
+/**
+ * @brief Builds a metrics file in the Prometheus text format. Every sample of a metric must
+ * follow its family() line.
+ */
+class MetricsText
+{
+public:
+  void family(std::string name, std::string type, std::string help);
+  void sample(std::string name, std::string labels, double value); // labels without braces, may be empty
+  // every counter of the metrics twice: prefix_<counter>_total summed over all connections and
+  // prefix_connection_<counter>_total for each connection, with the labels paired with it
+  void counters(std::string prefix, const ReceiverMetrics &total, const std::vector<std::pair<std::string, ReceiverMetrics>> &connections);
+  void counters(std::string prefix, const SenderMetrics &total, const std::vector<std::pair<std::string, SenderMetrics>> &connections);
+  bool writeFile(std::string path);                                // replaces `path` atomically, false on error
+
+  static std::string label(std::string name, std::string value); // name="value" with value escaped
+
+private:
+  std::string m_text;
+};
+
+#endif // METRICSTEXT_HPP
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#include "constants.hpp"
+#include "offload.hpp"
+
+bool probeSegmentationOffload(int sockFd)
+{
+#ifdef UDP_SEGMENT
+  int segmentSize;
+  socklen_t optionLen = sizeof(segmentSize);
+  return getsockopt(sockFd, SOL_UDP, UDP_SEGMENT, &segmentSize, &optionLen) == 0; // kernels before 4.18 do not know it
+#else
+  return false;
+#endif
+}
+
+void setSegmentSize(struct msghdr *msg, char *control, uint16_t segmentSize)
+{
+#ifdef UDP_SEGMENT
+  memset(control, 0, SEGMENT_SIZE_CONTROL_BYTES);
+  msg->msg_control = control;
+  msg->msg_controllen = SEGMENT_SIZE_CONTROL_BYTES;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(segmentSize));
+  memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+#endif
+}
+
+bool isOffloadError(int error)
+{
+  return error == EIO || error == EINVAL || error == ENOPROTOOPT || error == EOPNOTSUPP;
+}
+
+SegmentReader::SegmentReader(int maxSegment)
+{
+  m_maxSegment = maxSegment;
+  m_offload = false;
+  m_buffer.resize(maxSegment);
+  m_receivedBytes = 0;
+  m_segmentSize = 0;
+  m_offset = 0;
+  m_fromLen = 0;
+}
+
+bool SegmentReader::enableOffload(int sockFd)
+{
+#ifdef UDP_GRO
+  int on = 1;
+  if (setsockopt(sockFd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) // kernels before 5.0 do not know it
+  {
+    m_offload = true;
+    m_buffer.resize(GRO_BUFFER_BYTES);
+  }
+#endif
+  return m_offload;
+}
+
+int SegmentReader::receive(int sockFd, int flags, LatencyStages *stages, int stage)
+{
+  struct iovec iov = {m_buffer.data(), m_buffer.size()};
+  char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &m_from;
+  msg.msg_namelen = sizeof(m_from);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  int bytes = recvmsg(sockFd, &msg, flags);
+  if (bytes == -1)
+    return -1;
+  if (stages != nullptr)
+    stages->recordDelivery(&msg, stage);
+
+  m_fromLen = msg.msg_namelen;
+  m_receivedBytes = bytes;
+  m_segmentSize = bytes;
+  m_offset = 0;
+#ifdef UDP_GRO
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+      memcpy(&m_segmentSize, CMSG_DATA(cmsg), sizeof(m_segmentSize));
+  }
+#endif
+  if (m_segmentSize <= 0)
+    m_segmentSize = bytes;
+  return bytes;
+}
+
+int SegmentReader::next(char **data)
+{
+  if (m_offset >= m_receivedBytes)
+    return -1;
+  int length = std::min(m_segmentSize, m_receivedBytes - m_offset);
+  *data = m_buffer.data() + m_offset;
+  m_offset += length;
+  return std::min(length, m_maxSegment);
+}
@@ -0,0 +1,54 @@
+#ifndef OFFLOAD_HPP
+#define OFFLOAD_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "latency.hpp"
+
+/*
+  UDP segmentation and receive offload. With UDP_SEGMENT a sender hands the kernel one buffer of
+  packets back to back and the size to cut it at, and the stack is traversed once for all of
+  them; only the last packet may be shorter than the others. With UDP_GRO the kernel hands a
+  receiver the datagrams of one flow that arrived together in one buffer, cut the same way, and
+  reports the size. Both only change how packets cross the system call boundary, the datagrams
+  on the wire are the ones that would have been sent one by one.
+*/
+
+const size_t SEGMENT_SIZE_CONTROL_BYTES = CMSG_SPACE(sizeof(uint16_t));
+
+bool probeSegmentationOffload(int sockFd); // true if the kernel has UDP_SEGMENT
+// sets UDP_SEGMENT for one sendmsg, `control` must hold SEGMENT_SIZE_CONTROL_BYTES and live until the send
+void setSegmentSize(struct msghdr *msg, char *control, uint16_t segmentSize);
+bool isOffloadError(int error); // errno of a segmented send the device or kernel could not do
+
+/**
+ * @brief Receives datagrams, or with receive offload segments coalesced by the kernel, and hands
+ * them out one at a time. A segment longer than `maxSegment` is cut to that length, like a
+ * datagram received into a buffer of that size.
+ */
+class SegmentReader
+{
+public:
+  SegmentReader(int maxSegment);
+  bool enableOffload(int sockFd); // turns UDP_GRO on, false if the kernel does not have it
+  // receives into the buffer, recording the delivery `stage` in `stages`; -1 on error or timeout
+  int receive(int sockFd, int flags, LatencyStages *stages, int stage);
+  int next(char **data); // length of the next segment of the last receive, -1 once all were handed out
+  bool coalesced() const { return m_segmentSize < m_receivedBytes; } // the last receive held several segments
+  const struct sockaddr_storage *sender() const { return &m_from; }
+  socklen_t senderLen() const { return m_fromLen; }
+
+private:
+  int m_maxSegment;
+  bool m_offload;
+  std::vector<char> m_buffer;
+  int m_receivedBytes;
+  int m_segmentSize; // of every segment of the last receive but the last
+  int m_offset;      // of the next segment to hand out
+  struct sockaddr_storage m_from;
+  socklen_t m_fromLen;
+};
+
+#endif // OFFLOAD_HPP
@@ -0,0 +1,164 @@
+#include <string>
+#include "options.hpp"
+#include "aead.hpp"
+
+/*------------------------------------------------------------
+ENCODING HELPERS
+-------------------------------------------------------------*/
+
+static void putInteger(std::string &out, uint64_t value, int bytes)
+{
+  for (int i = bytes - 1; i >= 0; i--)
+    out += (char)((value >> (8 * i)) & 0xff);
+}
+
+static uint64_t getInteger(const std::string &in, int offset, int bytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value = (value << 8) | (uint8_t)in[offset + i];
+  return value;
+}
+
+static void putOption(std::string &out, OptionType type, const std::string &value)
+{
+  out += (char)type;
+  out += (char)value.size();
+  out += value;
+}
+
+/*------------------------------------------------------------
+CONNECTION OPTIONS
+-------------------------------------------------------------*/
+
+ConnectionOptions::ConnectionOptions()
+{
+  stripe = false;
+  transferId = 0;
+  stripeOffset = 0;
+  resume = false;
+  resumeToken = 0;
+  resumeOffset = -1;
+  compression = 0;
+  checksums = false;
+  fecGroup = 0;
+  session = false;
+  aead = 0;
+}
+
+std::string ConnectionOptions::encode()
+{
+  std::string out;
+  if (stripe)
+  {
+    std::string value;
+    putInteger(value, transferId, 4);
+    putInteger(value, stripeOffset, 8);
+    putOption(out, OPTION_STRIPE, value);
+  }
+  if (resume)
+  {
+    std::string value;
+    putInteger(value, resumeToken, 8);
+    if (resumeOffset != -1)
+      putInteger(value, resumeOffset, 8);
+    putOption(out, OPTION_RESUME, value);
+  }
+  if (compression != 0)
+  {
+    std::string value;
+    putInteger(value, compression, 1);
+    putOption(out, OPTION_COMPRESS, value);
+  }
+  if (checksums)
+    putOption(out, OPTION_CHECKSUM, "");
+  if (fecGroup != 0)
+  {
+    std::string value;
+    putInteger(value, fecGroup, 1);
+    putOption(out, OPTION_FEC, value);
+  }
+  if (session)
+    putOption(out, OPTION_SESSION, "");
+  if (aead != 0)
+  {
+    std::string value;
+    putInteger(value, aead, 1);
+    putOption(out, OPTION_AEAD, value + aeadRandom);
+  }
+  if (!earlyData.empty())
+  {
+    std::string value;
+    putInteger(value, earlyData.size(), 2);
+    putOption(out, OPTION_EARLY_DATA, value);
+    out += earlyData;
+  }
+  return out;
+}
+
+
+bool ConnectionOptions::decode(std::string payload)
+{
+  int i = 0;
+  while (i + 2 <= (int)payload.size())
+  {
+    int type = (uint8_t)payload[i];
+    int length = (uint8_t)payload[i + 1];
+    int value = i + 2;
+    if (value + length > (int)payload.size())
+      return false;
+
+    switch (type)
+    {
+    case OPTION_STRIPE:
+      if (length != 12)
+        return false;
+      stripe = true;
+      transferId = getInteger(payload, value, 4);
+      stripeOffset = getInteger(payload, value + 4, 8);
+      break;
+    case OPTION_RESUME:
+      if (length != 8 && length != 16)
+        return false;
+      resume = true;
+      resumeToken = getInteger(payload, value, 8);
+      resumeOffset = (length == 16) ? (int64_t)getInteger(payload, value + 8, 8) : -1;
+      break;
+    case OPTION_COMPRESS:
+      if (length != 1)
+        return false;
+      compression = getInteger(payload, value, 1);
+      break;
+    case OPTION_CHECKSUM:
+      if (length != 0)
+        return false;
+      checksums = true;
+      break;
+    case OPTION_FEC:
+      if (length != 1)
+        return false;
+      fecGroup = getInteger(payload, value, 1);
+      break;
+    case OPTION_SESSION:
+      if (length != 0)
+        return false;
+      session = true;
+      break;
+    case OPTION_AEAD:
+      if (length != 1 + AEAD_RANDOM_LEN)
+        return false;
+      aead = getInteger(payload, value, 1);
+      aeadRandom = payload.substr(value + 1, AEAD_RANDOM_LEN);
+      break;
+    case OPTION_EARLY_DATA: // the rest of the payload is data
+      if (length != 2 || value + length + (int)getInteger(payload, value, 2) != (int)payload.size())
+        return false;
+      earlyData = payload.substr(value + length);
+      return true;
+    default: // unknown option, skip it
+      break;
+    }
+    i = value + length;
+  }
+  return i == (int)payload.size();
+}
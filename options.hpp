@@ -0,0 +1,61 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <stdint.h>
+
+/*
+  Connection options travel in the payload of the SYN and are echoed by the server in the
+  payload of the SYN-ACK for every option it accepted. The payload of a SYN does not take up
+  sequence space. Options are encoded back to back as
+
+      | type (1 byte) | length (1 byte) | value (length bytes, integers big endian) |
+
+  Unknown options are skipped, so an old server simply answers with an empty SYN-ACK.
+
+  OPTION_EARLY_DATA is always last and is followed by the data itself, which takes up the
+  sequence space right after the SYN. The server ACKs it in the SYN-ACK if it accepted it.
+*/
+enum OptionType
+{
+  OPTION_STRIPE = 1, // value: transfer id (4) + file offset of this connection's data (8)
+  OPTION_RESUME = 2,  // SYN: transfer token (8), SYN-ACK: transfer token (8) + bytes durably written (8)
+  OPTION_COMPRESS = 3, // value: codec of the frame stream carried instead of the file bytes (1), see compression.hpp
+  OPTION_CHECKSUM = 4, // no value: client packets after the SYN end in a CRC32C trailer, FIN and FIN-ACK carry a digest
+  OPTION_FEC = 5,      // value: fewest data segments per XOR parity packet the client may send (1)
+  OPTION_EARLY_DATA = 6, // value: length of the data that follows the option (2)
+  OPTION_SESSION = 7,    // no value: the data is a sequence of files behind records, see session.hpp
+  OPTION_AEAD = 8        // value: cipher (1) + random of the side that sends it (16), packets after the SYN-ACK are sealed, see aead.hpp
+};
+
+const int EARLY_DATA_OPTION_LEN = 4; // type, length and value of OPTION_EARLY_DATA
+
+struct ConnectionOptions
+{
+  ConnectionOptions();
+  std::string encode();
+  bool decode(std::string payload); // false if the payload is malformed
+
+  bool stripe;           // data goes at stripeOffset of the output file shared by transferId
+  uint32_t transferId;
+  int64_t stripeOffset;
+
+  bool resume;           // continue the transfer identified by resumeToken if the server has it
+  uint64_t resumeToken;
+  int64_t resumeOffset;  // SYN-ACK only: contiguous bytes of the output file on disk, -1 in a SYN
+
+  uint8_t compression;   // CompressionCodec, 0 for plain file bytes
+
+  bool checksums;        // per packet CRC32C and a CRC32C digest of the connection's data
+
+  int fecGroup;          // forward error correction with groups of at least fecGroup segments, 0 for none
+
+  bool session;          // the data carries many files, each behind a record
+
+  uint8_t aead;          // AeadCipher the packets are sealed with, 0 for none
+  std::string aeadRandom; // salt of the keys, from the side that sent the options
+
+  std::string earlyData; // first bytes of the data, carried by the SYN
+};
+
+#endif // OPTIONS_HPP
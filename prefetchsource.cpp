@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "prefetchsource.hpp"
+#include "busypoll.hpp"
+
+PrefetchSource::PrefetchSource(int chunks)
+    : m_filled(0), m_released(0), m_eof(false), m_stop(false)
+{
+  m_fd = -1;
+  m_eventFd = -1;
+  m_start = -1;
+  m_readerWaiting = false;
+  m_ring.resize((chunks < MIN_PREFETCH_CHUNKS) ? MIN_PREFETCH_CHUNKS : chunks);
+  for (auto &chunk : m_ring)
+    chunk = {0, 0, 0, new char[PREFETCH_CHUNK_BYTES]};
+}
+
+PrefetchSource::~PrefetchSource()
+{
+  close();
+}
+
+bool PrefetchSource::open(std::string fileName)
+{
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  return fd != -1 && open(fd);
+}
+
+bool PrefetchSource::open(int fd)
+{
+  m_fd = fd;
+  posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL); // only a hint, failure is harmless
+  m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return m_eventFd != -1;
+}
+
+void PrefetchSource::close()
+{
+  if (m_reader.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_room.notify_one();
+    m_reader.join();
+  }
+
+  for (auto &chunk : m_ring)
+    delete[] chunk.data;
+  m_ring.clear();
+
+  if (m_fd != -1)
+    ::close(m_fd);
+  m_fd = -1;
+  if (m_eventFd != -1)
+    ::close(m_eventFd);
+  m_eventFd = -1;
+}
+
+int PrefetchSource::pollFd()
+{
+  return m_eventFd;
+}
+
+/**
+ * @brief Fills the ring with consecutive chunks until the end of the file, a read error or
+ * close(). Waits while every buffer holds a chunk that was not released.
+ */
+void PrefetchSource::readAhead()
+{
+  BusyPoller::leavePinnedCpu(); // the core of a busy polling event loop is taken
+  for (uint64_t index = 0;; index++)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_readerWaiting = true;
+      m_room.wait(lock, [&] { return m_stop || index - m_released.load(std::memory_order_acquire) < m_ring.size(); });
+      m_readerWaiting = false;
+      if (m_stop)
+        return;
+    }
+
+    Chunk &chunk = m_ring[index % m_ring.size()];
+    chunk.offset = m_start + index * PREFETCH_CHUNK_BYTES;
+    chunk.length = 0;
+    chunk.error = 0;
+    while (chunk.length < PREFETCH_CHUNK_BYTES)
+    {
+      ssize_t ret = pread(m_fd, chunk.data + chunk.length, PREFETCH_CHUNK_BYTES - chunk.length, chunk.offset + chunk.length);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1)
+        chunk.error = errno;
+      if (ret <= 0)
+        break;
+      chunk.length += ret;
+    }
+
+    bool last = chunk.length < PREFETCH_CHUNK_BYTES;
+    m_filled.store(index + 1, std::memory_order_release);
+    if (last)
+      m_eof.store(true, std::memory_order_release);
+    uint64_t signal = 1;
+    ssize_t ret = write(m_eventFd, &signal, sizeof(signal));
+    (void)ret; // the counter can not overflow, one signal per chunk
+    if (last)
+      return;
+  }
+}
+
+/**
+ * @brief The first call starts the reader at the chunk holding `offset`, later calls expose
+ * the part of a filled chunk from `offset` on
+ */
+int PrefetchSource::view(off_t offset, int maxLen, const char **data)
+{
+  if (m_start == -1)
+  {
+    m_start = offset - offset % PREFETCH_CHUNK_BYTES;
+    m_reader = std::thread(&PrefetchSource::readAhead, this);
+  }
+
+  uint64_t index = (offset - m_start) / PREFETCH_CHUNK_BYTES;
+  if (offset < m_start || index < m_released.load(std::memory_order_relaxed))
+  {
+    errno = EINVAL;
+    return -1; // offset was already released
+  }
+  if (index >= m_filled.load(std::memory_order_acquire))
+  {
+    // clear the eventfd before looking again, a chunk published after that signals it again
+    uint64_t signals;
+    ssize_t ret = read(m_eventFd, &signals, sizeof(signals));
+    (void)ret;
+    bool eof = m_eof.load(std::memory_order_acquire); // before m_filled, which is final then
+    if (index >= m_filled.load(std::memory_order_acquire))
+      return eof ? 0 : SOURCE_WOULD_BLOCK;
+  }
+
+  Chunk &chunk = m_ring[index % m_ring.size()];
+  if (chunk.error != 0)
+  {
+    errno = chunk.error;
+    return -1;
+  }
+  int available = chunk.offset + chunk.length - offset; // never straddles two chunks
+  if (available <= 0)
+    return 0; // in the last chunk, past the end of the file
+  *data = chunk.data + (offset - chunk.offset);
+  return (available < maxLen) ? available : maxLen;
+}
+
+void PrefetchSource::release(off_t offset)
+{
+  if (m_start == -1 || offset <= m_start)
+    return;
+  uint64_t released = (offset - m_start) / PREFETCH_CHUNK_BYTES;
+  uint64_t filled = m_filled.load(std::memory_order_acquire);
+  if (released > filled)
+    released = filled;
+  if (released <= m_released.load(std::memory_order_relaxed))
+    return;
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_released.store(released, std::memory_order_release);
+    wake = m_readerWaiting;
+  }
+  if (wake)
+    m_room.notify_one();
+}
@@ -0,0 +1,66 @@
+#ifndef PREFETCHSOURCE_HPP
+#define PREFETCHSOURCE_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include "datasource.hpp"
+
+const int PREFETCH_CHUNK_BYTES = 65536; // read size of the reader thread, multiple of MAX_PAYLOAD_LENGTH
+const int MIN_PREFETCH_CHUNKS = 2;      // a window of unreleased bytes can span two chunks
+
+/**
+ * @brief A regular file read ahead of the window by a thread of its own, so the event loop
+ * never waits for the disk while the next bytes are already in memory.
+ *
+ * The reader fills a ring of `chunks` buffers of PREFETCH_CHUNK_BYTES with consecutive chunks
+ * of the file, starting at the chunk of the first view(), and hands each over by publishing the
+ * number of chunks filled; release() hands buffers back by publishing the number of chunks
+ * released. Each counter has a single writer, so the ring needs no lock, only the reader waits
+ * on a condition variable while every buffer is taken. A view() of a chunk that is not filled
+ * yet returns SOURCE_WOULD_BLOCK and pollFd(), an eventfd the reader signals after every chunk,
+ * turns readable once it is. Views end at chunk boundaries, which are at fixed offsets, so a
+ * retransmission cuts the file where the first transmission did.
+ */
+class PrefetchSource : public DataSource
+{
+public:
+  PrefetchSource(int chunks);
+  ~PrefetchSource();
+  bool open(std::string fileName); // false on error, errno is set
+  bool open(int fd);               // takes ownership of fd, e.g. stdin redirected from a file
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset);
+  void close();
+  int pollFd();
+
+private:
+  struct Chunk
+  {
+    off_t offset; // file offset of data[0]
+    int length;   // valid bytes in data, less than PREFETCH_CHUNK_BYTES only at the end
+    int error;    // errno of a failed read, 0 otherwise
+    char *data;
+  };
+
+  void readAhead(); // body of the reader thread
+
+  int m_fd;
+  int m_eventFd;
+  off_t m_start;     // file offset of chunk 0, -1 until the first view()
+  std::vector<Chunk> m_ring; // chunk i lives in m_ring[i % m_ring.size()]
+  std::atomic<uint64_t> m_filled;   // chunks the reader published
+  std::atomic<uint64_t> m_released; // chunks the event loop gave back
+  std::atomic<bool> m_eof;          // the last chunk filled ends the file
+  std::atomic<bool> m_stop;
+  std::mutex m_mutex;               // guards m_readerWaiting, m_room waits on it
+  std::condition_variable m_room;   // signalled when a chunk is released or on close()
+  bool m_readerWaiting;             // release() only wakes a reader that waits, a wakeup is a system call
+  std::thread m_reader;
+};
+
+#endif // PREFETCHSOURCE_HPP
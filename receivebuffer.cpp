@@ -0,0 +1,152 @@
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "receivebuffer.hpp"
+
+ReceiveBuffer::ReceiveBuffer(int capacity)
+{
+  m_capacity = (capacity + 63) / 64 * 64;
+  m_data = std::vector<char>(m_capacity);
+  m_marks = std::vector<uint64_t>(m_capacity / 64, 0);
+  m_start = 0;
+}
+
+int ReceiveBuffer::capacity()
+{
+  return m_capacity;
+}
+
+/**
+ * @brief Changes the capacity, keeping the buffered bytes at their offsets
+ */
+bool ReceiveBuffer::resize(int capacity)
+{
+  capacity = (capacity + 63) / 64 * 64;
+  if (capacity == m_capacity)
+    return true;
+  if (capacity < m_capacity && span() > capacity)
+    return false;
+
+  int kept = std::min(capacity, m_capacity);
+  std::vector<char> data(capacity);
+  std::vector<uint64_t> marks(capacity / 64, 0);
+  read(data.data(), kept);
+  for (int offset = 0; offset < kept; offset++)
+    if (has(offset))
+      marks[offset / 64] |= 1ULL << (offset % 64);
+  m_data.swap(data);
+  m_marks.swap(marks);
+  m_capacity = capacity;
+  m_start = 0;
+  return true;
+}
+
+void ReceiveBuffer::put(int offset, const char *data, int length)
+{
+  int i = index(offset);
+  int first = std::min(length, m_capacity - i);
+  memcpy(&m_data[i], data, first);
+  mark(i, i + first, true);
+  if (length > first) // wraps to the start of the ring
+  {
+    memcpy(&m_data[0], data + first, length - first);
+    mark(0, length - first, true);
+  }
+}
+
+bool ReceiveBuffer::has(int offset)
+{
+  int i = index(offset);
+  return (m_marks[i / 64] >> (i % 64)) & 1;
+}
+
+char ReceiveBuffer::at(int offset)
+{
+  return m_data[index(offset)];
+}
+
+int ReceiveBuffer::contiguous()
+{
+  int end = firstUnmarked(m_start, m_capacity);
+  if (end < m_capacity)
+    return end - m_start;
+  return m_capacity - m_start + firstUnmarked(0, m_start);
+}
+
+void ReceiveBuffer::read(char *out, int length)
+{
+  int first = std::min(length, m_capacity - m_start);
+  memcpy(out, &m_data[m_start], first);
+  if (length > first)
+    memcpy(out + first, &m_data[0], length - first);
+}
+
+void ReceiveBuffer::consume(int length)
+{
+  int first = std::min(length, m_capacity - m_start);
+  mark(m_start, m_start + first, false);
+  if (length > first)
+    mark(0, length - first, false);
+  m_start = (m_start + length) % m_capacity;
+}
+
+int ReceiveBuffer::span()
+{
+  int last = lastMarked(0, m_start); // the ring indexes before the start hold the later offsets
+  if (last != -1)
+    return m_capacity - m_start + last + 1;
+  last = lastMarked(m_start, m_capacity);
+  return (last == -1) ? 0 : last - m_start + 1;
+}
+
+int ReceiveBuffer::index(int offset)
+{
+  int i = m_start + offset;
+  return (i >= m_capacity) ? i - m_capacity : i;
+}
+
+void ReceiveBuffer::mark(int from, int to, bool value)
+{
+  while (from < to)
+  {
+    int bit = from % 64;
+    int count = std::min(64 - bit, to - from);
+    uint64_t mask = (count == 64) ? ~0ULL : ((1ULL << count) - 1) << bit;
+    if (value)
+      m_marks[from / 64] |= mask;
+    else
+      m_marks[from / 64] &= ~mask;
+    from += count;
+  }
+}
+
+int ReceiveBuffer::firstUnmarked(int from, int to)
+{
+  while (from < to)
+  {
+    int bit = from % 64;
+    uint64_t unmarked = ~m_marks[from / 64] >> bit;
+    if (unmarked != 0)
+      return std::min(to, from + __builtin_ctzll(unmarked));
+    from += 64 - bit;
+  }
+  return to;
+}
+
+int ReceiveBuffer::lastMarked(int from, int to)
+{
+  while (to > from)
+  {
+    int word = (to - 1) / 64;
+    int low = std::max(from, word * 64);
+    uint64_t marked = m_marks[word];
+    int highBit = to - word * 64; // bits [low, to) of the word
+    if (highBit < 64)
+      marked &= (1ULL << highBit) - 1;
+    marked &= ~0ULL << (low - word * 64);
+    if (marked != 0)
+      return word * 64 + 63 - __builtin_clzll(marked);
+    to = low;
+  }
+  return -1;
+}
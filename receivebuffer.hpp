@@ -0,0 +1,42 @@
+#ifndef RECEIVEBUFFER_HPP
+#define RECEIVEBUFFER_HPP
+
+#include <vector>
+#include <stdint.h>
+
+/**
+ * @brief Receive window of a server connection: the bytes from the next expected sequence
+ * number on, and a bit per byte marking the ones that arrived.
+ *
+ * Both live in rings, so consuming the in order bytes at the front moves a start index instead
+ * of every byte behind them, and the marks are set, cleared and scanned a 64 bit word at a time.
+ * Offsets are relative to the next expected byte. The capacity is a multiple of 64 and can
+ * change while bytes are buffered, which is how the server tunes the window of a connection.
+ */
+class ReceiveBuffer
+{
+public:
+  ReceiveBuffer(int capacity);
+  int capacity();
+  bool resize(int capacity);                          // false if bytes are buffered beyond a smaller capacity
+  void put(int offset, const char *data, int length); // the bytes must fit in the capacity
+  bool has(int offset);                               // whether the byte at offset arrived
+  char at(int offset);
+  int contiguous();                                   // bytes that arrived in order from the front
+  void read(char *out, int length);                   // copies the first `length` bytes
+  void consume(int length);                           // drops the first `length` bytes and their marks
+  int span();                                         // offset after the last byte that arrived, 0 if none
+
+private:
+  int index(int offset); // ring index of an offset
+  void mark(int from, int to, bool value); // ring indexes [from, to), no wrap
+  int firstUnmarked(int from, int to);     // ring index of the first clear bit in [from, to), `to` if none
+  int lastMarked(int from, int to);        // ring index of the last set bit in [from, to), -1 if none
+
+  std::vector<char> m_data;
+  std::vector<uint64_t> m_marks; // bit i % 64 of word i / 64 marks ring index i
+  int m_capacity;
+  int m_start; // ring index of offset 0
+};
+
+#endif // RECEIVEBUFFER_HPP
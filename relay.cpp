@@ -0,0 +1,321 @@
+#include <string>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "relay.hpp"
+
+// RELAY IMPLEMENTATION
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+Impairment::Impairment()
+{
+  delayMs = 0;
+  jitterMs = 0;
+  loss = 0;
+  reorder = 0;
+  duplicate = 0;
+  rateKbit = 0;
+  queueBytes = RELAY_DEFAULT_QUEUE_BYTES;
+}
+
+Direction::Direction(std::string directionName)
+{
+  name = directionName;
+  linkFreeAt = std::chrono::steady_clock::now();
+  received = forwarded = lost = queueDrops = duplicated = reordered = 0;
+}
+
+Relay::Relay(char *listenPort, std::string serverHost, char *serverPort, Impairment impairment, unsigned seed)
+    : m_impairment(impairment), m_random(seed), m_nextOrder(0), m_toServer("to server"), m_toClient("to client")
+{
+  struct addrinfo hints, *serverInfo;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  int ret;
+  if ((ret = getaddrinfo(serverHost.c_str(), serverPort, &hints, &serverInfo)) != 0)
+  {
+    std::cerr << "ERROR: getaddrinfo: " << gai_strerror(ret) << std::endl;
+    exit(1);
+  }
+  memcpy(&m_server.addr, serverInfo->ai_addr, serverInfo->ai_addrlen);
+  m_server.addrLen = serverInfo->ai_addrlen;
+  freeaddrinfo(serverInfo);
+
+  struct addrinfo *listenInfo;
+  hints.ai_flags = AI_PASSIVE;
+  if ((ret = getaddrinfo(NULL, listenPort, &hints, &listenInfo)) != 0)
+  {
+    std::cerr << "ERROR: getaddrinfo: " << gai_strerror(ret) << std::endl;
+    exit(1);
+  }
+  m_listenFd = socket(listenInfo->ai_family, listenInfo->ai_socktype, listenInfo->ai_protocol);
+  if (m_listenFd == -1 || bind(m_listenFd, listenInfo->ai_addr, listenInfo->ai_addrlen) == -1)
+  {
+    std::cerr << "ERROR: Could not bind port " << listenPort << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  freeaddrinfo(listenInfo);
+  fcntl(m_listenFd, F_SETFL, O_NONBLOCK);
+}
+
+Relay::~Relay()
+{
+  while (!m_pending.empty())
+  {
+    delete m_pending.top();
+    m_pending.pop();
+  }
+  for (auto &entry : m_clientToUpstream)
+    close(entry.second);
+  close(m_listenFd);
+}
+
+/**
+ * @brief Waits for datagrams from both sides and delivers each once its time has come
+ */
+void Relay::run()
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop; // no SA_RESTART, poll() returns on the signal
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  std::vector<struct pollfd> fds;
+  while (!stopRequested)
+  {
+    fds.clear();
+    fds.push_back({m_listenFd, POLLIN, 0});
+    for (auto &entry : m_upstreamToClient)
+      fds.push_back({entry.first, POLLIN, 0});
+
+    int timeoutMs = -1;
+    if (!m_pending.empty())
+    {
+      auto wait = m_pending.top()->deliverAt - std::chrono::steady_clock::now();
+      // round up, waking early would only spin
+      timeoutMs = std::max(0, (int)std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::microseconds(999)).count());
+    }
+    if (poll(&fds[0], fds.size(), timeoutMs) == -1 && errno != EINTR)
+    {
+      std::cerr << "ERROR: poll: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    for (auto &fd : fds)
+      if (fd.revents & POLLIN)
+        receive(fd.fd);
+    deliverDue();
+  }
+}
+
+/**
+ * @brief Reads every datagram waiting on `sockFd` and schedules it in its direction
+ */
+void Relay::receive(int sockFd)
+{
+  char buffer[RELAY_MAX_DATAGRAM];
+  while (true)
+  {
+    Endpoint from;
+    from.addrLen = sizeof(from.addr);
+    int bytes = recvfrom(sockFd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from.addr, &from.addrLen);
+    if (bytes == -1)
+      return;
+    if (sockFd == m_listenFd)
+      schedule(m_toServer, upstreamSocket(from), m_server, buffer, bytes);
+    else
+      schedule(m_toClient, m_listenFd, m_upstreamToClient[sockFd], buffer, bytes);
+  }
+}
+
+/**
+ * @brief Decides the fate of a datagram: lost, or delivered after the bottleneck, the delay and
+ * the jitter, possibly held back behind later datagrams and possibly twice
+ */
+void Relay::schedule(Direction &direction, int sockFd, Endpoint &to, const char *data, int length)
+{
+  direction.received++;
+  if (uniform() < m_impairment.loss)
+  {
+    direction.lost++;
+    return;
+  }
+
+  c_time now = std::chrono::steady_clock::now();
+  c_time departure = now;
+  if (m_impairment.rateKbit > 0)
+  {
+    // tail drop once the bottleneck has more than queueBytes to send
+    c_time linkFreeAt = std::max(now, direction.linkFreeAt);
+    double backlogBytes = std::chrono::duration<double>(linkFreeAt - now).count() * m_impairment.rateKbit * 1000 / 8;
+    if (backlogBytes + length > m_impairment.queueBytes)
+    {
+      direction.queueDrops++;
+      return;
+    }
+    double serialization = length * 8 / (m_impairment.rateKbit * 1000);
+    departure = linkFreeAt + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(serialization));
+    direction.linkFreeAt = departure;
+  }
+
+  int copies = 1;
+  if (uniform() < m_impairment.duplicate)
+  {
+    direction.duplicated++;
+    copies = 2;
+  }
+  for (int i = 0; i < copies; i++)
+  {
+    double delayMs = m_impairment.delayMs + (uniform() * 2 - 1) * m_impairment.jitterMs;
+    if (uniform() < m_impairment.reorder)
+    {
+      direction.reordered++;
+      delayMs += std::max(m_impairment.delayMs, RELAY_MIN_REORDER_DELAY_MS);
+    }
+    Datagram *d = new Datagram();
+    d->deliverAt = departure + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(std::max(0.0, delayMs)));
+    d->order = m_nextOrder++;
+    d->sockFd = sockFd;
+    d->to = to;
+    d->data.assign(data, length);
+    m_pending.push(d);
+  }
+}
+
+/**
+ * @brief Sends every datagram whose time has come
+ */
+void Relay::deliverDue()
+{
+  c_time now = std::chrono::steady_clock::now();
+  while (!m_pending.empty() && m_pending.top()->deliverAt <= now)
+  {
+    Datagram *d = m_pending.top();
+    m_pending.pop();
+    if (sendto(d->sockFd, d->data.data(), d->data.size(), 0, (struct sockaddr *)&d->to.addr, d->to.addrLen) != -1)
+      (d->sockFd == m_listenFd ? m_toClient : m_toServer).forwarded++;
+    delete d;
+  }
+}
+
+/**
+ * @brief Socket the datagrams of `client` are relayed to the server from, created on the first one
+ */
+int Relay::upstreamSocket(Endpoint &client)
+{
+  std::string key((char *)&client.addr, client.addrLen);
+  auto it = m_clientToUpstream.find(key);
+  if (it != m_clientToUpstream.end())
+    return it->second;
+
+  int sockFd = socket(m_server.addr.ss_family, SOCK_DGRAM, 0);
+  if (sockFd == -1)
+  {
+    std::cerr << "ERROR: socket: " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  fcntl(sockFd, F_SETFL, O_NONBLOCK);
+  m_clientToUpstream[key] = sockFd;
+  m_upstreamToClient[sockFd] = client;
+  return sockFd;
+}
+
+double Relay::uniform()
+{
+  return std::uniform_real_distribution<double>(0, 1)(m_random);
+}
+
+void Relay::printStats()
+{
+  for (Direction *d : {&m_toServer, &m_toClient})
+    std::cerr << d->name << ": received " << d->received << " forwarded " << d->forwarded << " lost " << d->lost << " queue drops " << d->queueDrops
+              << " duplicated " << d->duplicated << " reordered " << d->reordered << std::endl;
+}
+
+void printUsage()
+{
+  std::cerr << "Usage: relay [-d <delay ms>] [-j <jitter ms>] [-l <loss %>] [-r <reorder %>] [-u <duplicate %>] [-b <kbit/s>] [-q <queue bytes>] [-s <seed>] "
+               "<LISTEN-PORT> <SERVER-HOSTNAME-OR-IP> <SERVER-PORT>" << std::endl;
+  std::cerr << "  every impairment applies to both directions on its own, the counts are printed on SIGINT or SIGTERM" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  using namespace std;
+  Impairment impairment;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:j:l:r:u:b:q:s:")) != -1)
+  {
+    double value = atof(optarg);
+    if (value < 0)
+    {
+      cerr << "ERROR: -" << (char)opt << " can not be negative" << endl;
+      exit(1);
+    }
+    switch (opt)
+    {
+    case 'd':
+      impairment.delayMs = value;
+      break;
+    case 'j':
+      impairment.jitterMs = value;
+      break;
+    case 'l':
+      impairment.loss = value / 100;
+      break;
+    case 'r':
+      impairment.reorder = value / 100;
+      break;
+    case 'u':
+      impairment.duplicate = value / 100;
+      break;
+    case 'b':
+      impairment.rateKbit = value;
+      break;
+    case 'q':
+      impairment.queueBytes = (int)value;
+      break;
+    case 's':
+      seed = (unsigned)value;
+      break;
+    default:
+      printUsage();
+      exit(1);
+    }
+  }
+  if (argc - optind != 3)
+  {
+    cerr << "ERROR: Incorrect number of arguments provided!" << endl;
+    printUsage();
+    exit(1);
+  }
+  if (atoi(argv[optind]) <= 0 || atoi(argv[optind]) > 65535 || atoi(argv[optind + 2]) <= 0 || atoi(argv[optind + 2]) > 65535)
+  {
+    cerr << "ERROR: Port invalid" << endl;
+    exit(1);
+  }
+
+  Relay relay(argv[optind], argv[optind + 1], argv[optind + 2], impairment, seed);
+  relay.run();
+  relay.printStats();
+  return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef RELAY_HPP
+#define RELAY_HPP
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+typedef std::chrono::steady_clock::time_point c_time;
+
+const int RELAY_MAX_DATAGRAM = 65536;
+const int RELAY_DEFAULT_QUEUE_BYTES = 262144; // bottleneck buffer of a rate limited direction
+const double RELAY_MIN_REORDER_DELAY_MS = 1;  // a reordered datagram is held back at least this long
+
+/**
+ * @brief Network conditions, applied to each direction on its own
+ */
+struct Impairment
+{
+  Impairment();
+
+  double delayMs;   // one way delay
+  double jitterMs;  // delay varies uniformly within +-jitterMs, which also reorders
+  double loss;      // probability that a datagram is dropped
+  double reorder;   // probability that a datagram is held back by another delay behind later ones
+  double duplicate; // probability that a datagram is delivered twice
+  double rateKbit;  // bottleneck bandwidth in kbit/s, 0 for unlimited
+  int queueBytes;   // bytes waiting for the bottleneck before new datagrams are dropped
+};
+
+struct Endpoint
+{
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+};
+
+struct Datagram // waiting to be delivered
+{
+  c_time deliverAt;
+  long order; // datagrams due at the same time leave in arrival order
+  int sockFd;
+  Endpoint to;
+  std::string data;
+};
+
+struct DatagramLater
+{
+  bool operator()(const Datagram *a, const Datagram *b) const
+  {
+    return a->deliverAt > b->deliverAt || (a->deliverAt == b->deliverAt && a->order > b->order);
+  }
+};
+
+struct Direction // one way through the relay
+{
+  Direction(std::string name);
+
+  std::string name;
+  c_time linkFreeAt; // when the bottleneck has sent everything queued so far
+  long received, forwarded, lost, queueDrops, duplicated, reordered;
+};
+
+/**
+ * A UDP relay between clients and one server that impairs the traffic passing through it like
+ * a lossy, slow or reordering network would. Every client address gets its own upstream
+ * socket, so the server sees one address per client.
+ */
+class Relay
+{
+public:
+  Relay(char *listenPort, std::string serverHost, char *serverPort, Impairment impairment, unsigned seed);
+  ~Relay();
+  void run();        // relays until SIGINT or SIGTERM
+  void printStats(); // counts of both directions, to stderr
+
+private:
+  void receive(int sockFd);
+  void schedule(Direction &direction, int sockFd, Endpoint &to, const char *data, int length);
+  void deliverDue();
+  int upstreamSocket(Endpoint &client);
+  double uniform(); // in [0, 1)
+
+  int m_listenFd;
+  Endpoint m_server;
+  Impairment m_impairment;
+  std::mt19937 m_random; // seeded, so a run can be repeated
+  long m_nextOrder;
+  Direction m_toServer;
+  Direction m_toClient;
+  std::priority_queue<Datagram *, std::vector<Datagram *>, DatagramLater> m_pending;
+  std::unordered_map<std::string, int> m_clientToUpstream; // upstream socket by client address
+  std::unordered_map<int, Endpoint> m_upstreamToClient;
+};
+
+#endif // RELAY_HPP
@@ -1,7 +1,5 @@
 #include <string>
 #include <string.h>
-#include <bitset>
-#include <thread>
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -14,18 +12,29 @@
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <limits.h>
 #include "server.hpp"
 #include "constants.hpp"
-#include "utilities.hpp"
-#include "tcp.hpp"
+#include "options.hpp"
+#include "session.hpp"
+#include "latency.hpp"
+#include "aead.hpp"
+#include "sharedkey.hpp"
+#include "latencysignals.hpp"
 
 // SERVER IMPLEMENTATION
 
 // CONSTRUCTORS
 
-Server::Server(char *port, std::string saveFolder)
+Server::Server(char *port, std::string saveFolder, std::string metricsPath, std::string tracePath, bool latency, int synCookieLimit,
+               int64_t receiveBudget, int busyPollCpu, bool offload, std::string sharedKey)
+    : m_engine(sharedKey, synCookieLimit, receiveBudget), m_stages(SERVER_STAGE_NAMES, SERVER_STAGES), m_reader(MAX_PACKET_LENGTH + AEAD_TRAILER_LEN) // the longer of the two trailers
 {
   m_folderName = saveFolder;
+  m_metricsPath = metricsPath;
+  m_metricsWrittenAt = std::chrono::steady_clock::now();
 
   struct addrinfo hints, *myAddrInfo, *p;
   memset(&hints, 0, sizeof(hints));
@@ -60,6 +69,37 @@ Server::Server(char *port, std::string saveFolder)
     perror("listener: failed to bind socket");
     exit(1);
   }
+  freeaddrinfo(myAddrInfo);
+
+  if (!tracePath.empty())
+  {
+    if (!m_tracer.open(tracePath, TRACE_SERVER))
+    {
+      std::cerr << "ERROR: Unable to open trace file " << tracePath << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    m_tracing = true;
+  }
+  m_engine.setPacketLog(true);
+
+  if (latency)
+  {
+    m_stages.enable();
+    if (!timestampReceives(m_sockFd))
+      perror("setsockopt SO_TIMESTAMPNS");
+    watchLatencySignals(true);
+    m_engine.setLatencyStages(&m_stages);
+  }
+  if (busyPollCpu != -1)
+    m_busyPoll.enable(m_sockFd, busyPollCpu);
+  if (offload && m_reader.enableOffload(m_sockFd))
+    m_sendOffload = probeSegmentationOffload(m_sockFd);
+
+  // the timers of the engine and the metrics file are served from the receive loop, which must
+  // not wait for packets forever; a tick of the shortest timer is late by at most that much
+  float tick = std::min(RETRANSMISSION_TIMEOUT, METRICS_INTERVAL);
+  struct timeval timeout = {(time_t)tick, (suseconds_t)((tick - (time_t)tick) * 1000000)};
+  setsockopt(m_sockFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 }
 Server::~Server()
 {
@@ -67,379 +107,398 @@ Server::~Server()
 
 void Server::run()
 {
-  handleConnection();
+  while (true) // since server will run indefinitely, and we're not using multithreading/forking
+  {
+    if (m_stages.enabled() && (takeLatencyDumpRequest() || latencyExitRequested()))
+    {
+      std::cerr << m_stages.table() << std::flush;
+      if (latencyExitRequested())
+        return;
+    }
+    // close any timed out connection and resend lost FIN-ACKs once they are due
+    c_time now = std::chrono::steady_clock::now();
+    if (now >= m_engine.nextDeadline())
+    {
+      m_engine.handleTimers(now);
+      drain();
+    }
+    if (!m_metricsPath.empty() && now - m_metricsWrittenAt >= std::chrono::duration<float>(METRICS_INTERVAL))
+      writeMetrics();
+    // the next packet is the next segment of the last receive, or the first of a new one
+    char *packetBuffer;
+    uint64_t stageStart;
+    int bytesRead = m_reader.next(&packetBuffer);
+    if (bytesRead == -1)
+    {
+      flushSendQueue(); // before waiting for the next receive
+      // with histograms a datagram that is already queued is received without blocking, so the
+      // recv stage times the system call and not the wait for the next datagram
+      stageStart = m_stages.start();
+      int received = -1;
+      if (m_stages.enabled())
+        received = m_reader.receive(m_sockFd, MSG_DONTWAIT, &m_stages, SERVER_DELIVERY);
+      if (received == -1)
+      {
+        if (m_busyPoll.enabled())
+          m_busyPoll.spin(m_sockFd); // the receive below returns at once if a datagram came during the spin
+        received = m_reader.receive(m_sockFd, 0, &m_stages, SERVER_DELIVERY);
+      }
+      else
+        m_stages.stop(SERVER_RECV, stageStart);
+      if (received == -1)
+        continue;
+      bytesRead = m_reader.next(&packetBuffer);
+    }
+    m_engine.receive(packetBuffer, bytesRead, (sockaddr *)m_reader.sender(), m_reader.senderLen(), std::chrono::steady_clock::now());
+    drain();
+  }
 }
 
 /**
- * @brief Enumerate through timers and if any timer has timed out, release resources for that connection
- *
+ * @brief Takes out everything the last call into the engine left: events first, as accepting a
+ * connection sends its SYN-ACK, then the datagrams and the packet log
  */
-void Server::closeTimedOutConnectionsAndRetransmitFIN()
+void Server::drain()
 {
-  for (auto it = m_connectionIdToTCB.begin(); it != m_connectionIdToTCB.end(); it++)
+  ServerEvent event;
+  while (m_engine.pollEvent(event))
   {
-    // close connection if connection inactive for 10s
-    if (!checkTimer(it->first, CONNECTION_TIMEOUT)) // check timer by connection id
-    {                                               // timer run out
-      closeConnection(it->first);
-    }
-
-    // retransmit fin packet if ACK not received after server FIN-ACK
-    else if (it->second->connectionState == FIN_RECEIVED && !checkTimer(it->first, RETRANSMISSION_TIMEOUT))
+    if (event.type == SERVER_CONNECTION_REQUESTED)
+      openConnection(event.connId, *event.options, event.peer, event.peerLen);
+    else if (event.type == SERVER_DATA)
     {
-      sendPacket(it->second->clientInfo, it->second->clientInfoLen, it->second->finPacket);
-      setTimer(it->first);
+      uint64_t stageStart = m_stages.start();
+      deliver(event.connId, event.data, event.length);
+      m_stages.stop(SERVER_FLUSH, stageStart);
     }
+    else if (event.type == SERVER_CONNECTION_CLOSED)
+      closeOutput(event.connId, event.complete);
+    else
+      outputToStderr(event.message);
+  }
+
+  Datagram datagram;
+  while (m_engine.pollDatagram(datagram))
+  {
+    uint64_t stageStart = m_stages.start();
+    sendPacket(datagram.to, datagram.toLen, datagram.data, datagram.length);
+    m_stages.stop(SERVER_ACK_SEND, stageStart);
+  }
+
+  TraceRecord record;
+  while (m_engine.pollLog(record))
+  {
+    if (m_tracing)
+      m_tracer.record(record);
+    else
+      outputToStdout(traceLine(record));
   }
 }
 
 /**
- * @brief Shift the window a certain number of bytes ahead for a connection
- *
- * @param id connection id
- * @param bytes number of bytes to shift winodw by
+ * @brief Creates the output of a connection the engine was asked for and accepts it, or refuses
+ * it if there is none. Options the server does not take are turned off before they are echoed.
  */
-void Server::moveWindow(int connId, int bytes)
+void Server::openConnection(int connId, ConnectionOptions options, const struct sockaddr *clientInfo, socklen_t clientInfoLen)
 {
-  using namespace std;
-  vector<char> &connectionBuffer = m_connectionIdToTCB[connId]->connectionBuffer;
-  bitset<RWND_BYTES> &connectionBitset = m_connectionIdToTCB[connId]->connectionBitvector;
+  if (options.compression != CODEC_ZLIB)
+    options.compression = CODEC_NONE; // unknown codec, the client sends plain bytes or gives up
+  if (options.session)
+  {
+    options.stripe = false; // the files of a session are sent whole over one connection
+    options.resume = false;
+  }
 
-  if (bytes >= (int)connectionBuffer.size())
+  // create an output file, or join the one of the striped transfer
+  std::string transferKey;
+  int fd = options.session ? openSessionDirectory(connId) : openOutputFile(connId, options, clientInfo, clientInfoLen, transferKey);
+  if (fd == -1)
+  {
+    m_engine.refuse(connId); // connection is refused, the client times out
     return;
+  }
 
-  for (int i = 0; i < RWND_BYTES - bytes; i++) // last value of i will be RWND_BYTES - bytesToWriite - 1
+  ConnectionOutput *output = new ConnectionOutput(options.session ? -1 : fd);
+  output->transferKey = transferKey;
+  output->fileOffset = options.stripe ? options.stripeOffset : 0;
+  if (options.resume)
   {
-    connectionBuffer[i] = connectionBuffer[i + bytes];
-    connectionBitset[i] = connectionBitset[i + bytes];
+    output->resumable = true;
+    output->resumeToken = options.resumeToken;
+    output->resumeHost = peerHost(clientInfo);
+    output->fileOffset = options.resumeOffset;
+    m_resumeTokens[output->resumeHost + std::to_string(options.resumeToken)] = connId;
   }
-
-  for (int i = RWND_BYTES - bytes; i < RWND_BYTES; i++)
+  if (options.compression != CODEC_NONE)
+    output->decoder = new FrameDecoder();
+  if (options.session)
   {
-    connectionBuffer[i] = 0;
-    connectionBitset[i] = 0;
+    output->session = new SessionDecoder();
+    output->sessionDirectory = fd;
   }
+  m_outputs[connId] = output;
+  m_engine.accept(connId, options);
 }
 
 /**
- * @brief Function that handles all of the incoming connections
+ * @brief Opens the output file of a new connection. Connections of a striped transfer (same
+ * client address and transfer id) share one file, named after the first connection.
  *
+ * @param transferKey set to the key of the shared file, empty if the file is not shared
+ * @return file descriptor, -1 on error
  */
-void Server::handleConnection()
+int Server::openOutputFile(int connId, ConnectionOptions &options, const struct sockaddr *clientInfo, socklen_t clientInfoLen, std::string &transferKey)
 {
-  using namespace std;
-  while (true) // since server will run indefinitely, and we're not using multithreading/forking
-  {
-    closeTimedOutConnectionsAndRetransmitFIN(); // check and close any timed out connection every iteration
-    // prepare to read incoming packet
-    char packetBuffer[MAX_PACKET_LENGTH + 1]; // last byte nullbyte
-    struct sockaddr clientInfo;               // needed to send response
-    socklen_t clientInfoLen = sizeof(clientInfo);
-    int bytesRead = recvfrom(m_sockFd, packetBuffer, MAX_PACKET_LENGTH, 0, &clientInfo, &clientInfoLen);
-    packetBuffer[MAX_PACKET_LENGTH] = 0; // mark the end with a null byte
+  transferKey = "";
+  if (options.stripe || options.compression != CODEC_NONE)
+    options.resume = false; // stripes are not written contiguously and frames do not map to file offsets, neither can be resumed
+  if (options.resume)
+    return openResumableFile(connId, options, peerHost(clientInfo));
 
-    // convert C string to std::string
-    std::string packet = convertCStringtoStandardString(packetBuffer, bytesRead);
-
-    TCPPacket *p = new TCPPacket(packet); // create new packet from string
-    int packetConnId = p->getConnId();    // get the connection ID of the packet
-
-    /* everything will go through addNewConnection and handlefIN as if the packet is
-     relevant to them they will update connection state */
-    packetConnId = addNewConnection(p, &clientInfo, clientInfoLen);
-    bool finHandled = handleFin(p, packetConnId);
-
-    // if packet is not in map then discard it
-    if (m_connectionIdToTCB.find(packetConnId) == m_connectionIdToTCB.end())
+  if (options.stripe)
+  {
+    transferKey = std::string((char *)clientInfo, clientInfoLen) + std::to_string(options.transferId);
+    auto it = m_transfers.find(transferKey);
+    if (it != m_transfers.end())
     {
-      // there should be no other reason for us to find a SYN unless we're not adding a new connection
-      // do nothing, packet will be deleted
+      it->second.connections++;
+      return it->second.fileDescriptor;
     }
-    else if (!finHandled)
-    {
-      // set timer for packets to detect 10s inactivity of connection
-      setTimer(packetConnId);
-      int returnValue = addPacketToBuffer(packetConnId, p);
-      flushBuffer(packetConnId);
-
-      // check if the a SYN-ACK needs to be sent
-      bool synFlag = false;
-      if (m_connectionIdToTCB[packetConnId]->connectionState == AWAITING_ACK)
-      {
-        synFlag = true;
-      }
-      bool isDup = m_connectionIdToTCB[packetConnId]->connectionExpectedSeqNum == m_connectionIdToTCB[packetConnId]->previousExpectedSeqNum;
-      m_connectionIdToTCB[packetConnId]->previousExpectedSeqNum = m_connectionIdToTCB[packetConnId]->connectionExpectedSeqNum;
-      bool isDropped = returnValue == PACKET_DROPPED;
-
-      printPacket(p, true, isDropped, false); // for receipt of the packet receive
+  }
 
-      if (returnValue == PACKET_ADDED || returnValue == PACKET_DUPLICATE || returnValue == PACKET_DROPPED)
-      {
-        // if reached this block, then packet was valid and ACK should be sent
-        TCPPacket *ackPacket = new TCPPacket(
-            m_connectionIdToTCB[packetConnId]->connectionServerSeqNum,   // sequence number
-            m_connectionIdToTCB[packetConnId]->connectionExpectedSeqNum, // ack number
-            packetConnId,                                                // connection id
-            true,                                                        // is an ACK
-            synFlag,                                                     // decided by synFlag
-            false,                                                       // is not FIN
-            0,                                                           // no payload
-            "");
-        if (synFlag)
-          ++m_connectionIdToTCB[packetConnId]->connectionServerSeqNum;
-        sendPacket(&clientInfo, clientInfoLen, ackPacket);
-        printPacket(ackPacket, false, false, isDup); // for receipt of the packet send
-        delete ackPacket;
-        ackPacket = nullptr;
-      }
-    }
-    // delete the packet
-    delete p;
-    p = nullptr;
+  // TODO: assumed existance of save directory
+  std::string pathName = m_folderName + "/" + std::to_string(connId) + ".file";
+  int fd = open(pathName.c_str(), O_CREAT | O_WRONLY, 0644);
+  if (fd == -1)
+  {
+    outputToStderr("Unable to open output file " + pathName + ": " + std::string(strerror(errno)));
+    transferKey = "";
+    return -1;
   }
+
+  if (options.stripe)
+    m_transfers[transferKey] = {fd, 1};
+  return fd;
 }
 
 /**
- * @brief Adds packet to the buffer
+ * @brief Opens the output file of a resumable transfer. The file of a token known from the same
+ * client host is reopened and the bytes it holds are flushed to disk; they are reported in
+ * options.resumeOffset so the client continues from there. Any other token starts a new file and
+ * records its name in a resume record in the save folder, so the transfer can also be resumed
+ * after a server restart. Tokens are not secret, binding them to the host keeps other clients
+ * from appending to the file.
  *
- * @param p pointer to the TCPPacket
- * @return True if packet was successfully added to the buffer, false if no space was available,the pointer was nullptr, or it was a duplicate
+ * @return file descriptor, -1 on error
  */
-int Server::addPacketToBuffer(int connId, TCPPacket *p)
+int Server::openResumableFile(int connId, ConnectionOptions &options, std::string host)
 {
-  /*
-Several implementations could have been used here in the case that we
-receive a packet that has fills a gap AND also overwrites on either side.
-One approach would be that if any byte in the range of the packet in the window
-has already been written to then drop the packet, removing the chance of an overwrite.
-However, the counter argument to that was -- what's the guarantee that the first packet
-I got was not corrupted (since such a case would only arise in the case of a corruption)
-
-Thus, the current implementation is that if there is an overlap in bits, overwrite.
-
-Packets that have overlapping bytes should result in undefined behavior, which is
-exactly what this implementation would provide, since the order of arrival of the
-packets is not definite, and the result is therefore indeterminate.
-*/
-
-  using namespace std;
-  if (p == nullptr)
-    return PACKET_NULL;
-  if (p->isSYN())
-    return PACKET_ADDED;
-  vector<char> &connectionBuffer = m_connectionIdToTCB[connId]->connectionBuffer;
-  bitset<RWND_BYTES> &connectionBitset = m_connectionIdToTCB[connId]->connectionBitvector;
-  int nextExpectedSeqNum = m_connectionIdToTCB[connId]->connectionExpectedSeqNum;
-
-  int packetSeqNum = p->getSeqNum();
-  int payloadLen = p->getPayloadLength();
-  string payloadBuffer = p->getPayload();
-
-  if (p->isFIN() || m_connectionIdToTCB[connId]->connectionState == FIN_RECEIVED)
-    return PACKET_DROPPED;
-
-  /*
-  HANDLING OF WRAP AROUND:
-
-  The only time we will see a wrap around in action is if the the sequence number of the packet arrived
-  is less than the nextExpectedSequnceNumber
-
-  What about the case if there is a wrap around of the sequence number within the packet's payload?
-  We don't care; the nextExpectedSeqNum would be an offset such that all the payload should have space.
-  If that runs out of bounds, we should DROP the packet, not accomodate for it by wrapping out in the buffer.
-
-  We NEVER wrap around in index to the start of the buffer. We ONLY wrap around in terms of the next packet's sequence number.
-
-  In such a case that there is a wrap around, then for all we are concerned, we only need to shift the offset
-
-  This logic sets the code as follows:
-  */
-
-  int offset = packetSeqNum - nextExpectedSeqNum;
-
-  if (packetSeqNum < nextExpectedSeqNum)
+  // the client gave up on a connection that has not timed out here yet
+  auto live = m_resumeTokens.find(host + std::to_string(options.resumeToken));
+  if (live != m_resumeTokens.end())
   {
-    offset = MAX_SEQ_NUM + packetSeqNum - nextExpectedSeqNum + 1;
-    /*
-    RWND_BYTES + packetSeqNum => shift the packets sequence number as if it is moving beyond the maximum sequence number
-    - nextExpectedSeqNum => shift back based on the base offset
-    */
+    m_engine.closeConnection(live->second);
+    closeOutput(live->second, false);
   }
 
-  // when to drop?
-  // we have an adjusted base offset, all we have to see now is if it runs above or below bounds
-  // (because RWND_BYTES + packetSeqNum - nextExpectedSeqNum) can be less than 0 or it can go beyond the buffer
-  // a neat way to think of offset is an "adjusted sequence number"
-  if (offset + payloadLen > RWND_BYTES)
-    return PACKET_DROPPED;
-
-  for (int i = 0; i < payloadLen; i++)
+  std::string recordPath = resumeRecordPath(options.resumeToken, host);
+  int recordFd = open(recordPath.c_str(), O_RDONLY);
+  if (recordFd != -1)
   {
+    char pathName[PATH_MAX];
+    ssize_t len = read(recordFd, pathName, sizeof(pathName) - 1);
+    close(recordFd);
+    int fd = (len > 0) ? open(std::string(pathName, len).c_str(), O_WRONLY) : -1;
+    struct stat st;
+    if (fd != -1 && fdatasync(fd) == 0 && fstat(fd, &st) == 0)
+    {
+      options.resumeOffset = st.st_size; // written in order, so every byte of the file is contiguous
+      return fd;
+    }
+    if (fd != -1)
+      close(fd);
+    outputToStderr("Unable to resume transfer from " + recordPath + ", starting over");
+  }
 
-    connectionBuffer[offset + i] = payloadBuffer[i];
-    connectionBitset[offset + i] = 1; // now mark as used, regardless of overwrite
+  std::string pathName = m_folderName + "/" + std::to_string(connId) + ".file";
+  int fd = open(pathName.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd == -1)
+  {
+    outputToStderr("Unable to open output file " + pathName + ": " + std::string(strerror(errno)));
+    return -1;
   }
-  return PACKET_ADDED;
+  recordFd = open(recordPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (recordFd == -1 || write(recordFd, pathName.data(), pathName.size()) != (ssize_t)pathName.size() || fsync(recordFd) != 0)
+    outputToStderr("Unable to write resume record " + recordPath + ": " + std::string(strerror(errno)));
+  if (recordFd != -1)
+    close(recordFd);
+  options.resumeOffset = 0;
+  return fd;
 }
 
 /**
- * @brief Writes consecutive packets that have arrived in the buffer from the start, updates next expected sequence number, and initializes next slots in buffer to nullptr
+ * @brief Creates the folder the files of a session go to, named after the connection
  *
- * @return number of bytes that were written
+ * @return file descriptor of the folder, -1 on error
  */
-int Server::flushBuffer(int connId)
+int Server::openSessionDirectory(int connId)
 {
-  using namespace std;
-  vector<char> &connectionBuffer = m_connectionIdToTCB[connId]->connectionBuffer;
-  bitset<RWND_BYTES> &connectionBitset = m_connectionIdToTCB[connId]->connectionBitvector;
-  int &nextExpectedSeqNum = m_connectionIdToTCB[connId]->connectionExpectedSeqNum;
-
-  // find the number of bytes to write
-  int bytesToWrite = 0;
-  for (; bytesToWrite < RWND_BYTES && connectionBitset[bytesToWrite] == 1; bytesToWrite++)
-    ;
-
-  char *outputBuffer = new char[bytesToWrite + 1];
-
-  std::copy(connectionBuffer.begin(), connectionBuffer.begin() + bytesToWrite, outputBuffer);
-  outputBuffer[bytesToWrite] = 0; // just for safety
-
-  writeToFile(connId, outputBuffer, bytesToWrite);
-  nextExpectedSeqNum += bytesToWrite; // update the next expected sequence number
-  nextExpectedSeqNum %= MAX_SEQ_NUM + 1;
-
-  delete[] outputBuffer;
-  outputBuffer = nullptr;
-
-  moveWindow(connId, bytesToWrite);
-
-  return bytesToWrite;
+  std::string pathName = m_folderName + "/" + std::to_string(connId);
+  if (mkdir(pathName.c_str(), 0755) == -1 && errno != EEXIST)
+  {
+    outputToStderr("Unable to create session folder " + pathName + ": " + std::string(strerror(errno)));
+    return -1;
+  }
+  int fd = open(pathName.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    outputToStderr("Unable to open session folder " + pathName + ": " + std::string(strerror(errno)));
+  return fd;
 }
 
 /**
- * @brief Adds a new connection and sets the correct connection State
+ * @brief Creates a file of a session and the folders of its name below the session folder. The
+ * decoder only passes relative names without "." or "..", and no symbolic link is followed.
+ *
+ * @return file descriptor, -1 on error
  */
-int Server::addNewConnection(TCPPacket *p, sockaddr *clientInfo, socklen_t clientInfoLen)
+int Server::openSessionFile(int connId, std::string name)
 {
-  if (p->isSYN() && p->getConnId() == 0) // new connection id
+  int directory = m_outputs[connId]->sessionDirectory;
+  for (size_t slash = name.find('/'); slash != std::string::npos; slash = name.find('/', slash + 1))
   {
-    // Get the connection ID
-    int packetConnId = m_nextAvailableConnectionId;
-
-    // create an output file
-    // TODO: assumed existance of save directory
-    std::string pathName = m_folderName + "/" + std::to_string(packetConnId) + ".file";
-    int fd = open(pathName.c_str(), O_CREAT | O_WRONLY, 0644);
-
-    // set up TCB and start timer
-    m_connectionIdToTCB[packetConnId] = new TCB(p->getSeqNum() + 1, fd, ConnectionState::AWAITING_ACK, true, clientInfo, clientInfoLen); // +1 in constructer as SYN == 1byte
-    m_connectionIdToTCB[packetConnId]->clientInfo = clientInfo;
-    m_connectionIdToTCB[packetConnId]->clientInfoLen = clientInfoLen;
-    m_connectionIdToTCB[packetConnId]->connectionFileDescriptor = fd;
-    setTimer(packetConnId);
-
-    ++m_nextAvailableConnectionId; // update the next available connection Id
-    return packetConnId;
+    if (mkdirat(directory, name.substr(0, slash).c_str(), 0755) == -1 && errno != EEXIST)
+      break; // openat reports it
   }
+  int fd = openat(directory, name.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_NOFOLLOW, 0644);
+  if (fd == -1)
+    outputToStderr("Unable to open output file " + m_folderName + "/" + std::to_string(connId) + "/" + name + ": " + std::string(strerror(errno)));
+  return fd;
+}
 
-  // Update Connection state in case of an ACK
-  else if (p->isACK() && m_connectionIdToTCB[p->getConnId()]->connectionState == AWAITING_ACK) // new connection id
+/**
+ * @brief Writes the in order data of a session: every record opens the next file, whose bytes
+ * follow, and the file gets the mode and modification time of the record once it is complete.
+ * The bytes of a file that can not be opened are dropped.
+ */
+void Server::writeSessionData(int connId, const char *data, int len)
+{
+  ConnectionOutput *output = m_outputs[connId];
+  std::vector<SessionEvent> events;
+  bool valid = output->session->decode(data, len, events);
+  for (auto &event : events)
   {
-    m_connectionIdToTCB[p->getConnId()]->connectionState = ConnectionState::CONNECTION_SET;
-    return p->getConnId();
+    int &fd = output->fileDescriptor;
+    if (event.type == SESSION_FILE_START)
+    {
+      fd = openSessionFile(connId, event.file.name);
+      output->fileOffset = 0;
+    }
+    else if (event.type == SESSION_FILE_DATA && fd != -1)
+      writeToFile(connId, event.data, event.length);
+    else if (event.type == SESSION_FILE_END && fd != -1)
+    {
+      struct timespec times[2];
+      times[0].tv_sec = event.file.mtimeSeconds;
+      times[0].tv_nsec = event.file.mtimeNanoseconds;
+      times[1] = times[0];
+      if (fchmod(fd, event.file.mode & 07777) == -1 || futimens(fd, times) == -1)
+        outputToStderr("Unable to set the mode and time of " + event.file.name + ": " + std::string(strerror(errno)));
+      close(fd);
+      fd = -1;
+      m_sessionFiles++;
+    }
   }
-  return p->getConnId();
+  if (!valid)
+    outputToStderr("Corrupt session data on connection " + std::to_string(connId));
 }
 
 /**
- * @brief close connection and remove entry from unordered map
+ * @brief Path of the file that maps a resume token of a client host to its output file
  */
-void Server::closeConnection(int connId)
+std::string Server::resumeRecordPath(uint64_t token, std::string host)
 {
-  // delete TCB Block
-  delete m_connectionIdToTCB[connId];
-  m_connectionIdToTCB[connId] = nullptr;
-  m_connectionIdToTCB.erase(connId);
+  char name[32];
+  snprintf(name, sizeof(name), ".%016llx.", (unsigned long long)token);
+  return m_folderName + "/" + name + host + ".resume";
 }
 
 /**
- * @brief set timer by saving current timestamp
+ * @brief Address of a client without its port, in hex: a rerun of the client resumes from
+ * another port
  */
-void Server::setTimer(int connId)
+std::string Server::peerHost(const struct sockaddr *clientInfo)
 {
-  m_connectionIdToTCB[connId]->connectionTimer = std::chrono::system_clock::now();
+  const unsigned char *address;
+  size_t length;
+  if (clientInfo->sa_family == AF_INET6)
+  {
+    address = (const unsigned char *)&((const struct sockaddr_in6 *)clientInfo)->sin6_addr;
+    length = sizeof(struct in6_addr);
+  }
+  else
+  {
+    address = (const unsigned char *)&((const struct sockaddr_in *)clientInfo)->sin_addr;
+    length = sizeof(struct in_addr);
+  }
+  std::string host;
+  char digits[3];
+  for (size_t i = 0; i < length; i++)
+  {
+    snprintf(digits, sizeof(digits), "%02x", address[i]);
+    host += digits;
+  }
+  return host;
 }
 
 /**
- * @brief check timer by comparing present timestamp with timerLimit
+ * @brief Closes the output file of a connection, unless other stripes still write to it, or the
+ * folder and the open file of a session
  */
-bool Server::checkTimer(int connId, float timerLimit)
+void Server::closeOutputFile(int connId)
 {
-  c_time current_time = std::chrono::system_clock::now();
-  c_time start_time = m_connectionIdToTCB[connId]->connectionTimer;
-  std::chrono::duration<double> elapsed_time = current_time - start_time;
-  int elapsed_seconds = elapsed_time.count();
-
-  return (elapsed_seconds < timerLimit);
+  ConnectionOutput *output = m_outputs[connId];
+  if (output->session != nullptr)
+  {
+    if (output->session->inFile())
+      outputToStderr("Session on connection " + std::to_string(connId) + " ended in the middle of " + output->session->fileName());
+    if (output->fileDescriptor != -1)
+      close(output->fileDescriptor);
+    close(output->sessionDirectory);
+    return;
+  }
+  if (!output->transferKey.empty())
+  {
+    auto it = m_transfers.find(output->transferKey);
+    if (it != m_transfers.end() && --it->second.connections > 0)
+      return;
+    m_transfers.erase(output->transferKey);
+  }
+  close(output->fileDescriptor);
 }
 
 /**
- * @brief handleFin
- * @return boolean if fin was handled or not
+ * @brief Closes the output of a connection the engine is done with. A resumable transfer is
+ * forgotten once it is complete, else it waits for the client to return.
  */
-bool Server::handleFin(TCPPacket *p, int connId)
+void Server::closeOutput(int connId, bool complete)
 {
-  if (p->getSeqNum() < m_connectionIdToTCB[connId]->connectionExpectedSeqNum)
-    return false;
-  // if fin packet update state and send fin from server
-  else if (p->isFIN())
-  {
+  auto it = m_outputs.find(connId);
+  if (it == m_outputs.end())
+    return;
+  closeOutputFile(connId);
 
-    // output the packet
-    bool duplicate = false;
-    if (m_connectionIdToTCB[connId]->connectionState == ConnectionState::FIN_RECEIVED)
-    {
-      // the FIN-ACK was already sent, but I got it again
-      duplicate = true;
-    }
+  ConnectionOutput *output = it->second;
+  if (output->resumable)
+  {
+    auto token = m_resumeTokens.find(output->resumeHost + std::to_string(output->resumeToken));
+    if (token != m_resumeTokens.end() && token->second == connId)
+      m_resumeTokens.erase(token);
+    if (complete)
+      unlink(resumeRecordPath(output->resumeToken, output->resumeHost).c_str());
+  }
 
-    printPacket(p, true, false, false);
-
-    // change state to FIN_RECEIVED -> wait for ACK for FIN-ACK
-    m_connectionIdToTCB[connId]->connectionState = ConnectionState::FIN_RECEIVED;
-    m_connectionIdToTCB[connId]->connectionExpectedSeqNum = (p->getSeqNum() + 1) % (MAX_SEQ_NUM + 1);
-
-    TCPPacket *finPacket = new TCPPacket(
-        m_connectionIdToTCB[connId]->connectionServerSeqNum,   // sequence number
-        m_connectionIdToTCB[connId]->connectionExpectedSeqNum, // ack number
-        connId,                                                // connection id
-        true,                                                  // is ACK
-        false,                                                 // is not SYN
-        true,                                                  // is FIN
-        0,                                                     // no payload
-        "");
-    sendPacket(m_connectionIdToTCB[connId]->clientInfo, m_connectionIdToTCB[connId]->clientInfoLen, finPacket);
-    // save the FIN packet
-    m_connectionIdToTCB[connId]->finPacket = finPacket;
-    printPacket(finPacket, false, false, duplicate);
-    setTimer(connId); // set timer
-    return true;
-  }
-
-  /*
-  If Ack recieved and the connection state is awaiting for ack then 4 way handwave
-  complete and so close connection
-  */
-  else if (p->isACK() && m_connectionIdToTCB[p->getConnId()]->connectionState == FIN_RECEIVED)
-  {
-    // write out the packet
-    printPacket(p, true, false, false);
-    // assuming that the received expected sequence number is the same as the one received
-    closeConnection(p->getConnId());
-    return true;
-  }
-  return false;
+  delete output;
+  m_outputs.erase(it);
 }
 
 void Server::outputToStdout(std::string message)
@@ -451,19 +510,31 @@ void Server::outputToStderr(std::string message)
   std::cerr << message << std::endl;
 }
 
-int Server::sendPacket(sockaddr *clientInfo, int clientInfoLen, TCPPacket *p)
+int Server::sendPacket(const struct sockaddr *clientInfo, socklen_t clientInfoLen, const char *packet, int packetLength)
 {
-  int packetLength;
-  char *packetCString;
   int bytesSent;
 
-  packetCString = p->getCString(packetLength);
-  if (p == nullptr)
+  // the answers to the segments of a coalesced receive go to the client that sent them, they are
+  // queued and leave together before the next receive
+  if (m_sendOffload && m_reader.coalesced())
   {
-    return -1;
+    bool sameClient = m_sendQueueCount > 0 && m_sendQueueToLen == clientInfoLen && memcmp(&m_sendQueueTo, clientInfo, clientInfoLen) == 0;
+    if (m_sendQueueCount > 0 && (!sameClient || m_sendQueueCount == GSO_MAX_SEGMENTS || packetLength > m_sendQueueSegment || m_sendQueueLast < m_sendQueueSegment))
+      flushSendQueue();
+    if (m_sendQueueCount == 0)
+    {
+      memcpy(&m_sendQueueTo, clientInfo, clientInfoLen);
+      m_sendQueueToLen = clientInfoLen;
+      m_sendQueueSegment = packetLength;
+    }
+    m_sendQueue.insert(m_sendQueue.end(), packet, packet + packetLength);
+    m_sendQueueLast = packetLength;
+    m_sendQueueCount++;
+    return packetLength;
   }
 
-  if ((bytesSent = sendto(m_sockFd, packetCString, packetLength, 0, clientInfo, clientInfoLen) == -1))
+  flushSendQueue();
+  if ((bytesSent = sendto(m_sockFd, packet, packetLength, 0, clientInfo, clientInfoLen)) == -1)
   {
     std::string errorMessage = "Packet send Error: " + std::string(strerror(errno));
     outputToStderr(errorMessage);
@@ -471,48 +542,172 @@ int Server::sendPacket(sockaddr *clientInfo, int clientInfoLen, TCPPacket *p)
   return bytesSent;
 }
 
-int Server::writeToFile(int connId, char *message, int len)
+/**
+ * @brief Sends the queued packets in one sendmsg cut at the length of the first. If the kernel
+ * or the device can not segment they are sent one by one, and every packet after them too.
+ */
+void Server::flushSendQueue()
 {
-  TCB *currentBlock = m_connectionIdToTCB[connId];
-  int fd = currentBlock->connectionFileDescriptor;
+  if (m_sendQueueCount == 0)
+    return;
+  struct iovec iov = {m_sendQueue.data(), m_sendQueue.size()};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &m_sendQueueTo;
+  msg.msg_namelen = m_sendQueueToLen;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[SEGMENT_SIZE_CONTROL_BYTES];
+  if (m_sendQueueCount > 1)
+    setSegmentSize(&msg, control, m_sendQueueSegment);
+  if (sendmsg(m_sockFd, &msg, 0) == -1)
+  {
+    if (m_sendQueueCount > 1 && isOffloadError(errno))
+    {
+      m_sendOffload = false;
+      for (size_t offset = 0; offset < m_sendQueue.size(); offset += m_sendQueueSegment)
+        sendto(m_sockFd, m_sendQueue.data() + offset, std::min((size_t)m_sendQueueSegment, m_sendQueue.size() - offset), 0, (sockaddr *)&m_sendQueueTo, m_sendQueueToLen);
+    }
+    else
+      outputToStderr("Packet send Error: " + std::string(strerror(errno)));
+  }
+  m_sendQueue.clear();
+  m_sendQueueCount = 0;
+}
+
+void Server::deliver(int connId, const char *data, int len)
+{
+  // a compressed connection carries frames, which are written out as they complete
+  FrameDecoder *decoder = m_outputs[connId]->decoder;
+  if (decoder == nullptr)
+    writeOutput(connId, data, len);
+  else
+  {
+    std::string decoded;
+    if (!decoder->decode(data, len, decoded))
+      outputToStderr("Corrupt compressed data on connection " + std::to_string(connId));
+    else if (!decoded.empty())
+      writeOutput(connId, &decoded[0], decoded.size());
+  }
+}
+
+void Server::writeOutput(int connId, const char *data, int len)
+{
+  if (m_outputs[connId]->session != nullptr)
+    writeSessionData(connId, data, len);
+  else
+    writeToFile(connId, data, len);
+}
+
+int Server::writeToFile(int connId, const char *message, int len)
+{
+  ConnectionOutput *output = m_outputs[connId];
   int bytesWrote;
-  if ((bytesWrote = write(fd, message, len)) == -1)
+  // positional write, stripes of one transfer fill different parts of the same file
+  c_time start = std::chrono::steady_clock::now();
+  bytesWrote = pwrite(output->fileDescriptor, message, len, output->fileOffset);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (bytesWrote == -1)
   {
     std::string errorMessage = "File write Error: " + std::string(strerror(errno));
     outputToStderr(errorMessage);
+    m_engine.reportWrite(connId, 0, seconds);
     return -1;
   }
+  output->fileOffset += bytesWrote;
+  m_engine.reportWrite(connId, bytesWrote, seconds); // the window follows what the disk takes
   return bytesWrote;
 }
 
-void Server::printPacket(TCPPacket *p, bool recvd, bool dropped, bool dup)
+/**
+ * @brief Replaces the metrics file with the counters of every open connection and the totals
+ * since start
+ */
+void Server::writeMetrics()
 {
-  std::string message;
+  c_time now = std::chrono::steady_clock::now();
+  ReceiverMetrics total = m_engine.getClosedMetrics();
+  std::vector<std::pair<std::string, ReceiverMetrics>> connections;
+  for (auto &entry : m_engine.connections())
+  {
+    total.add(entry.second->metrics);
+    connections.push_back(std::make_pair(MetricsText::label("connection", std::to_string(entry.first)), entry.second->metrics));
+  }
 
-  if (recvd)
-    message = "RECV";
-  else
-    message = "SEND";
-
-  if (recvd && dropped)
-    message = "DROP";
-
-  message = message + " " + std::to_string(p->getSeqNum()) + " " + std::to_string(p->getAckNum()) + " " + std::to_string(p->getConnId()) + " ";
-  if (p->isACK())
-    message += "ACK ";
-  if (p->isSYN())
-    message += "SYN ";
-  if (p->isFIN())
-    message += "FIN ";
-  if (dup && !recvd)
-    message += "DUP ";
-  message.pop_back(); // remove the trailing space
-  outputToStdout(message);
+  MetricsText text;
+  text.family("confundo_server_connections_opened_total", "counter", "Connections opened since start");
+  text.sample("confundo_server_connections_opened_total", "", m_engine.getConnectionsOpened());
+  text.family("confundo_server_open_connections", "gauge", "Connections open now");
+  text.sample("confundo_server_open_connections", "", m_engine.connections().size());
+  text.family("confundo_server_corrupt_packets_total", "counter", "Packets dropped for a wrong checksum");
+  text.sample("confundo_server_corrupt_packets_total", "", m_engine.getCorruptPackets());
+  text.family("confundo_server_syn_cookies_sent_total", "counter", "SYNs answered with a cookie instead of a connection");
+  text.sample("confundo_server_syn_cookies_sent_total", "", m_engine.getSynCookiesSent());
+  text.family("confundo_server_syn_cookies_accepted_total", "counter", "Connections opened by a SYN echoing a valid cookie");
+  text.sample("confundo_server_syn_cookies_accepted_total", "", m_engine.getSynCookiesAccepted());
+  text.family("confundo_server_session_files_total", "counter", "Files of sessions written completely");
+  text.sample("confundo_server_session_files_total", "", m_sessionFiles);
+  text.counters("confundo_server", total, connections);
+  text.family("confundo_server_receive_window_bytes", "gauge", "Receive windows of every connection together");
+  text.sample("confundo_server_receive_window_bytes", "", m_engine.getReceiveBytes());
+  text.family("confundo_server_receive_budget_bytes", "gauge", "Limit of the receive windows together");
+  text.sample("confundo_server_receive_budget_bytes", "", m_engine.getReceiveBudget());
+  text.family("confundo_server_connection_window_bytes", "gauge", "Receive window of the connection");
+  for (auto &entry : m_engine.connections())
+    text.sample("confundo_server_connection_window_bytes", MetricsText::label("connection", std::to_string(entry.first)),
+                entry.second->receiveBuffer.capacity());
+  text.family("confundo_server_connection_goodput_bytes_per_second", "gauge", "Bytes written per second since the connection opened");
+  for (auto &entry : m_engine.connections())
+  {
+    double seconds = std::chrono::duration<double>(now - entry.second->openedAt).count();
+    text.sample("confundo_server_connection_goodput_bytes_per_second", MetricsText::label("connection", std::to_string(entry.first)),
+                seconds > 0 ? entry.second->metrics.bytesWritten / seconds : 0);
+  }
+
+  if (!text.writeFile(m_metricsPath))
+    outputToStderr("Metrics file write Error: " + std::string(strerror(errno)));
+  m_metricsWrittenAt = now;
 }
 
+#ifndef CONFUNDO_NO_MAIN
 int main(int argc, char *argv[])
 {
   using namespace std;
+  string metricsPath;
+  string tracePath;
+  bool latency = false;
+  int synCookieLimit = SYN_COOKIE_HALF_OPEN;
+  int64_t receiveBudget = RECEIVE_BUDGET_BYTES;
+  int busyPollCpu = -1;
+  bool offload = true;
+  string sharedKey;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:ps:w:B:gk:")) != -1)
+  {
+    if (opt == 'm')
+      metricsPath = optarg;
+    else if (opt == 't')
+      tracePath = optarg;
+    else if (opt == 'p')
+      latency = true;
+    else if (opt == 's' && atoi(optarg) >= 0)
+      synCookieLimit = atoi(optarg);
+    else if (opt == 'w' && atoll(optarg) > 0)
+      receiveBudget = atoll(optarg);
+    else if (opt == 'B' && atoi(optarg) >= 0)
+      busyPollCpu = atoi(optarg);
+    else if (opt == 'g')
+      offload = false;
+    else if (opt == 'k')
+      sharedKey = readSharedKey(optarg);
+    else
+    {
+      cerr << "Usage: server [-m <metrics file>] [-t <trace file>] [-p] [-s <half-open connections before SYN cookies>] [-w <receive window budget bytes>] [-B <cpu to busy poll on>] [-g] [-k <shared key file>] <PORT> <FILE-DIR>" << endl;
+      exit(1);
+    }
+  }
+  argc -= optind - 1; // the port and folder follow the options
+  argv += optind - 1;
   if (argc != 3)
   {
     cerr << "ERROR: Incorrect number of arguments provided!" << endl;
@@ -531,6 +726,7 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
-  Server server(argv[1], argv[2]);
+  Server server(argv[1], argv[2], metricsPath, tracePath, latency, synCookieLimit, receiveBudget, busyPollCpu, offload, sharedKey);
   server.run();
 }
+#endif // CONFUNDO_NO_MAIN
@@ -2,80 +2,127 @@
 #define SERVER_HPP
 
 #include <vector>
+#include <deque>
 #include <string>
 #include <unordered_map>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <bitset>
 #include <chrono>
+#include <string.h>
+#include <stdint.h>
 #include "constants.hpp"
-#include "tcp.hpp"
+#include "options.hpp"
+#include "compression.hpp"
+#include "metricstext.hpp"
+#include "tracefile.hpp"
+#include "latency.hpp"
+#include "busypoll.hpp"
+#include "offload.hpp"
+#include "session.hpp"
+#include "serverengine.hpp"
 
-typedef std::chrono::time_point<std::chrono::system_clock> c_time;
-
-struct TCB
+struct ConnectionOutput // where the bytes of a connection go
 {
-	TCB(int expectedSeqNum, int fileDescriptor, ConnectionState state, bool syn, struct sockaddr *cInfo, socklen_t cInfoLen)
+	ConnectionOutput(int fd)
 	{
-		connectionBuffer = std::vector<char>(RWND_BYTES);
-		connectionServerSeqNum = INIT_SERVER_SEQ_NUM;
-		connectionExpectedSeqNum = expectedSeqNum;
-		previousExpectedSeqNum = -1;
-		connectionState = state;
-		clientInfo = cInfo;
-		clientInfoLen = cInfoLen;
-		finPacket = nullptr;
+		fileDescriptor = fd;
+		fileOffset = 0;
+		resumable = false;
+		resumeToken = 0;
+		decoder = nullptr;
+		session = nullptr;
+		sessionDirectory = -1;
 	}
 
-	~TCB()
+	~ConnectionOutput()
 	{
-		delete finPacket;
-		finPacket = nullptr;
+		delete decoder;
+		decoder = nullptr;
+		delete session;
+		session = nullptr;
 	}
 
-	std::vector<char> connectionBuffer;					 // Connection's payload buffer for each packet received
-	std::bitset<RWND_BYTES> connectionBitvector; // A bit vector to keep track of which packets have arrived to later flush to output file
-	int connectionExpectedSeqNum;								 // Next expected Seq Number from client
-	int previousExpectedSeqNum;
-	int connectionServerSeqNum;									 // Seq number to be sent in server ack packet
-	int connectionFileDescriptor;								 // Output target file
-	c_time connectionTimer;											 // connection timer at server side (Connection closes if this runs out)
-	ConnectionState connectionState;						 // connection state
-	TCPPacket *finPacket;
-	struct sockaddr *clientInfo;
-	socklen_t clientInfoLen;
+	int fileDescriptor;				// Output target file
+	int64_t fileOffset;				// Where the next byte goes in the output file
+	std::string transferKey;	// Key into Server::m_transfers if the output file is shared, else empty
+	bool resumable;						// the output file outlives a timed out connection
+	uint64_t resumeToken;			// Key into Server::m_resumeTokens with resumeHost if resumable
+	std::string resumeHost;		// Client address the transfer is bound to, see Server::peerHost()
+	FrameDecoder *decoder;		// Decodes the data of a compressed connection, else nullptr
+	SessionDecoder *session;	// Splits the data of a session into its files, else nullptr
+	int sessionDirectory;			// Folder the files of a session go to, -1 if not a session
 };
 
+struct OutputFile // output file shared by the connections of a striped transfer
+{
+	int fileDescriptor;
+	int connections; // open connections writing to the file
+};
+
+/**
+ * The driver of the server binary: owns the socket, the clock and the output files, and runs a
+ * ServerEngine with them. Every datagram goes into the engine, and after every call the driver
+ * opens the output of new connections, writes the data the engine hands out, sends its
+ * datagrams and prints or traces its packet log.
+ */
 class Server
 {
 public:
 	// #1
-	Server(char *port, std::string saveFolder);
+	// no metrics file if metricsPath is empty, a binary trace instead of the packet log if tracePath is set,
+	// latency histograms of the receive path printed on SIGUSR1 and on SIGINT or SIGTERM if latency is set,
+	// SYN cookies once synCookieLimit connections are half open (0 for always), receive windows of
+	// at most receiveBudget bytes together, the receive loop pinned to busyPollCpu and spinning
+	// before it blocks if that is not -1, see busypoll.hpp, UDP_GRO and UDP_SEGMENT if
+	// offload is set and the kernel has them, see offload.hpp, and only encrypted connections
+	// keyed from sharedKey if that is not empty, see aead.hpp
+	Server(char *port, std::string saveFolder, std::string metricsPath = "", std::string tracePath = "", bool latency = false,
+				 int synCookieLimit = SYN_COOKIE_HALF_OPEN, int64_t receiveBudget = RECEIVE_BUDGET_BYTES, int busyPollCpu = -1,
+				 bool offload = true, std::string sharedKey = "");
 	~Server();	// closes the socket
-	void run(); // engine function of the server //#3
+	void run(); // receive loop of the server //#3
 	void outputToStdout(std::string message);
 	void outputToStderr(std::string message);
-	void printPacket(TCPPacket *p, bool recvd, bool dropped, bool dup);
-	int writeToFile(int connId, char *message, int len);
-	int sendPacket(sockaddr *clientInfo, int clientInfoLen, TCPPacket *p);
-
-	// #2
-	int addNewConnection(TCPPacket *p, sockaddr *clientInfo, socklen_t clientInfoLen);
-	void setTimer(int connId);
-	bool checkTimer(int connId, float timerLimit); // false if timer runs out, true if still valid
-	bool handleFin(TCPPacket* p, int connId);
-	void closeConnection(int connId); // also will remove the connection ID entry from hashmap
-	void handleConnection();
-	int addPacketToBuffer(int connId, TCPPacket *p);
-	int flushBuffer(int connId);
 
 private:
 	int m_sockFd;
-	int m_nextAvailableConnectionId = 1;
-	void closeTimedOutConnectionsAndRetransmitFIN();
-	void moveWindow(int connId, int bytes);
+	ServerEngine m_engine;
+	void drain(); // handles the events of the engine, then sends its datagrams and logs its packets
+	void openConnection(int connId, ConnectionOptions options, const struct sockaddr *clientInfo, socklen_t clientInfoLen);
+	void closeOutput(int connId, bool complete); // also removes the connection ID entry from m_outputs
+	void deliver(int connId, const char *data, int len); // decodes and writes the in order data of a connection
+	void writeOutput(int connId, const char *data, int len); // to the output file, or to the files of a session
+	int writeToFile(int connId, const char *message, int len);
+	int openOutputFile(int connId, ConnectionOptions &options, const struct sockaddr *clientInfo, socklen_t clientInfoLen, std::string &transferKey);
+	void closeOutputFile(int connId);
+	int openResumableFile(int connId, ConnectionOptions &options, std::string host);
+	int openSessionDirectory(int connId);
+	int openSessionFile(int connId, std::string name);
+	void writeSessionData(int connId, const char *data, int len);
+	std::string resumeRecordPath(uint64_t token, std::string host);
+	static std::string peerHost(const struct sockaddr *clientInfo);
+	int sendPacket(const struct sockaddr *clientInfo, socklen_t clientInfoLen, const char *packet, int packetLength);
+	void flushSendQueue();
+	void writeMetrics();
 	std::string m_folderName;
-	std::unordered_map<int, TCB *> m_connectionIdToTCB;
+	std::string m_metricsPath;
+	c_time m_metricsWrittenAt;
+	int64_t m_sessionFiles = 0; // files of sessions written completely
+	bool m_tracing = false;
+	Tracer m_tracer;
+	LatencyStages m_stages;
+	BusyPoller m_busyPoll;
+	SegmentReader m_reader;
+	bool m_sendOffload = false;					// answers to a coalesced receive leave in one segmented send
+	std::vector<char> m_sendQueue;			// packets back to back for that send
+	int m_sendQueueCount = 0;
+	int m_sendQueueSegment = 0;					// length of the first packet, the segment size
+	int m_sendQueueLast = 0;						// length of the last packet
+	struct sockaddr_storage m_sendQueueTo;
+	socklen_t m_sendQueueToLen = 0;
+	std::unordered_map<int, ConnectionOutput *> m_outputs;		 // output of every accepted connection
+	std::unordered_map<std::string, OutputFile> m_transfers; // striped transfers by client address + transfer id
+	std::unordered_map<std::string, int> m_resumeTokens;		 // connection id currently writing each resumable transfer, by client host + token
 };
 
 #endif // SERVER_HPP
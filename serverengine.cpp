@@ -0,0 +1,1008 @@
+#include <string>
+#include <string.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include "serverengine.hpp"
+#include "constants.hpp"
+#include "tcp.hpp"
+#include "options.hpp"
+#include "crc32c.hpp"
+
+// SERVER ENGINE IMPLEMENTATION
+
+ServerEngine::ServerEngine(std::string sharedKey, int synCookieLimit, int64_t receiveBudget)
+{
+  m_now = c_time(); // the driver sets the clock with the first datagram or timer
+  m_sharedKey = sharedKey;
+  m_synCookieLimit = synCookieLimit;
+  m_receiveBudget = receiveBudget;
+  std::random_device random;
+  m_synCookieSecret = ((uint64_t)random() << 32) | random();
+}
+
+ServerEngine::~ServerEngine()
+{
+  for (auto &entry : m_connectionIdToTCB)
+    delete entry.second;
+}
+
+/**
+ * @brief Takes one datagram of a client: verifies it, opens connections, buffers and hands out
+ * the data in order, runs the handwave and answers with an ACK
+ */
+void ServerEngine::receive(char *datagram, int length, const struct sockaddr *from, socklen_t fromLen, c_time now)
+{
+  m_now = now;
+  if (length < HEADER_LEN) // runt datagram, not a packet
+    return;
+  uint64_t started = stageStart();
+  bool corrupt = !verifyChecksum(datagram, length) || !openPacket(datagram, length);
+
+  TCPPacket *p = new TCPPacket(std::string(datagram, length)); // create new packet from string
+  stageStop(SERVER_PARSE, started);
+  if (corrupt) // never reaches the buffer, the retransmission will
+  {
+    m_corruptPackets++;
+    logPacket(p, true, true, false);
+    delete p;
+    return;
+  }
+
+  // parity takes no sequence space and is only ACKed if it rebuilt a lost segment
+  if (p->getFecGroup() != 0)
+  {
+    auto it = m_connectionIdToTCB.find(p->getConnId());
+    if (it != m_connectionIdToTCB.end() && it->second->fec && it->second->connectionState != FIN_RECEIVED)
+    {
+      setTimer(it->first);
+      addParity(it->first, p);
+      if (recoverSegments(it->first))
+      {
+        flushBuffer(it->first);
+        sendAck(it->first, false, false);
+      }
+    }
+    delete p;
+    return;
+  }
+  started = stageStart();
+
+  /* everything will go through addNewConnection and handlefIN as if the packet is
+   relevant to them they will update connection state */
+  int packetConnId = addNewConnection(p, from, fromLen);
+  auto it = m_connectionIdToTCB.find(packetConnId);
+  bool finHandled = false;
+  if (it != m_connectionIdToTCB.end() && it->second->accepted)
+    finHandled = handleFin(p, packetConnId);
+  stageStop(SERVER_LOOKUP, started);
+
+  // packets of unknown connections, and of connections the driver did not accept yet, are discarded
+  it = m_connectionIdToTCB.find(packetConnId);
+  if (it != m_connectionIdToTCB.end() && it->second->accepted && !finHandled)
+  {
+    TCB *currentBlock = it->second;
+    // set timer for packets to detect 10s inactivity of connection
+    setTimer(packetConnId);
+    started = stageStart();
+    int returnValue = addPacketToBuffer(packetConnId, p);
+    if (!currentBlock->parityGroups.empty())
+      recoverSegments(packetConnId);
+    flushBuffer(packetConnId); // the driver times writing the bytes out as SERVER_FLUSH
+    stageStop(SERVER_INSERT, started);
+
+    // check if the a SYN-ACK needs to be sent
+    bool synFlag = currentBlock->connectionState == AWAITING_ACK;
+    bool isDup = currentBlock->connectionExpectedSeqNum == currentBlock->previousExpectedSeqNum;
+    currentBlock->previousExpectedSeqNum = currentBlock->connectionExpectedSeqNum;
+    bool isDropped = returnValue == PACKET_DROPPED;
+
+    logPacket(p, true, isDropped, false); // for receipt of the packet receive
+
+    if (returnValue == PACKET_ADDED || returnValue == PACKET_DUPLICATE || returnValue == PACKET_DROPPED)
+    {
+      // if reached this block, then packet was valid and ACK should be sent
+      sendAck(packetConnId, synFlag, isDup);
+    }
+  }
+  delete p;
+}
+
+/**
+ * @brief Enumerate through timers and if any timer has timed out, release resources for that connection
+ *
+ */
+void ServerEngine::handleTimers(c_time now)
+{
+  m_now = now;
+  for (auto next = m_connectionIdToTCB.begin(); next != m_connectionIdToTCB.end();)
+  {
+    auto it = next++; // endConnection() erases `it`
+    // close connection if connection inactive for 10s
+    if (!checkTimer(it->first, CONNECTION_TIMEOUT)) // check timer by connection id
+    {                                               // timer run out
+      endConnection(it->first);
+    }
+
+    // retransmit fin packet if ACK not received after server FIN-ACK
+    else if (it->second->connectionState == FIN_RECEIVED && !checkTimer(it->first, RETRANSMISSION_TIMEOUT))
+    {
+      sendPacket((sockaddr *)&it->second->clientInfo, it->second->clientInfoLen, it->second->finPacket);
+      setTimer(it->first);
+    }
+
+    // a closed window that the driver caught up with is opened by an ACK of its own
+    else if (it->second->windowClosed && now >= it->second->tunedAt + it->second->rtt)
+    {
+      tuneWindow(it->first);
+      if (!it->second->windowClosed)
+        sendAck(it->first, false, false);
+    }
+  }
+}
+
+/**
+ * @brief Earliest connection timeout or FIN-ACK retransmission of any connection
+ */
+c_time ServerEngine::nextDeadline()
+{
+  c_time deadline = c_time::max();
+  for (auto &entry : m_connectionIdToTCB)
+  {
+    float timerLimit = (entry.second->connectionState == FIN_RECEIVED) ? RETRANSMISSION_TIMEOUT : CONNECTION_TIMEOUT;
+    c_time expiry = entry.second->connectionTimer + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timerLimit));
+    deadline = std::min(deadline, expiry);
+    if (entry.second->windowClosed)
+      deadline = std::min(deadline, entry.second->tunedAt + entry.second->rtt);
+  }
+  return deadline;
+}
+
+/**
+ * @brief Checks the CRC32C trailer of a packet of a connection with checksums and strips it.
+ * Other packets, including every SYN, have no trailer and pass unchanged.
+ *
+ * @param length length of the datagram, set to the length without the trailer
+ * @return false if the packet is corrupt
+ */
+bool ServerEngine::verifyChecksum(const char *packet, int &length)
+{
+  uint16_t connId;
+  memcpy(&connId, packet + 8, sizeof(connId));
+  auto it = m_connectionIdToTCB.find(ntohs(connId));
+  bool syn = packet[11] & 2;
+  if (syn || it == m_connectionIdToTCB.end() || !it->second->checksums)
+    return true;
+  if (length < HEADER_LEN + CHECKSUM_LEN)
+    return false;
+
+  uint32_t trailer;
+  memcpy(&trailer, packet + length - CHECKSUM_LEN, sizeof(trailer));
+  length -= CHECKSUM_LEN;
+  return ntohl(trailer) == crc32c(0, packet, length);
+}
+
+/**
+ * @brief Verifies and decrypts in place a packet of an encrypted connection and strips its
+ * trailer. Other packets, including every SYN, pass unchanged.
+ *
+ * @param length length of the datagram, set to the length without the trailer
+ * @return false if the packet is forged, damaged or replayed
+ */
+bool ServerEngine::openPacket(char *packet, int &length)
+{
+  uint16_t connId;
+  memcpy(&connId, packet + 8, sizeof(connId));
+  auto it = m_connectionIdToTCB.find(ntohs(connId));
+  bool syn = packet[11] & 2;
+  if (syn || it == m_connectionIdToTCB.end() || it->second->cipher == nullptr)
+    return true;
+  int opened = it->second->cipher->open(packet, length);
+  if (opened == -1)
+    return false;
+  length = opened;
+  return true;
+}
+
+/**
+ * @brief Sends the ACK of everything flushed so far. A SYN-ACK carries the accepted
+ * connection options.
+ */
+void ServerEngine::sendAck(int connId, bool synFlag, bool isDup)
+{
+  uint64_t started = stageStart();
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  std::string ackPayload = synFlag ? currentBlock->synAckOptions : "";
+  if (synFlag) // every SYN-ACK of a connection is the same, a resent one must verify too
+    currentBlock->connectionServerSeqNum = INIT_SERVER_SEQ_NUM;
+  TCPPacket *ackPacket = new TCPPacket(
+      currentBlock->connectionServerSeqNum,   // sequence number
+      currentBlock->connectionExpectedSeqNum, // ack number
+      connId,                                 // connection id
+      true,                                   // is an ACK
+      synFlag,                                // decided by synFlag
+      false,                                  // is not FIN
+      ackPayload.size(),                      // options only
+      ackPayload);
+  if (synFlag)
+    ++currentBlock->connectionServerSeqNum;
+  ackPacket->setWindow(currentBlock->windowClosed ? 0 : currentBlock->receiveBuffer.capacity());
+  sendPacket((sockaddr *)&currentBlock->clientInfo, currentBlock->clientInfoLen, ackPacket);
+  stageStop(SERVER_ACK_BUILD, started);
+  logPacket(ackPacket, false, false, isDup); // for receipt of the packet send
+  delete ackPacket;
+  ackPacket = nullptr;
+}
+
+/**
+ * @brief Keeps the parity of a group of segments until every segment of the group arrived
+ */
+void ServerEngine::addParity(int connId, TCPPacket *p)
+{
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  if (p->getPayloadLength() != MAX_PAYLOAD_LENGTH || p->getFecGroup() > FEC_MAX_GROUP)
+    return;
+  currentBlock->parityGroups.push_back({p->getSeqNum(), p->getFecGroup(), p->getPayload()});
+  if ((int)currentBlock->parityGroups.size() > RWND_BYTES / MAX_PAYLOAD_LENGTH)
+    currentBlock->parityGroups.pop_front();
+}
+
+/**
+ * @brief Rebuilds every segment that is the only one missing from a group with known parity,
+ * by XORing the parity with the other segments of the group. Those are read from the receive
+ * buffer or, if already flushed, from the flushed history.
+ *
+ * @return true if a segment was rebuilt
+ */
+bool ServerEngine::recoverSegments(int connId)
+{
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  ReceiveBuffer &buffer = currentBlock->receiveBuffer;
+  std::string &history = currentBlock->flushedHistory;
+  bool recovered = false;
+
+  for (auto it = currentBlock->parityGroups.begin(); it != currentBlock->parityGroups.end();)
+  {
+    // offset of the group from the next expected byte, negative if it starts in flushed data
+    int start = (it->seqNum - currentBlock->connectionExpectedSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+    if (start > (MAX_SEQ_NUM + 1) / 2)
+      start -= MAX_SEQ_NUM + 1;
+    int end = start + it->segments * MAX_PAYLOAD_LENGTH;
+    if (end <= 0 || end > buffer.capacity() || -start > (int)history.size())
+    {
+      it = currentBlock->parityGroups.erase(it); // complete, or can not be rebuilt
+      continue;
+    }
+
+    int missing = -1, missingCount = 0;
+    for (int offset = start; offset < end; offset += MAX_PAYLOAD_LENGTH)
+    {
+      if (offset >= 0 && !(buffer.has(offset) && buffer.has(offset + MAX_PAYLOAD_LENGTH - 1)))
+      {
+        missing = offset;
+        missingCount++;
+      }
+    }
+    if (missingCount > 1)
+    {
+      ++it;
+      continue;
+    }
+
+    if (missingCount == 1)
+    {
+      std::string payload = it->parity;
+      for (int offset = start; offset < end; offset += MAX_PAYLOAD_LENGTH)
+      {
+        if (offset == missing)
+          continue;
+        for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+          payload[i] ^= (offset + i < 0) ? history[history.size() + offset + i] : buffer.at(offset + i);
+      }
+      int seqNum = (currentBlock->connectionExpectedSeqNum + missing) % (MAX_SEQ_NUM + 1);
+      TCPPacket segment(seqNum, 0, connId, false, false, false, MAX_PAYLOAD_LENGTH, payload);
+      addPacketToBuffer(connId, &segment);
+      recovered = true;
+    }
+    it = currentBlock->parityGroups.erase(it);
+  }
+  return recovered;
+}
+
+/**
+ * @brief Adds packet to the buffer
+ *
+ * @param p pointer to the TCPPacket
+ * @return True if packet was successfully added to the buffer, false if no space was available,the pointer was nullptr, or it was a duplicate
+ */
+int ServerEngine::addPacketToBuffer(int connId, TCPPacket *p)
+{
+  /*
+Several implementations could have been used here in the case that we
+receive a packet that has fills a gap AND also overwrites on either side.
+One approach would be that if any byte in the range of the packet in the window
+has already been written to then drop the packet, removing the chance of an overwrite.
+However, the counter argument to that was -- what's the guarantee that the first packet
+I got was not corrupted (since such a case would only arise in the case of a corruption)
+
+Thus, the current implementation is that if there is an overlap in bits, overwrite.
+
+Packets that have overlapping bytes should result in undefined behavior, which is
+exactly what this implementation would provide, since the order of arrival of the
+packets is not definite, and the result is therefore indeterminate.
+*/
+
+  using namespace std;
+  if (p == nullptr)
+    return PACKET_NULL;
+  if (p->isSYN())
+    return PACKET_ADDED;
+  ReceiveBuffer &buffer = m_connectionIdToTCB[connId]->receiveBuffer;
+
+  int packetSeqNum = p->getSeqNum();
+  int payloadLen = p->getPayloadLength();
+
+  if (p->isFIN() || m_connectionIdToTCB[connId]->connectionState == FIN_RECEIVED)
+    return PACKET_DROPPED;
+
+  /*
+  HANDLING OF WRAP AROUND:
+
+  Sequence numbers wrap every MAX_SEQ_NUM + 1 bytes, so the packet is placed by its stream offset
+  instead, the absolute position of its first byte in the connection's data. The offset into the
+  receive buffer is then relative to the next expected byte: negative for bytes flushed already,
+  beyond the capacity for bytes there is no room for yet. A wrap inside the payload needs no care,
+  the buffer is indexed by offset and never by sequence number.
+  */
+  int64_t offset = unwrapSeqNum(connId, packetSeqNum) - m_connectionIdToTCB[connId]->connectionStreamOffset;
+
+  ReceiverMetrics &metrics = m_connectionIdToTCB[connId]->metrics;
+  metrics.packetsReceived++;
+  metrics.bytesReceived += payloadLen;
+  const char *payload = p->getPayloadData();
+  if (offset < 0 && offset + payloadLen > 0)
+  {
+    // a retransmission cut at other boundaries than the lost original can start in bytes
+    // that were flushed already, the rest of it is new
+    payload -= offset;
+    payloadLen += offset;
+    offset = 0;
+  }
+  if (offset < 0 || offset + payloadLen > buffer.capacity())
+  {
+    // behind the window the bytes were flushed already, ahead of it there is no room
+    if (offset < 0)
+      metrics.duplicatePackets++;
+    else
+      metrics.droppedPackets++;
+    return PACKET_DROPPED;
+  }
+  if (payloadLen > 0 && buffer.has(offset))
+    metrics.duplicatePackets++;
+  else if (offset > 0)
+    metrics.outOfOrderBytes += payloadLen;
+
+  buffer.put(offset, payload, payloadLen); // marked as arrived, regardless of overwrite
+  return PACKET_ADDED;
+}
+
+/**
+ * @brief Hands out the consecutive bytes that have arrived in the buffer from the start as a
+ * SERVER_DATA event and updates the next expected sequence number
+ *
+ * @return number of bytes that were handed out
+ */
+int ServerEngine::flushBuffer(int connId)
+{
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  ReceiveBuffer &buffer = currentBlock->receiveBuffer;
+  int &nextExpectedSeqNum = currentBlock->connectionExpectedSeqNum;
+
+  // find the number of bytes to write
+  int bytesToWrite = buffer.contiguous();
+  if (bytesToWrite == 0)
+    return 0;
+
+  // the bytes go straight into the output of the engine, where the driver picks them up
+  size_t dataOffset = m_delivered.size();
+  m_delivered.resize(dataOffset + bytesToWrite);
+  char *outputBuffer = &m_delivered[dataOffset];
+  buffer.read(outputBuffer, bytesToWrite);
+  QueuedEvent queued;
+  queued.event.type = SERVER_DATA;
+  queued.event.connId = connId;
+  queued.event.length = bytesToWrite;
+  queued.dataOffset = dataOffset;
+  m_events.push_back(queued);
+
+  if (currentBlock->fec)
+  {
+    std::string &history = currentBlock->flushedHistory;
+    history.append(outputBuffer, bytesToWrite);
+    if ((int)history.size() > FEC_HISTORY_BYTES)
+      history.erase(0, history.size() - FEC_HISTORY_BYTES);
+  }
+  if (currentBlock->checksums)
+    currentBlock->digest = crc32c(currentBlock->digest, outputBuffer, bytesToWrite);
+
+  nextExpectedSeqNum += bytesToWrite; // update the next expected sequence number
+  nextExpectedSeqNum %= MAX_SEQ_NUM + 1;
+  currentBlock->connectionStreamOffset += bytesToWrite;
+
+  buffer.consume(bytesToWrite);
+  currentBlock->deliveredBytes += bytesToWrite;
+  tuneWindow(connId);
+
+  return bytesToWrite;
+}
+
+/**
+ * @brief Sizes the receive window of a connection, at most once per round trip. It grows to
+ * twice the bytes delivered in a round trip (dynamic right sizing), so a client held back by the
+ * window can double its rate every round trip while an idle or slow one keeps a small window. A
+ * window the driver can not write out in a round trip only queues packets until the socket
+ * drops them, so it shrinks to what the writes reported by the driver take and a slow disk slows
+ * the client down instead. Windows grow only as far as the budget of all of them allows.
+ *
+ * A disk that can not write even the smallest window in a round trip, and kept the driver busy
+ * for most of the time, closes the window: the ACKs advertise 0 and the client only probes it
+ * until a round trip passes in which the driver caught up. The buffer keeps its size meanwhile,
+ * so whatever was already in flight is still taken.
+ */
+void ServerEngine::tuneWindow(int connId)
+{
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  c_time now = m_now;
+  if (currentBlock->rtt == std::chrono::steady_clock::duration::zero() || now - currentBlock->tunedAt < currentBlock->rtt)
+    return;
+
+  if (currentBlock->writeSeconds > 0)
+  {
+    double rate = currentBlock->writeBytes / currentBlock->writeSeconds;
+    currentBlock->drainRate = (currentBlock->drainRate == 0) ? rate : 0.75 * currentBlock->drainRate + 0.25 * rate;
+  }
+  double rtt = std::chrono::duration<double>(currentBlock->rtt).count();
+  double elapsed = std::chrono::duration<double>(now - currentBlock->tunedAt).count();
+  double deliveredPerRtt = currentBlock->deliveredBytes * rtt / elapsed;
+  int capacity = currentBlock->receiveBuffer.capacity();
+  double target = std::max((double)capacity, 2 * deliveredPerRtt);
+  if (currentBlock->drainRate > 0)
+    target = std::min(target, currentBlock->drainRate * rtt);
+  if (target > capacity)
+    target = std::min(target, (double)capacity + std::max((int64_t)0, m_receiveBudget - m_receiveBytes));
+  int window = std::max(RWND_MIN_BYTES, std::min(RWND_BYTES, (int)target)) / MAX_PAYLOAD_LENGTH * MAX_PAYLOAD_LENGTH;
+  if (window != capacity && currentBlock->receiveBuffer.resize(window)) // a smaller one waits for the bytes beyond it
+    m_receiveBytes += window - capacity;
+  currentBlock->windowClosed = currentBlock->drainRate > 0 && currentBlock->drainRate * rtt < RWND_MIN_BYTES &&
+                               currentBlock->writeSeconds * 2 >= elapsed;
+
+  currentBlock->tunedAt = now;
+  currentBlock->deliveredBytes = 0;
+  currentBlock->writeSeconds = 0;
+  currentBlock->writeBytes = 0;
+}
+
+void ServerEngine::reportWrite(int connId, int64_t bytes, double seconds)
+{
+  auto it = m_connectionIdToTCB.find(connId);
+  if (it == m_connectionIdToTCB.end())
+    return;
+  it->second->writeSeconds += seconds;
+  it->second->writeBytes += bytes;
+  it->second->metrics.bytesWritten += bytes;
+}
+
+/**
+ * @brief Stream offset of a sequence number of a connection: of the offsets that wrap to it, the
+ * one nearest to the next expected byte. Windows are far smaller than half the sequence space,
+ * so a segment the client may still send is never taken for one a wrap earlier or later.
+ */
+int64_t ServerEngine::unwrapSeqNum(int connId, int seqNum)
+{
+  TCB *currentBlock = m_connectionIdToTCB[connId];
+  int distance = (seqNum - currentBlock->connectionExpectedSeqNum + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+  if (distance > (MAX_SEQ_NUM + 1) / 2)
+    distance -= MAX_SEQ_NUM + 1;
+  return currentBlock->connectionStreamOffset + distance;
+}
+
+/**
+ * @brief Adds a new connection and sets the correct connection State. A new connection waits
+ * for the driver to accept it, the SYN-ACK goes out from accept().
+ *
+ * @return connection of the packet, 0 for none yet
+ */
+int ServerEngine::addNewConnection(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen)
+{
+  if (p->isSYN() && p->getConnId() == 0) // new connection id
+  {
+    // a retransmitted SYN belongs to the connection the first one opened, which answers it again
+    std::string synKey = std::string((char *)clientInfo, clientInfoLen) + std::to_string(p->getSeqNum());
+    auto existing = m_synToConnectionId.find(synKey);
+    if (existing != m_synToConnectionId.end())
+      return existing->second;
+
+    // with too many connections half open, a SYN only opens one once it echoes a cookie, which
+    // proves the client got our SYN-ACK at its address
+    if (p->isACK() && checkSynCookie(p, clientInfo, clientInfoLen))
+      m_synCookiesAccepted++;
+    else if (m_halfOpen >= m_synCookieLimit)
+    {
+      sendSynCookie(p, clientInfo, clientInfoLen);
+      return 0; // no connection yet, packet is dropped
+    }
+
+    // Get the connection ID
+    int packetConnId = m_nextAvailableConnectionId;
+
+    ConnectionOptions options;
+    if (!options.decode(p->getPayload()))
+    {
+      error(packetConnId, "Malformed connection options from new connection");
+      options = ConnectionOptions();
+    }
+    if (options.fecGroup != 0)
+      options.fecGroup = std::max(FEC_MIN_GROUP, std::min(FEC_MAX_GROUP, options.fecGroup));
+    // nothing authenticates the SYN, so its data is only taken on a connection that will never be
+    // encrypted; on any other it is dropped and left out of the SYN-ACK, and the client sends it again
+    if (options.aead != AEAD_NONE || !m_sharedKey.empty())
+      options.earlyData.clear();
+    // with a shared key a connection is encrypted or refused
+    if (!m_sharedKey.empty() && options.aead == AEAD_NONE)
+    {
+      error(packetConnId, "Connection without encryption refused");
+      return 0;
+    }
+    PacketCipher *cipher = nullptr;
+    if (options.aead != AEAD_NONE)
+    {
+      std::string clientRandom = options.aeadRandom;
+      if (!aeadRandom(options.aeadRandom))
+      {
+        error(packetConnId, "No random bytes for the encryption keys, connection refused");
+        return 0;
+      }
+      cipher = new PacketCipher();
+      if (m_sharedKey.empty() || !cipher->setup((AeadCipher)options.aead, m_sharedKey, clientRandom, options.aeadRandom, false))
+      {
+        delete cipher; // not echoed, the client gives up
+        cipher = nullptr;
+        options.aead = AEAD_NONE;
+        if (!m_sharedKey.empty())
+        {
+          error(packetConnId, "Connection with an unknown cipher refused");
+          return 0;
+        }
+      }
+      else
+        options.checksums = false; // the tag covers what the CRC32C would
+    }
+
+    // set up TCB and start timer, the driver decides about the rest
+    TCB *currentBlock = new TCB((p->getSeqNum() + 1) % (MAX_SEQ_NUM + 1), ConnectionState::AWAITING_ACK, clientInfo, clientInfoLen, m_now); // +1 in constructer as SYN == 1byte
+    currentBlock->earlyData = options.earlyData; // ACKed in the SYN-ACK, not echoed
+    options.earlyData.clear();
+    currentBlock->requestedOptions = options;
+    currentBlock->cipher = cipher;
+    currentBlock->synKey = synKey;
+    m_connectionIdToTCB[packetConnId] = currentBlock;
+    m_synToConnectionId[synKey] = packetConnId;
+    m_halfOpen++;
+    m_receiveBytes += currentBlock->receiveBuffer.capacity();
+    ++m_nextAvailableConnectionId; // update the next available connection Id
+
+    logPacket(p, true, false, false);
+    QueuedEvent queued;
+    queued.event.type = SERVER_CONNECTION_REQUESTED;
+    queued.event.connId = packetConnId;
+    queued.event.options = &currentBlock->requestedOptions;
+    queued.event.peer = (sockaddr *)&currentBlock->clientInfo;
+    queued.event.peerLen = currentBlock->clientInfoLen;
+    queued.dataOffset = 0;
+    m_events.push_back(queued);
+    return 0; // answered once accepted
+  }
+
+  // Update Connection state in case of an ACK
+  else if (p->isACK() && m_connectionIdToTCB.count(p->getConnId()) && m_connectionIdToTCB[p->getConnId()]->connectionState == AWAITING_ACK) // new connection id
+  {
+    TCB *currentBlock = m_connectionIdToTCB[p->getConnId()];
+    setState(currentBlock, ConnectionState::CONNECTION_SET);
+    currentBlock->tunedAt = m_now;
+    currentBlock->rtt = currentBlock->tunedAt - currentBlock->openedAt; // the SYN-ACK went out as the connection opened
+    return p->getConnId();
+  }
+  return p->getConnId();
+}
+
+/**
+ * @brief Opens a requested connection: data in the SYN is buffered like a first segment and
+ * handed out before the SYN-ACK goes out. A resumed transfer continues at an offset the client
+ * does not know yet, so it has none.
+ */
+void ServerEngine::accept(int connId, ConnectionOptions options)
+{
+  auto it = m_connectionIdToTCB.find(connId);
+  if (it == m_connectionIdToTCB.end() || it->second->accepted)
+    return;
+  TCB *currentBlock = it->second;
+  currentBlock->accepted = true;
+  options.earlyData.clear();
+  currentBlock->synAckOptions = options.encode(); // every option that was decoded is supported
+  currentBlock->checksums = options.checksums;
+  currentBlock->fec = options.fecGroup != 0;
+  currentBlock->requestedOptions = ConnectionOptions();
+  ++m_connectionsOpened;
+
+  if (!currentBlock->earlyData.empty() && !options.resume)
+  {
+    TCPPacket segment(currentBlock->connectionExpectedSeqNum, 0, connId, false, false, false, currentBlock->earlyData.size(), currentBlock->earlyData);
+    addPacketToBuffer(connId, &segment);
+    flushBuffer(connId);
+  }
+  currentBlock->earlyData.clear();
+  currentBlock->previousExpectedSeqNum = currentBlock->connectionExpectedSeqNum;
+  sendAck(connId, true, false);
+}
+
+void ServerEngine::refuse(int connId)
+{
+  auto it = m_connectionIdToTCB.find(connId);
+  if (it != m_connectionIdToTCB.end() && !it->second->accepted)
+    closeConnection(connId);
+}
+
+/**
+ * @brief Moves a connection to another state, counting the connections that are half open so a
+ * SYN flood does not walk every connection to decide about cookies
+ */
+void ServerEngine::setState(TCB *currentBlock, ConnectionState state)
+{
+  if (currentBlock->connectionState == AWAITING_ACK)
+    m_halfOpen--;
+  if (state == AWAITING_ACK)
+    m_halfOpen++;
+  currentBlock->connectionState = state;
+}
+
+static uint64_t mix64(uint64_t x) // splitmix64 finalizer
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief Keyed hash of the client address, its initial sequence number and a time slot, folded
+ * into the sequence number space
+ */
+int ServerEngine::synCookie(const struct sockaddr *clientInfo, socklen_t clientInfoLen, int initialSeqNum, int64_t slot)
+{
+  uint64_t hash = mix64(m_synCookieSecret ^ (uint64_t)slot);
+  for (socklen_t i = 0; i < clientInfoLen; i += sizeof(uint64_t))
+  {
+    uint64_t word = 0;
+    memcpy(&word, (const char *)clientInfo + i, std::min((socklen_t)sizeof(uint64_t), clientInfoLen - i));
+    hash = mix64(hash ^ word);
+  }
+  hash = mix64(hash ^ (uint64_t)initialSeqNum);
+  return hash % (MAX_SEQ_NUM + 1);
+}
+
+int64_t ServerEngine::synCookieSlot()
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(m_now.time_since_epoch()).count() / SYN_COOKIE_SLOT;
+}
+
+/**
+ * @brief Whether the SYN acknowledges a cookie of this or the previous time slot
+ */
+bool ServerEngine::checkSynCookie(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen)
+{
+  int cookie = (p->getAckNum() + MAX_SEQ_NUM) % (MAX_SEQ_NUM + 1); // the ACK is cookie + 1
+  int64_t slot = synCookieSlot();
+  return cookie == synCookie(clientInfo, clientInfoLen, p->getSeqNum(), slot) ||
+         cookie == synCookie(clientInfo, clientInfoLen, p->getSeqNum(), slot - 1);
+}
+
+/**
+ * @brief Answers a SYN without keeping any state: the SYN-ACK has connection ID 0 and the cookie
+ * as its sequence number. The client sends its SYN again, options and early data included,
+ * with the cookie + 1 as the ACK number.
+ */
+void ServerEngine::sendSynCookie(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen)
+{
+  TCPPacket synAck(synCookie(clientInfo, clientInfoLen, p->getSeqNum(), synCookieSlot()), (p->getSeqNum() + 1) % (MAX_SEQ_NUM + 1), 0,
+                   true, true, false, 0, "");
+  logPacket(p, true, false, false);
+  sendPacket(clientInfo, clientInfoLen, &synAck);
+  logPacket(&synAck, false, false, false);
+  m_synCookiesSent++;
+}
+
+/**
+ * @brief close connection and remove entry from unordered map
+ */
+void ServerEngine::closeConnection(int connId)
+{
+  auto it = m_connectionIdToTCB.find(connId);
+  if (it == m_connectionIdToTCB.end())
+    return;
+  TCB *currentBlock = it->second;
+  m_synToConnectionId.erase(currentBlock->synKey);
+  m_closedMetrics.add(currentBlock->metrics);
+  m_receiveBytes -= currentBlock->receiveBuffer.capacity();
+  if (currentBlock->connectionState == AWAITING_ACK)
+    m_halfOpen--;
+
+  // delete TCB Block
+  delete currentBlock;
+  m_connectionIdToTCB.erase(it);
+}
+
+/**
+ * @brief Closes a connection and tells the driver, which had everything it sent once the FIN
+ * arrived
+ */
+void ServerEngine::endConnection(int connId)
+{
+  QueuedEvent queued;
+  queued.event.type = SERVER_CONNECTION_CLOSED;
+  queued.event.connId = connId;
+  queued.event.complete = m_connectionIdToTCB[connId]->connectionState == FIN_RECEIVED;
+  queued.dataOffset = 0;
+  m_events.push_back(queued);
+  closeConnection(connId);
+}
+
+/**
+ * @brief set timer by saving current timestamp
+ */
+void ServerEngine::setTimer(int connId)
+{
+  m_connectionIdToTCB[connId]->connectionTimer = m_now;
+}
+
+/**
+ * @brief check timer by comparing present timestamp with timerLimit
+ */
+bool ServerEngine::checkTimer(int connId, float timerLimit)
+{
+  std::chrono::duration<double> elapsed_time = m_now - m_connectionIdToTCB[connId]->connectionTimer;
+  return (elapsed_time.count() < timerLimit);
+}
+
+/**
+ * @brief handleFin
+ * @return boolean if fin was handled or not
+ */
+bool ServerEngine::handleFin(TCPPacket *p, int connId)
+{
+  TCB *finBlock = m_connectionIdToTCB[connId];
+  if (p->isFIN() && finBlock->connectionState == FIN_RECEIVED &&
+      (p->getSeqNum() + 1) % (MAX_SEQ_NUM + 1) == finBlock->connectionExpectedSeqNum)
+  {
+    // the FIN-ACK was lost, every retransmitted FIN resets the timer that would resend it
+    logPacket(p, true, false, false);
+    sendPacket((sockaddr *)&finBlock->clientInfo, finBlock->clientInfoLen, finBlock->finPacket);
+    logPacket(finBlock->finPacket, false, false, true);
+    return true;
+  }
+  if (unwrapSeqNum(connId, p->getSeqNum()) < finBlock->connectionStreamOffset)
+    return false;
+  // if fin packet update state and send fin from server
+  else if (p->isFIN())
+  {
+
+    // output the packet
+    bool duplicate = false;
+    if (finBlock->connectionState == ConnectionState::FIN_RECEIVED)
+    {
+      // the FIN-ACK was already sent, but I got it again
+      duplicate = true;
+    }
+
+    logPacket(p, true, false, false);
+
+    // the FIN of a connection with checksums carries the client's digest, the FIN-ACK answers with ours
+    std::string finPayload;
+    TCB *currentBlock = finBlock;
+    if (currentBlock->checksums)
+    {
+      uint32_t digest = htonl(currentBlock->digest);
+      finPayload = std::string((char *)&digest, sizeof(digest));
+      if (!duplicate && p->getPayload() != finPayload)
+        error(connId, "ERROR: Digest mismatch on connection " + std::to_string(connId) + ", the output file is corrupt");
+    }
+
+    // change state to FIN_RECEIVED -> wait for ACK for FIN-ACK
+    setState(currentBlock, ConnectionState::FIN_RECEIVED);
+    currentBlock->connectionStreamOffset = unwrapSeqNum(connId, p->getSeqNum()) + 1; // the FIN takes a sequence number
+    currentBlock->connectionExpectedSeqNum = (p->getSeqNum() + 1) % (MAX_SEQ_NUM + 1);
+
+    TCPPacket *finPacket = new TCPPacket(
+        currentBlock->connectionServerSeqNum,   // sequence number
+        currentBlock->connectionExpectedSeqNum, // ack number
+        connId,                                 // connection id
+        true,                                   // is ACK
+        false,                                  // is not SYN
+        true,                                   // is FIN
+        finPayload.size(),                      // digest only
+        finPayload);
+    sendPacket((sockaddr *)&currentBlock->clientInfo, currentBlock->clientInfoLen, finPacket);
+    // save the FIN packet
+    delete currentBlock->finPacket;
+    currentBlock->finPacket = finPacket;
+    logPacket(finPacket, false, false, duplicate);
+    setTimer(connId); // set timer
+    return true;
+  }
+
+  /*
+  If Ack recieved and the connection state is awaiting for ack then 4 way handwave
+  complete and so close connection
+  */
+  else if (p->isACK() && finBlock->connectionState == FIN_RECEIVED)
+  {
+    // write out the packet
+    logPacket(p, true, false, false);
+    // assuming that the received expected sequence number is the same as the one received
+    endConnection(connId);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Queues a packet for the driver, sealed if it belongs to an encrypted connection and is
+ * not a SYN-ACK
+ */
+void ServerEngine::sendPacket(const struct sockaddr *clientInfo, socklen_t clientInfoLen, TCPPacket *p)
+{
+  if (p == nullptr)
+    return;
+  int packetLength;
+  char *packetCString = p->getCString(packetLength);
+  QueuedDatagram datagram;
+  datagram.offset = m_outgoing.size();
+  memcpy(&datagram.to, clientInfo, clientInfoLen);
+  datagram.toLen = clientInfoLen;
+
+  auto connection = m_connectionIdToTCB.find(p->getConnId());
+  if (!p->isSYN() && connection != m_connectionIdToTCB.end() && connection->second->cipher != nullptr)
+  {
+    m_outgoing.resize(datagram.offset + packetLength + AEAD_TRAILER_LEN);
+    char *sealed = &m_outgoing[datagram.offset];
+    memcpy(sealed, packetCString, HEADER_LEN);
+    packetLength = HEADER_LEN + connection->second->cipher->seal(packetCString, packetCString + HEADER_LEN, packetLength - HEADER_LEN, sealed + HEADER_LEN);
+  }
+  else
+    m_outgoing.insert(m_outgoing.end(), packetCString, packetCString + packetLength);
+  datagram.length = packetLength;
+  m_datagrams.push_back(datagram);
+}
+
+void ServerEngine::logPacket(TCPPacket *p, bool recvd, bool dropped, bool dup)
+{
+  if (m_packetLog)
+    m_log.push_back(tracePacketRecord(traceEvent(recvd, dropped, dup), p));
+}
+
+void ServerEngine::error(int connId, std::string message)
+{
+  QueuedEvent queued;
+  queued.event.type = SERVER_ERROR;
+  queued.event.connId = connId;
+  queued.event.message = message;
+  queued.dataOffset = 0;
+  m_events.push_back(queued);
+}
+
+bool ServerEngine::pollDatagram(Datagram &datagram)
+{
+  if (m_datagramsPolled < m_datagrams.size())
+  {
+    QueuedDatagram &queued = m_datagrams[m_datagramsPolled++];
+    datagram.data = &m_outgoing[queued.offset];
+    datagram.length = queued.length;
+    datagram.to = (sockaddr *)&queued.to;
+    datagram.toLen = queued.toLen;
+    return true;
+  }
+  m_outgoing.clear();
+  m_datagrams.clear();
+  m_datagramsPolled = 0;
+  return false;
+}
+
+bool ServerEngine::pollEvent(ServerEvent &event)
+{
+  if (m_eventsPolled < m_events.size())
+  {
+    QueuedEvent &queued = m_events[m_eventsPolled++];
+    event = queued.event;
+    if (event.type == SERVER_DATA)
+      event.data = &m_delivered[queued.dataOffset];
+    return true;
+  }
+  m_delivered.clear();
+  m_events.clear();
+  m_eventsPolled = 0;
+  return false;
+}
+
+bool ServerEngine::pollLog(TraceRecord &record)
+{
+  if (m_logPolled < m_log.size())
+  {
+    record = m_log[m_logPolled++];
+    return true;
+  }
+  m_log.clear();
+  m_logPolled = 0;
+  return false;
+}
+
+void ServerEngine::setPacketLog(bool on)
+{
+  m_packetLog = on;
+}
+
+void ServerEngine::setLatencyStages(LatencyStages *stages)
+{
+  m_stages = stages;
+}
+
+uint64_t ServerEngine::stageStart()
+{
+  return m_stages == nullptr ? 0 : m_stages->start();
+}
+
+void ServerEngine::stageStop(ServerStage stage, uint64_t start)
+{
+  if (m_stages != nullptr)
+    m_stages->stop(stage, start);
+}
+
+const std::unordered_map<int, TCB *> &ServerEngine::connections()
+{
+  return m_connectionIdToTCB;
+}
+
+int64_t ServerEngine::getConnectionsOpened()
+{
+  return m_connectionsOpened;
+}
+
+int64_t ServerEngine::getCorruptPackets()
+{
+  return m_corruptPackets;
+}
+
+int64_t ServerEngine::getSynCookiesSent()
+{
+  return m_synCookiesSent;
+}
+
+int64_t ServerEngine::getSynCookiesAccepted()
+{
+  return m_synCookiesAccepted;
+}
+
+int64_t ServerEngine::getReceiveBytes()
+{
+  return m_receiveBytes;
+}
+
+int64_t ServerEngine::getReceiveBudget()
+{
+  return m_receiveBudget;
+}
+
+ReceiverMetrics ServerEngine::getClosedMetrics()
+{
+  return m_closedMetrics;
+}
@@ -0,0 +1,250 @@
+#ifndef SERVERENGINE_HPP
+#define SERVERENGINE_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "constants.hpp"
+#include "tcp.hpp"
+#include "options.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "latency.hpp"
+#include "aead.hpp"
+#include "receivebuffer.hpp"
+
+/*
+  The receiving end of the protocol without any I/O: handshake and SYN cookies, reassembly,
+  forward error correction, ACKs with the receive window, encryption and the handwave of every
+  connection. It never touches a socket, a file or a clock. The driver feeds every datagram and
+  the current time in with receive() and handleTimers(), and after every call into the engine
+  takes out
+
+    - the datagrams to send, with pollDatagram()
+    - what happened to the connections, with pollEvent(): new connections to accept() or
+      refuse(), the in order bytes of a connection to write and closed connections
+    - the packet log, with pollLog(), if setPacketLog() turned it on
+
+  Whatever pollDatagram() and pollEvent() hand out stays valid until the next call that feeds
+  the engine. nextDeadline() says when handleTimers() has to run next. The Server is the driver
+  of the server binary.
+*/
+
+typedef std::chrono::steady_clock::time_point c_time;
+
+struct ParityGroup // XOR of `segments` full data segments starting at seqNum
+{
+	int seqNum;
+	int segments;
+	std::string parity;
+};
+
+struct TCB
+{
+	TCB(int expectedSeqNum, ConnectionState state, const struct sockaddr *cInfo, socklen_t cInfoLen, c_time now)
+			: receiveBuffer(RWND_INIT_BYTES)
+	{
+		connectionServerSeqNum = INIT_SERVER_SEQ_NUM;
+		connectionExpectedSeqNum = expectedSeqNum;
+		connectionStreamOffset = 0;
+		previousExpectedSeqNum = -1;
+		connectionState = state;
+		accepted = false;
+		checksums = false;
+		digest = 0;
+		cipher = nullptr;
+		fec = false;
+		memcpy(&clientInfo, cInfo, cInfoLen);
+		clientInfoLen = cInfoLen;
+		finPacket = nullptr;
+		connectionTimer = now;
+		openedAt = now;
+		rtt = std::chrono::steady_clock::duration::zero();
+		deliveredBytes = 0;
+		tunedAt = openedAt;
+		writeSeconds = 0;
+		writeBytes = 0;
+		drainRate = 0;
+		windowClosed = false;
+	}
+
+	~TCB()
+	{
+		delete finPacket;
+		finPacket = nullptr;
+		delete cipher;
+		cipher = nullptr;
+	}
+
+	ReceiveBuffer receiveBuffer;								 // Bytes from the next expected one on, handed out once in order
+	int connectionExpectedSeqNum;								 // Next expected Seq Number from client
+	int64_t connectionStreamOffset;							 // Bytes of the connection handed out in order, the offset of connectionExpectedSeqNum
+	int previousExpectedSeqNum;
+	int connectionServerSeqNum;									 // Seq number to be sent in server ack packet
+	std::string synKey;													 // Key into ServerEngine::m_synToConnectionId
+	ConnectionOptions requestedOptions;					 // of the SYN, until the driver accepts the connection
+	std::string earlyData;											 // carried by the SYN, until the driver accepts the connection
+	bool accepted;															 // by the driver, nothing is answered before
+	std::string synAckOptions;									 // Accepted connection options, echoed in the SYN-ACK payload
+	bool checksums;															 // client packets carry a CRC32C trailer
+	uint32_t digest;														 // CRC32C of every byte handed out so far, compared in the FIN exchange
+	PacketCipher *cipher;												 // seals and opens the packets after the SYN-ACK, nullptr unless encrypted
+	bool fec;																		 // the client sends parity packets
+	std::deque<ParityGroup> parityGroups;				 // parity of groups that may still lose a segment
+	std::string flushedHistory;									 // last FEC_HISTORY_BYTES handed out, to rebuild segments of partly flushed groups
+	c_time connectionTimer;											 // connection timer at server side (Connection closes if this runs out)
+	c_time openedAt;														 // start of the connection, for its goodput
+	ReceiverMetrics metrics;
+	// receive window tuning, see ServerEngine::tuneWindow()
+	std::chrono::steady_clock::duration rtt; // SYN-ACK to the first ACK, zero until then
+	c_time tunedAt;
+	int64_t deliveredBytes;											 // handed out since tunedAt
+	double writeSeconds;												 // the driver spent writing since tunedAt
+	int64_t writeBytes;
+	double drainRate;														 // bytes per second the driver writes, 0 until measured
+	bool windowClosed;													 // the ACKs advertise a zero window
+	ConnectionState connectionState;						 // connection state
+	TCPPacket *finPacket;
+	struct sockaddr_storage clientInfo;
+	socklen_t clientInfoLen;
+};
+
+enum ServerEventType
+{
+	SERVER_CONNECTION_REQUESTED, // a SYN asks for a connection, answer with accept() or refuse() before feeding the engine again
+	SERVER_DATA,								 // the next in order bytes of a connection
+	SERVER_CONNECTION_CLOSED,		 // the connection is gone, the engine forgot it
+	SERVER_ERROR								 // something to tell the operator, the connection goes on
+};
+
+struct ServerEvent
+{
+	ServerEventType type;
+	int connId;
+	const ConnectionOptions *options; // REQUESTED: of the SYN, with the options of the engine settled
+	const struct sockaddr *peer;			// REQUESTED: address of the client
+	socklen_t peerLen;
+	const char *data;									// DATA
+	int length;
+	bool complete;										// CLOSED: the client sent everything, else the connection timed out
+	std::string message;							// ERROR
+};
+
+struct Datagram
+{
+	const char *data;
+	int length;
+	const struct sockaddr *to;
+	socklen_t toLen;
+};
+
+class ServerEngine
+{
+public:
+	// only encrypted connections keyed from sharedKey if that is not empty, see aead.hpp, SYN
+	// cookies once synCookieLimit connections are half open (0 for always), receive windows of
+	// at most receiveBudget bytes together
+	ServerEngine(std::string sharedKey = "", int synCookieLimit = SYN_COOKIE_HALF_OPEN, int64_t receiveBudget = RECEIVE_BUDGET_BYTES);
+	~ServerEngine();
+	void receive(char *datagram, int length, const struct sockaddr *from, socklen_t fromLen, c_time now); // decrypts in place
+	void handleTimers(c_time now); // closes connections that timed out and resends lost FIN-ACKs
+	c_time nextDeadline();				 // earliest time handleTimers() has work to do
+	bool pollDatagram(Datagram &datagram); // next datagram to send, false once all were handed out
+	bool pollEvent(ServerEvent &event);		 // next event, false once all were handed out
+	bool pollLog(TraceRecord &record);		 // next packet sent or received, false once the log is empty; timestamp left 0
+
+	// answers a SERVER_CONNECTION_REQUESTED with the options the driver took, they are echoed in
+	// the SYN-ACK. A resumed transfer carries the bytes the driver has in resumeOffset and gets
+	// no early data
+	void accept(int connId, ConnectionOptions options);
+	void refuse(int connId);											 // the SYN goes unanswered
+	void closeConnection(int connId);							 // forgets the connection at once, without a handwave or an event
+	void reportWrite(int connId, int64_t bytes, double seconds); // bytes of SERVER_DATA the driver wrote and the time it took, see tuneWindow()
+	void setPacketLog(bool on);										 // keep a log of every packet for pollLog(), off by default
+	void setLatencyStages(LatencyStages *stages);	 // times the receive path into the driver's histograms
+
+	const std::unordered_map<int, TCB *> &connections();
+	int64_t getConnectionsOpened();
+	int64_t getCorruptPackets();
+	int64_t getSynCookiesSent();
+	int64_t getSynCookiesAccepted();
+	int64_t getReceiveBytes(); // capacity of every receive window
+	int64_t getReceiveBudget();
+	ReceiverMetrics getClosedMetrics(); // sum over the connections that are gone
+
+	int addNewConnection(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen);
+	int addPacketToBuffer(int connId, TCPPacket *p);
+	int flushBuffer(int connId);
+
+private:
+	struct QueuedDatagram
+	{
+		size_t offset; // into m_outgoing
+		int length;
+		struct sockaddr_storage to;
+		socklen_t toLen;
+	};
+	struct QueuedEvent
+	{
+		ServerEvent event;
+		size_t dataOffset; // into m_delivered
+	};
+
+	void setTimer(int connId);
+	bool checkTimer(int connId, float timerLimit); // false if timer runs out, true if still valid
+	bool handleFin(TCPPacket *p, int connId);
+	void endConnection(int connId); // closes with a SERVER_CONNECTION_CLOSED event
+	void tuneWindow(int connId);
+	int64_t unwrapSeqNum(int connId, int seqNum);
+	bool verifyChecksum(const char *packet, int &length);
+	bool openPacket(char *packet, int &length);
+	void sendAck(int connId, bool synFlag, bool isDup);
+	void sendPacket(const struct sockaddr *clientInfo, socklen_t clientInfoLen, TCPPacket *p);
+	void logPacket(TCPPacket *p, bool recvd, bool dropped, bool dup);
+	void error(int connId, std::string message);
+	void addParity(int connId, TCPPacket *p);
+	bool recoverSegments(int connId);
+	void setState(TCB *currentBlock, ConnectionState state);
+	int synCookie(const struct sockaddr *clientInfo, socklen_t clientInfoLen, int initialSeqNum, int64_t slot);
+	int64_t synCookieSlot();
+	bool checkSynCookie(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen);
+	void sendSynCookie(TCPPacket *p, const struct sockaddr *clientInfo, socklen_t clientInfoLen);
+	uint64_t stageStart(); // cycle counter if the stages are timed
+	void stageStop(ServerStage stage, uint64_t start);
+
+	c_time m_now; // of the last call that fed the engine
+	int m_nextAvailableConnectionId = 1;
+	ReceiverMetrics m_closedMetrics;
+	int64_t m_connectionsOpened = 0;
+	int64_t m_corruptPackets = 0;
+	int m_synCookieLimit;
+	int m_halfOpen = 0; // connections in AWAITING_ACK
+	std::string m_sharedKey; // of encrypted connections, empty if they are not required
+	int64_t m_receiveBudget;
+	int64_t m_receiveBytes = 0;
+	uint64_t m_synCookieSecret; // keys the cookie hash, random per engine
+	int64_t m_synCookiesSent = 0;
+	int64_t m_synCookiesAccepted = 0;
+	LatencyStages *m_stages = nullptr; // nullptr if the stages are not timed
+
+	// outputs, cleared once the driver took all of them; the buffers keep their capacity
+	std::vector<char> m_outgoing; // datagrams back to back
+	std::vector<QueuedDatagram> m_datagrams;
+	size_t m_datagramsPolled = 0;
+	std::vector<char> m_delivered; // bytes of the SERVER_DATA events back to back
+	std::vector<QueuedEvent> m_events;
+	size_t m_eventsPolled = 0;
+	bool m_packetLog = false;
+	std::vector<TraceRecord> m_log;
+	size_t m_logPolled = 0;
+
+	std::unordered_map<int, TCB *> m_connectionIdToTCB;
+	std::unordered_map<std::string, int> m_synToConnectionId; // connection opened by each SYN, by client address + initial sequence number
+};
+
+#endif // SERVERENGINE_HPP
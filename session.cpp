@@ -0,0 +1,114 @@
+#include "session.hpp"
+
+static void putInteger(std::string &out, uint64_t value, int bytes)
+{
+  for (int i = bytes - 1; i >= 0; i--)
+    out += (char)((value >> (8 * i)) & 0xff);
+}
+
+static uint64_t getInteger(const std::string &in, int offset, int bytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value = (value << 8) | (uint8_t)in[offset + i];
+  return value;
+}
+
+std::string encodeSessionRecord(const SessionFile &file)
+{
+  std::string out;
+  out += SESSION_RECORD_MAGIC;
+  putInteger(out, file.name.size(), 2);
+  out += file.name;
+  putInteger(out, file.length, 8);
+  putInteger(out, file.mode, 4);
+  putInteger(out, file.mtimeSeconds, 8);
+  putInteger(out, file.mtimeNanoseconds, 4);
+  return out;
+}
+
+bool isSessionName(const std::string &name)
+{
+  if (name.empty() || name.size() > (size_t)SESSION_MAX_NAME_LEN || name[0] == '/')
+    return false;
+  size_t start = 0;
+  while (start <= name.size())
+  {
+    size_t end = name.find('/', start);
+    if (end == std::string::npos)
+      end = name.size();
+    std::string component = name.substr(start, end - start);
+    if (component.empty() || component == "." || component == ".." || component.find('\0') != std::string::npos)
+      return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+SessionDecoder::SessionDecoder()
+{
+  m_remaining = 0;
+  m_corrupt = false;
+}
+
+bool SessionDecoder::inFile()
+{
+  return m_remaining > 0;
+}
+
+std::string SessionDecoder::fileName()
+{
+  return m_file.name;
+}
+
+/**
+ * @brief Splits the data into records and file bytes. A record split across calls is kept until
+ * it is complete, file bytes are handed out as they come.
+ */
+bool SessionDecoder::decode(const char *data, int len, std::vector<SessionEvent> &events)
+{
+  int pos = 0;
+  while (pos < len && !m_corrupt)
+  {
+    if (m_remaining > 0)
+    {
+      int length = (m_remaining < len - pos) ? m_remaining : len - pos;
+      events.push_back({SESSION_FILE_DATA, SessionFile(), data + pos, length});
+      pos += length;
+      m_remaining -= length;
+      if (m_remaining == 0)
+        events.push_back({SESSION_FILE_END, m_file, nullptr, 0});
+      continue;
+    }
+
+    // gather the fixed part up to the name length, then the rest of the record
+    int wanted = 3;
+    if (m_record.size() >= 3)
+      wanted = SESSION_RECORD_FIXED_LEN + getInteger(m_record, 1, 2);
+    int length = (wanted - (int)m_record.size() < len - pos) ? wanted - m_record.size() : len - pos;
+    m_record.append(data + pos, length);
+    pos += length;
+    if (m_record[0] != SESSION_RECORD_MAGIC)
+      m_corrupt = true;
+    if ((int)m_record.size() < SESSION_RECORD_FIXED_LEN || (int)m_record.size() < wanted)
+      continue;
+
+    int nameLen = getInteger(m_record, 1, 2);
+    m_file.name = m_record.substr(3, nameLen);
+    m_file.length = getInteger(m_record, 3 + nameLen, 8);
+    m_file.mode = getInteger(m_record, 11 + nameLen, 4);
+    m_file.mtimeSeconds = getInteger(m_record, 15 + nameLen, 8);
+    m_file.mtimeNanoseconds = getInteger(m_record, 23 + nameLen, 4);
+    m_record.clear();
+    if (!isSessionName(m_file.name) || m_file.length < 0)
+    {
+      m_corrupt = true;
+      break;
+    }
+    m_remaining = m_file.length;
+    events.push_back({SESSION_FILE_START, m_file, nullptr, 0});
+    if (m_remaining == 0)
+      events.push_back({SESSION_FILE_END, m_file, nullptr, 0});
+  }
+  return !m_corrupt;
+}
@@ -0,0 +1,67 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+  A session connection carries any number of files, one after the other, each behind a record
+  that describes it:
+
+      | 'F' (1 byte) | name length (2 bytes) | name | file length (8 bytes) | mode (4 bytes) |
+      | modification time seconds (8 bytes) | modification time nanoseconds (4 bytes) | file bytes |
+
+  Integers are big endian. Names are relative paths without "." or ".." components; the server
+  writes every file below a folder of the connection. The data ends after the last file, so a
+  connection that closes in the middle of a file leaves that file incomplete.
+*/
+const char SESSION_RECORD_MAGIC = 'F';
+const int SESSION_RECORD_FIXED_LEN = 27; // record without the name
+const int SESSION_MAX_NAME_LEN = 4096;
+
+struct SessionFile
+{
+  std::string name;
+  int64_t length;
+  uint32_t mode;                // permission bits
+  int64_t mtimeSeconds;
+  uint32_t mtimeNanoseconds;
+};
+
+enum SessionEventType
+{
+  SESSION_FILE_START, // file holds the record
+  SESSION_FILE_DATA,  // data and length hold the next bytes of the file
+  SESSION_FILE_END    // every byte of the file arrived
+};
+
+struct SessionEvent
+{
+  SessionEventType type;
+  SessionFile file;
+  const char *data; // points into the bytes passed to decode()
+  int length;
+};
+
+std::string encodeSessionRecord(const SessionFile &file);
+bool isSessionName(const std::string &name); // relative, no "." or ".." components
+
+class SessionDecoder
+{
+public:
+  SessionDecoder();
+  // appends the events of `data` to `events`, false if a record is malformed. The rest of the
+  // data is ignored after that.
+  bool decode(const char *data, int len, std::vector<SessionEvent> &events);
+  bool inFile();              // a file started and not all of its bytes arrived
+  std::string fileName();     // of the current or the last file
+
+private:
+  std::string m_record;  // start of a record that is not complete yet
+  SessionFile m_file;
+  int64_t m_remaining;   // bytes of the current file still to come, 0 between files
+  bool m_corrupt;
+};
+
+#endif // SESSION_HPP
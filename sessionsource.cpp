@@ -0,0 +1,105 @@
+#include <iostream>
+#include <errno.h>
+#include "sessionsource.hpp"
+
+SessionSource::SessionSource(const std::vector<SessionEntry> &entries, int streamBufferBytes, int prefetchChunks)
+{
+  off_t offset = 0;
+  for (auto &entry : entries)
+  {
+    Part part;
+    part.path = entry.path;
+    part.record = encodeSessionRecord(entry.file);
+    part.start = offset;
+    part.dataStart = offset + part.record.size();
+    part.end = part.dataStart + entry.file.length;
+    part.source = nullptr;
+    m_parts.push_back(part);
+    offset = part.end;
+  }
+  m_first = 0;
+  m_starved = nullptr;
+  m_streamBufferBytes = streamBufferBytes;
+  m_prefetchChunks = prefetchChunks;
+}
+
+SessionSource::~SessionSource()
+{
+  for (auto &part : m_parts)
+    delete part.source;
+}
+
+void SessionSource::close()
+{
+  for (auto &part : m_parts)
+  {
+    if (part.source != nullptr)
+      part.source->close();
+    delete part.source;
+    part.source = nullptr;
+  }
+  m_starved = nullptr;
+}
+
+int SessionSource::pollFd()
+{
+  return (m_starved != nullptr) ? m_starved->pollFd() : -1;
+}
+
+/**
+ * @brief Exposes bytes of one record or one file, never across the end of a part. A file that
+ * is shorter than when it was queued is a read error, the server expects the length in its record.
+ */
+int SessionSource::view(off_t offset, int maxLen, const char **data)
+{
+  size_t i = m_first;
+  while (i < m_parts.size() && m_parts[i].end <= offset)
+    i++;
+  if (i == m_parts.size())
+    return 0;
+
+  Part &part = m_parts[i];
+  if (offset < part.dataStart)
+  {
+    *data = part.record.data() + (offset - part.start);
+    return (part.dataStart - offset < maxLen) ? part.dataStart - offset : maxLen;
+  }
+
+  if (part.source == nullptr)
+  {
+    part.source = openDataSource(part.path, m_streamBufferBytes, m_prefetchChunks);
+    if (part.source == nullptr)
+    {
+      std::cerr << "ERROR: Unable to open file " << part.path << std::endl;
+      return -1;
+    }
+  }
+  if (part.end - offset < maxLen)
+    maxLen = part.end - offset;
+  int length = part.source->view(offset - part.dataStart, maxLen, data);
+  m_starved = (length == SOURCE_WOULD_BLOCK) ? part.source : nullptr;
+  if (length == 0)
+  {
+    std::cerr << "ERROR: " << part.path << " shrank while it was sent" << std::endl;
+    errno = EIO;
+    return -1;
+  }
+  return length;
+}
+
+void SessionSource::release(off_t offset)
+{
+  while (m_first < m_parts.size() && m_parts[m_first].end <= offset)
+  {
+    Part &part = m_parts[m_first];
+    if (part.source != nullptr)
+      part.source->close();
+    if (part.source == m_starved)
+      m_starved = nullptr;
+    delete part.source;
+    part.source = nullptr;
+    m_first++;
+  }
+  if (m_first < m_parts.size() && m_parts[m_first].source != nullptr && offset > m_parts[m_first].dataStart)
+    m_parts[m_first].source->release(offset - m_parts[m_first].dataStart);
+}
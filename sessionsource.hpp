@@ -0,0 +1,50 @@
+#ifndef SESSIONSOURCE_HPP
+#define SESSIONSOURCE_HPP
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "datasource.hpp"
+#include "session.hpp"
+
+struct SessionEntry // a file of a session
+{
+  std::string path; // opened when the window reaches the file
+  SessionFile file; // sent in the record in front of its bytes
+};
+
+/**
+ * @brief The data of a session connection: the record of every file followed by its bytes, see
+ * session.hpp. Offsets of view() and release() are offsets into that stream. A file is opened
+ * when the window first reaches it and closed once it is released, so a session holds at most a
+ * window's worth of files open.
+ */
+class SessionSource : public DataSource
+{
+public:
+  SessionSource(const std::vector<SessionEntry> &entries, int streamBufferBytes, int prefetchChunks = 0);
+  ~SessionSource();
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset);
+  void close();
+  int pollFd(); // of the file whose bytes were not read yet
+
+private:
+  struct Part
+  {
+    std::string path;
+    std::string record;
+    off_t start;        // stream offset of the record
+    off_t dataStart;    // stream offset of the first file byte
+    off_t end;          // stream offset after the last file byte
+    DataSource *source; // nullptr until viewed
+  };
+
+  std::vector<Part> m_parts;
+  size_t m_first; // first part not released entirely
+  DataSource *m_starved; // source of the last view() that returned SOURCE_WOULD_BLOCK
+  int m_streamBufferBytes;
+  int m_prefetchChunks;
+};
+
+#endif // SESSIONSOURCE_HPP
@@ -0,0 +1,26 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "aead.hpp"
+#include "sharedkey.hpp"
+
+std::string readSharedKey(std::string path)
+{
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream key;
+  key << file.rdbuf();
+  if (!file)
+  {
+    std::cerr << "ERROR: Unable to read the shared key " << path << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  if (key.str().size() < AEAD_MIN_SHARED_KEY_LEN)
+  {
+    std::cerr << "ERROR: The shared key " << path << " is shorter than " << AEAD_MIN_SHARED_KEY_LEN << " bytes" << std::endl;
+    exit(1);
+  }
+  return key.str();
+}
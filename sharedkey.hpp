@@ -0,0 +1,10 @@
+#ifndef SHAREDKEY_HPP
+#define SHAREDKEY_HPP
+
+#include <string>
+
+// reads the shared key file of encrypted connections, see aead.hpp, and exits with an error if
+// it can not or the key is too short
+std::string readSharedKey(std::string path);
+
+#endif // SHAREDKEY_HPP
@@ -0,0 +1,119 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "streamsource.hpp"
+
+StreamSource::StreamSource(int capacity)
+{
+  m_fd = -1;
+  m_capacity = (capacity < 2 * STREAM_CHUNK_BYTES) ? 2 * STREAM_CHUNK_BYTES : capacity;
+  m_readOffset = 0;
+  m_eof = false;
+}
+
+StreamSource::~StreamSource()
+{
+  close();
+}
+
+bool StreamSource::open(int fd)
+{
+  m_fd = fd;
+  // the event loop must never block on the producer
+  int flags = fcntl(m_fd, F_GETFL);
+  return flags != -1 && fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+void StreamSource::close()
+{
+  for (auto &chunk : m_chunks)
+    delete[] chunk.data;
+  m_chunks.clear();
+  for (auto buffer : m_spare)
+    delete[] buffer;
+  m_spare.clear();
+
+  if (m_fd != -1)
+    ::close(m_fd);
+  m_fd = -1;
+}
+
+int StreamSource::pollFd()
+{
+  return m_fd;
+}
+
+/**
+ * @brief Reads from the stream until it would block, ends, or the buffer is full
+ *
+ * @return -1 on read error, 0 otherwise
+ */
+int StreamSource::fill()
+{
+  while (!m_eof)
+  {
+    if (m_chunks.empty() || m_chunks.back().length == STREAM_CHUNK_BYTES)
+    {
+      if ((int)m_chunks.size() * STREAM_CHUNK_BYTES >= m_capacity)
+        return 0; // buffer full: backpressure until the window moves
+
+      char *buffer;
+      if (m_spare.empty())
+        buffer = new char[STREAM_CHUNK_BYTES];
+      else
+      {
+        buffer = m_spare.back();
+        m_spare.pop_back();
+      }
+      m_chunks.push_back({m_readOffset, 0, buffer});
+    }
+
+    Chunk &chunk = m_chunks.back();
+    int ret = read(m_fd, chunk.data + chunk.length, STREAM_CHUNK_BYTES - chunk.length);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    if (ret == -1)
+      return -1;
+    if (ret == 0)
+      m_eof = true;
+    chunk.length += ret;
+    m_readOffset += ret;
+  }
+  return 0;
+}
+
+int StreamSource::view(off_t offset, int maxLen, const char **data)
+{
+  if (fill() == -1)
+    return -1;
+
+  if (offset >= m_readOffset)
+    return m_eof ? 0 : SOURCE_WOULD_BLOCK;
+
+  for (auto &chunk : m_chunks)
+  {
+    if (offset >= chunk.offset && offset < chunk.offset + chunk.length)
+    {
+      int available = chunk.offset + chunk.length - offset; // never straddles two chunks
+      // a short view of a chunk that is still filling would cut a packet short, and a
+      // retransmission after a timeout would then cut the stream at different offsets
+      if (available < maxLen && &chunk == &m_chunks.back() && !m_eof)
+        return SOURCE_WOULD_BLOCK;
+      *data = chunk.data + (offset - chunk.offset);
+      return (available < maxLen) ? available : maxLen;
+    }
+  }
+  return -1; // offset was already released
+}
+
+void StreamSource::release(off_t offset)
+{
+  // the last chunk is kept while it is still being filled
+  while (m_chunks.size() > 1 && m_chunks.front().offset + m_chunks.front().length <= offset)
+  {
+    m_spare.push_back(m_chunks.front().data);
+    m_chunks.pop_front();
+  }
+}
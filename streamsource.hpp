@@ -0,0 +1,49 @@
+#ifndef STREAMSOURCE_HPP
+#define STREAMSOURCE_HPP
+
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include "datasource.hpp"
+
+const int STREAM_CHUNK_BYTES = 65536;             // allocation unit of the retransmission buffer
+const int DEFAULT_STREAM_BUFFER_BYTES = 1048576;  // default bound of the retransmission buffer
+
+/**
+ * @brief Data from a non-seekable file descriptor (stdin, pipes, sockets, character devices).
+ *
+ * Bytes are read without blocking into a bounded buffer and stay there until release(), which
+ * is what allows retransmitting them. Once `capacity` bytes are buffered the source stops
+ * reading, so a fast producer is held back by the pipe instead of by unbounded memory; a slow
+ * producer makes view() return SOURCE_WOULD_BLOCK until pollFd() is readable.
+ */
+class StreamSource : public DataSource
+{
+public:
+  StreamSource(int capacity);
+  ~StreamSource();
+  bool open(int fd); // takes ownership of fd, false on error
+  int view(off_t offset, int maxLen, const char **data);
+  void release(off_t offset);
+  void close();
+  int pollFd();
+
+private:
+  struct Chunk
+  {
+    off_t offset; // stream offset of data[0]
+    int length;   // valid bytes in data, grows until STREAM_CHUNK_BYTES
+    char *data;
+  };
+
+  int fill(); // reads whatever is available, -1 on error
+
+  int m_fd;
+  int m_capacity;
+  std::deque<Chunk> m_chunks; // chunks covering [released offset, read offset)
+  std::vector<char *> m_spare; // recycled chunk buffers
+  off_t m_readOffset;          // stream offset of the next byte read from m_fd
+  bool m_eof;
+};
+
+#endif // STREAMSOURCE_HPP
@@ -1,6 +1,6 @@
 #include <string>
-#include <iostream>
 #include <cstring>
+#include <algorithm>
 #include <sys/types.h>
 #ifdef __APPLE__
 #include <machine/endian.h>
@@ -18,30 +18,24 @@ CONSTRUCTORS
 TCPPacket::TCPPacket(std::string s)
 {
   m_totalLength = s.size();
-  m_packetString = s;
-  m_packetCString = new char[m_totalLength];
-  for (int i = 0; i < m_totalLength; i++)
-  {
-    m_packetCString[i] = s[i]; // Can't use c_str because null bye characters
-  }
+  m_packetCString = nullptr;
+  memcpy(m_header, s.data(), HEADER_LEN);
 
   m_payloadLen = m_totalLength - HEADER_LEN;
-  
-  for(int i = 0 ; i < m_payloadLen; i++)
-  {
-    m_payload += m_packetCString[i+HEADER_LEN];
-  } 
+  m_payload = s.substr(HEADER_LEN); // Can't use c_str because null bye characters
+  m_payloadData = m_payload.data();
 
-  memcpy(&m_seq, m_packetCString, sizeof(m_seq));
+  memcpy(&m_seq, m_header, sizeof(m_seq));
   m_seq = be32toh(m_seq);
 
-  memcpy(&m_ack, m_packetCString + 4, sizeof(m_ack));
+  memcpy(&m_ack, m_header + 4, sizeof(m_ack));
   m_ack = be32toh(m_ack);
 
-  memcpy(&m_connId, m_packetCString + 8, sizeof(m_connId));
-  m_connId = be16toh(m_connId);
+  uint16_t connId;
+  memcpy(&connId, m_header + 8, sizeof(connId));
+  m_connId = be16toh(connId);
 
-  char flagField = m_packetCString[11];
+  char flagField = m_header[11];
 
   m_ackflag = ((flagField & 4) >> 2) ? true : false; // 4 = b100
   m_synflag = (flagField & 2) >> 1 ? true : false;   // 2 = b010
@@ -58,12 +52,28 @@ TCPPacket::TCPPacket(int seq, int ack, int connId, bool ackflag, bool synflag, b
   m_finflag = finflag;
   m_payloadLen = payloadLen;
   m_payload = payload;
+  m_payloadData = m_payload.data();
+  m_totalLength = payloadLen + HEADER_LEN;
+  m_packetCString = nullptr;
+  setHeader();
+}
+
+TCPPacket::TCPPacket(int seq, int ack, int connId, bool ackflag, bool synflag, bool finflag, const char *payload, int payloadLen)
+{
+  m_seq = seq;
+  m_ack = ack;
+  m_connId = connId;
+  m_ackflag = ackflag;
+  m_synflag = synflag;
+  m_finflag = finflag;
+  m_payloadLen = payloadLen;
+  m_payloadData = payload;
   m_totalLength = payloadLen + HEADER_LEN;
-  m_packetCString = new char[m_totalLength];
-  setString();
+  m_packetCString = nullptr;
+  setHeader();
 }
 
-void TCPPacket::setString()
+void TCPPacket::setHeader()
 {
   uint32_t seq = (uint32_t)m_seq;
   uint32_t ack = (uint32_t)m_ack;
@@ -76,28 +86,16 @@ void TCPPacket::setString()
 
   // Setting Header
   seq = htobe32(seq);
-  memcpy(m_packetCString,&seq,sizeof(seq));
+  memcpy(m_header,&seq,sizeof(seq));
 
   ack = htobe32(ack);
-  memcpy(m_packetCString+4,&ack,sizeof(ack));
+  memcpy(m_header+4,&ack,sizeof(ack));
 
   connId = htobe16(connId);
-  memcpy( m_packetCString+8,&connId,sizeof(connId));
-
-  m_packetCString[10] = 0;
-  m_packetCString[11] = flagField;
+  memcpy(m_header+8,&connId,sizeof(connId));
 
-  // Setting Payload
-  for(int i = 0 ; i < m_payloadLen; i++)
-  {
-    m_packetCString[i+HEADER_LEN] = m_payload[i];
-  }
-
-  m_packetString.resize(m_totalLength);
-  for(int i = 0 ; i < m_totalLength; i++)
-  {
-    m_packetString += m_packetCString[i];
-  }
+  m_header[10] = 0;
+  m_header[11] = flagField;
 }
 
 /*------------------------------------------------------------
@@ -106,7 +104,7 @@ DESTRUCTOR
 
 TCPPacket::~TCPPacket()
 {
-  delete m_packetCString;
+  delete[] m_packetCString;
 }
 
 /*------------------------------------------------------------
@@ -114,15 +112,68 @@ GETTER FUNCTIONS
 -------------------------------------------------------------*/
 std::string TCPPacket::getString()
 {
-  return m_packetString;
+  int length;
+  char *packetCString = getCString(length);
+  return std::string(packetCString, length);
 }
 
-char *TCPPacket::getCString(int &length) //Currently returns pointer to m_packetCString
+char *TCPPacket::getCString(int &length) // Builds the contiguous copy only for callers that need one
 {
+  if (m_packetCString == nullptr)
+  {
+    m_packetCString = new char[m_totalLength];
+    memcpy(m_packetCString, m_header, HEADER_LEN);
+    if (m_payloadLen > 0)
+      memcpy(m_packetCString + HEADER_LEN, m_payloadData, m_payloadLen);
+  }
   length = m_totalLength;
   return m_packetCString;
 }
 
+const char *TCPPacket::getHeader()
+{
+  return m_header;
+}
+
+/**
+ * @brief Header byte 10 is only set in forward error correction parity packets, where it
+ * holds the number of data segments the parity covers
+ */
+int TCPPacket::getFecGroup()
+{
+  return (unsigned char)m_header[10];
+}
+
+void TCPPacket::setFecGroup(int segments)
+{
+  m_header[10] = (char)segments;
+  delete[] m_packetCString; // rebuilt from the new header on demand
+  m_packetCString = nullptr;
+}
+
+/**
+ * @brief The server's ACKs reuse header byte 10 for the receive window of the connection, in
+ * units of MAX_PAYLOAD_LENGTH, and set flag bit 8 to say that they do. A window of 0 is closed;
+ * packets without the bit, like those of older servers, advertise none.
+ */
+int TCPPacket::getWindow()
+{
+  if (!(m_header[11] & WINDOW_FLAG))
+    return -1;
+  return getFecGroup() * MAX_PAYLOAD_LENGTH;
+}
+
+void TCPPacket::setWindow(int bytes)
+{
+  setFecGroup(std::max(0, std::min(255, bytes / MAX_PAYLOAD_LENGTH)));
+  m_header[11] |= WINDOW_FLAG;
+}
+
+const char *TCPPacket::getPayloadData()
+{
+  return m_payloadData;
+}
+
 
 int TCPPacket::getAckNum()
 {
@@ -164,6 +215,6 @@ bool TCPPacket::isSYN()
 
 std::string TCPPacket::getPayload()
 {
-  return m_payload;
+  return std::string(m_payloadData, m_payloadLen);
 }
 
@@ -1,6 +1,7 @@
 #ifndef TCP_HPP
 #define TCP_HPP
 #include <string>
+#include "constants.hpp"
 
 
 class TCPPacket
@@ -9,6 +10,8 @@ public:
   // Constructors
   TCPPacket(std::string s);
   TCPPacket(int seq, int ack, int connId, bool ackflag, bool synflag, bool finflag, int payloadLen, std::string payload);
+  // Payload is NOT copied: `payload` must stay valid for the lifetime of the packet
+  TCPPacket(int seq, int ack, int connId, bool ackflag, bool synflag, bool finflag, const char *payload, int payloadLen);
   // Destructor
   ~TCPPacket();
 
@@ -22,12 +25,18 @@ public:
   bool isACK();
   bool isFIN();
   bool isSYN();
-  std::string getString(); 
+  std::string getString();
   std::string getPayload();
+  const char *getPayloadData(); // pointer to the payload bytes, no copy
+  const char *getHeader();      // pointer to the HEADER_LEN encoded header bytes
+  int getFecGroup();            // data segments covered by a parity packet, 0 for every other packet
+  void setFecGroup(int segments);
+  int getWindow();              // receive window advertised by a server ACK in bytes, -1 if none
+  void setWindow(int bytes);
   char* getCString(int &length);
 private:
   // utility Functions
-  void setString();
+  void setHeader();
 
   // Data Members
   int m_seq, m_ack;
@@ -36,9 +45,10 @@ private:
   int m_totalLength;
   bool m_ackflag, m_synflag, m_finflag;
   std::string m_payload;
-  std:: string m_packetString;
-  char* m_packetCString;
+  const char *m_payloadData; // either m_payload.data() or a caller owned view
+  char m_header[HEADER_LEN];
+  char* m_packetCString;     // contiguous header + payload, built on demand
 
 };
 
-#endif //TCP_HPP
\ No newline at end of file
+#endif //TCP_HPP
@@ -0,0 +1,47 @@
+#include <string>
+#include "trace.hpp"
+
+TraceRecord tracePacketRecord(TraceEvent event, TCPPacket *p, uint32_t cwnd, uint32_t ssthresh)
+{
+  TraceRecord r;
+  r.timestampNs = 0;
+  r.seqNum = p->getSeqNum();
+  r.ackNum = p->getAckNum();
+  r.cwnd = cwnd;
+  r.ssthresh = ssthresh;
+  r.connId = p->getConnId();
+  r.payloadLen = p->getPayloadLength();
+  r.flags = (p->isACK() ? TRACE_FLAG_ACK : 0) | (p->isSYN() ? TRACE_FLAG_SYN : 0) | (p->isFIN() ? TRACE_FLAG_FIN : 0);
+  r.direction = (event == TRACE_RECV || event == TRACE_DROP) ? TRACE_IN : TRACE_OUT;
+  r.event = event;
+  r.reserved = 0;
+  return r;
+}
+
+TraceEvent traceEvent(bool recvd, bool dropped, bool dup)
+{
+  if (recvd)
+    return dropped ? TRACE_DROP : TRACE_RECV;
+  return dup ? TRACE_RETRANSMIT : TRACE_SEND;
+}
+
+/**
+ * @brief The RECV/SEND/DROP line of a packet: the windows of a client connection follow the
+ * connection id, except for a dropped packet, and a retransmission ends in DUP
+ */
+std::string traceLine(const TraceRecord &record)
+{
+  std::string message = (record.event == TRACE_DROP) ? "DROP" : (record.direction == TRACE_IN) ? "RECV" : "SEND";
+  message = message + " " + std::to_string(record.seqNum) + " " + std::to_string(record.ackNum) + " " + std::to_string(record.connId);
+  if (record.cwnd != 0 && record.event != TRACE_DROP)
+    message += " " + std::to_string(record.cwnd) + " " + std::to_string(record.ssthresh);
+  if (record.flags & TRACE_FLAG_ACK)
+    message += " ACK";
+  if (record.flags & TRACE_FLAG_SYN)
+    message += " SYN";
+  if (record.flags & TRACE_FLAG_FIN)
+    message += " FIN";
+  if (record.event == TRACE_RETRANSMIT)
+    message += " DUP";
+  return message;
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <stdint.h>
+#include "tcp.hpp"
+
+/*
+  The packet log of the engines: one fixed size record per packet sent, received or dropped,
+  in host byte order. A driver prints each as its RECV/SEND/DROP line with traceLine(), or
+  stores it in a binary trace, see tracefile.hpp.
+*/
+
+enum TraceDirection
+{
+	TRACE_OUT = 0,
+	TRACE_IN = 1
+};
+
+enum TraceEvent // what the line of the packet log says
+{
+	TRACE_SEND = 0,       // SEND
+	TRACE_RETRANSMIT = 1, // SEND ... DUP
+	TRACE_RECV = 2,       // RECV
+	TRACE_DROP = 3        // DROP
+};
+
+struct TraceRecord
+{
+	uint64_t timestampNs; // since the trace was opened
+	uint32_t seqNum;
+	uint32_t ackNum;
+	uint32_t cwnd;        // congestion window of a client connection, 0 on the server
+	uint32_t ssthresh;
+	uint16_t connId;
+	uint16_t payloadLen;
+	uint8_t flags;        // ACK, SYN and FIN bits as in the header
+	uint8_t direction;    // TraceDirection
+	uint8_t event;        // TraceEvent
+	uint8_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "trace layout changed, bump TRACE_VERSION");
+
+const uint8_t TRACE_FLAG_ACK = 4;
+const uint8_t TRACE_FLAG_SYN = 2;
+const uint8_t TRACE_FLAG_FIN = 1;
+
+// the record of a packet, with the windows of a client connection and no timestamp
+TraceRecord tracePacketRecord(TraceEvent event, TCPPacket *p, uint32_t cwnd = 0, uint32_t ssthresh = 0);
+TraceEvent traceEvent(bool recvd, bool dropped, bool dup); // of a packet received, maybe dropped, or sent, maybe again
+std::string traceLine(const TraceRecord &record);          // its line in the packet log
+
+#endif // TRACE_HPP
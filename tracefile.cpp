@@ -0,0 +1,146 @@
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tracefile.hpp"
+
+static uint64_t clockNs(clockid_t clock)
+{
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+Tracer::Tracer()
+{
+  m_header = nullptr;
+  m_records = nullptr;
+  m_mapLength = 0;
+  m_startNs = 0;
+}
+
+Tracer::~Tracer()
+{
+  if (m_header != nullptr)
+    munmap(m_header, m_mapLength);
+}
+
+/**
+ * @brief Creates (or truncates) the trace file at `path` with room for `capacity` records and
+ * maps it
+ */
+bool Tracer::open(std::string path, TraceSide side, uint64_t capacity)
+{
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return false;
+  m_mapLength = sizeof(TraceHeader) + capacity * sizeof(TraceRecord);
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, m_mapLength) == 0)
+    map = mmap(NULL, m_mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int savedErrno = errno;
+  close(fd); // the mapping keeps the file
+  if (map == MAP_FAILED)
+  {
+    errno = savedErrno;
+    return false;
+  }
+
+  m_header = (TraceHeader *)map;
+  m_records = (TraceRecord *)(m_header + 1);
+  memcpy(m_header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  m_header->version = TRACE_VERSION;
+  m_header->recordSize = sizeof(TraceRecord);
+  m_header->capacity = capacity;
+  m_header->written = 0;
+  m_header->startRealtimeNs = clockNs(CLOCK_REALTIME);
+  m_header->side = side;
+  m_startNs = clockNs(CLOCK_MONOTONIC);
+  return true;
+}
+
+void Tracer::record(TraceRecord record)
+{
+  if (m_header == nullptr)
+    return;
+  uint64_t n = m_header->written;
+  record.timestampNs = clockNs(CLOCK_MONOTONIC) - m_startNs;
+  m_records[n % m_header->capacity] = record;
+  // publish the record after it is complete, for a reader looking at a live trace
+  __atomic_store_n(&m_header->written, n + 1, __ATOMIC_RELEASE);
+}
+
+TraceReader::TraceReader()
+{
+  m_header = nullptr;
+  m_records = nullptr;
+  m_mapLength = 0;
+}
+
+TraceReader::~TraceReader()
+{
+  if (m_header != nullptr)
+    munmap(m_header, m_mapLength);
+}
+
+bool TraceReader::open(std::string path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1)
+  {
+    m_error = path + ": " + strerror(errno);
+    if (fd != -1)
+      close(fd);
+    return false;
+  }
+  if (st.st_size < (off_t)sizeof(TraceHeader))
+  {
+    m_error = path + " is not a trace";
+    close(fd);
+    return false;
+  }
+  m_mapLength = st.st_size;
+  void *map = mmap(NULL, m_mapLength, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    m_error = path + ": " + strerror(errno);
+    return false;
+  }
+  m_header = (TraceHeader *)map;
+  m_records = (TraceRecord *)(m_header + 1);
+  if (memcmp(m_header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || m_header->version != TRACE_VERSION ||
+      m_header->recordSize != sizeof(TraceRecord) || m_mapLength < sizeof(TraceHeader) + m_header->capacity * sizeof(TraceRecord))
+  {
+    m_error = path + " is not a version " + std::to_string(TRACE_VERSION) + " trace";
+    return false;
+  }
+  return true;
+}
+
+std::string TraceReader::error()
+{
+  return m_error;
+}
+
+const TraceHeader &TraceReader::header()
+{
+  return *m_header;
+}
+
+uint64_t TraceReader::size()
+{
+  uint64_t written = __atomic_load_n(&m_header->written, __ATOMIC_ACQUIRE);
+  return written < m_header->capacity ? written : m_header->capacity;
+}
+
+const TraceRecord &TraceReader::operator[](uint64_t i)
+{
+  uint64_t written = __atomic_load_n(&m_header->written, __ATOMIC_ACQUIRE);
+  return m_records[(written - size() + i) % m_header->capacity];
+}
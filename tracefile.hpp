@@ -0,0 +1,84 @@
+#ifndef TRACEFILE_HPP
+#define TRACEFILE_HPP
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.hpp"
+
+/*
+  A binary trace replaces the RECV/SEND/DROP lines of the packet log with the TraceRecord of
+  every packet, written into a ring of records in a memory mapped file:
+
+      | TraceHeader (64 bytes) | TraceRecord 0 | TraceRecord 1 | ... | TraceRecord capacity-1 |
+
+  Record n goes to slot n % capacity, so once the ring is full the oldest records are
+  overwritten and the file keeps the last `capacity` packets. Everything is in host byte order.
+  The analyzer tool turns a trace into per connection time series.
+*/
+
+const char TRACE_MAGIC[8] = {'C', 'F', 'D', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t TRACE_VERSION = 1;
+const uint64_t TRACE_DEFAULT_RECORDS = 1 << 20; // 32M of trace
+
+enum TraceSide // which end wrote the trace
+{
+	TRACE_SERVER = 0,
+	TRACE_CLIENT = 1
+};
+
+struct TraceHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t capacity;        // records in the ring
+	uint64_t written;         // records written so far
+	uint64_t startRealtimeNs; // wall clock time of timestamp 0
+	uint8_t side;             // TraceSide
+	uint8_t reserved[23];
+};
+
+static_assert(sizeof(TraceHeader) == 64, "trace layout changed, bump TRACE_VERSION");
+
+/**
+ * @brief Writes a trace. record() only stores into the mapping, the kernel writes the pages
+ * back to the file on its own.
+ */
+class Tracer
+{
+public:
+	Tracer();
+	~Tracer();
+	bool open(std::string path, TraceSide side, uint64_t capacity = TRACE_DEFAULT_RECORDS); // false on error, errno is set
+	void record(TraceRecord record); // stamped with the time since open()
+
+private:
+	TraceHeader *m_header;
+	TraceRecord *m_records;
+	size_t m_mapLength;
+	uint64_t m_startNs; // CLOCK_MONOTONIC at open
+};
+
+/**
+ * @brief Reads a trace written by a Tracer, oldest record first
+ */
+class TraceReader
+{
+public:
+	TraceReader();
+	~TraceReader();
+	bool open(std::string path); // false on error, with a message in error()
+	std::string error();
+	const TraceHeader &header();
+	uint64_t size();                         // records kept in the ring
+	const TraceRecord &operator[](uint64_t i); // i-th oldest record
+
+private:
+	TraceHeader *m_header;
+	TraceRecord *m_records;
+	size_t m_mapLength;
+	std::string m_error;
+};
+
+#endif // TRACEFILE_HPP
@@ -0,0 +1,944 @@
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "constants.hpp"
+#include "utilities.hpp"
+#include "uploader.hpp"
+#include "compressedsource.hpp"
+#include "prefetchsource.hpp"
+#include "aead.hpp"
+#include "sharedkey.hpp"
+#include "latencysignals.hpp"
+
+Uploader::Uploader(std::string hostname, std::string port, int maxActive, int stripes, int streamBufferBytes, bool resume, bool compress, bool checksums, int fecGroup, bool earlyData, std::string metricsPath, std::string tracePath, bool latency,
+                   bool session, int prefetchChunks, int busyPollCpu, bool offload, std::string sharedKey)
+    : m_stages(CLIENT_STAGE_NAMES, CLIENT_STAGES), m_reader(MAX_PACKET_LENGTH)
+{
+  using namespace std;
+  struct addrinfo hints, *servInfo, *p;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET; // set to AF_INET to use IPv4
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  hints.ai_protocol = IPPROTO_UDP;
+
+  m_maxActive = maxActive;
+  m_stripes = stripes;
+  m_streamBufferBytes = streamBufferBytes;
+  m_resume = resume;
+  m_compress = compress;
+  m_checksums = checksums;
+  m_fecGroup = fecGroup;
+  m_earlyData = earlyData;
+  m_session = session;
+  m_prefetchChunks = prefetchChunks;
+  m_sharedKey = sharedKey;
+  m_metricsPath = metricsPath;
+  m_metricsWrittenAt = std::chrono::steady_clock::now();
+  m_connectionsOpened = 0;
+  m_tracer = nullptr;
+  if (!tracePath.empty())
+  {
+    m_tracer = new Tracer();
+    if (!m_tracer->open(tracePath, TRACE_CLIENT))
+    {
+      cerr << "ERROR: Unable to open trace file " << tracePath << ": " << strerror(errno) << endl;
+      exit(1);
+    }
+  }
+  if (latency)
+  {
+    m_stages.enable();
+    watchLatencySignals(false);
+  }
+  m_nextInitialSeqNum = INIT_CLIENT_SEQ_NUM;
+  m_exitCode = 0;
+  srand(time(nullptr) ^ getpid()); // transfer ids and stream tokens only need to differ between concurrent clients
+
+  int ret;
+  if ((ret = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &servInfo)) != 0)
+  {
+    cerr << "ERROR: in getaddrinfo " << gai_strerror(ret) << endl;
+    exit(1);
+  }
+  int sockfd = -1;
+
+  for (p = servInfo; p != NULL; p = p->ai_next)
+  {
+    sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (sockfd == -1)
+    {
+      cerr << "ERROR: in socket " << strerror(errno) << endl;
+      continue;
+    }
+    break;
+  }
+
+  if (p == NULL)
+  {
+    cerr << "ERROR: in socket " << strerror(errno) << endl;
+    exit(1);
+  }
+
+  m_sockFd = sockfd;
+  // non blocking receiving, waiting is done in waitForPacket()
+  if (fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1)
+  {
+    cerr << "ERROR: in fcntl " << strerror(errno) << endl;
+    exit(1);
+  }
+
+  m_segmentationOffload = offload && probeSegmentationOffload(m_sockFd);
+  if (offload)
+    m_reader.enableOffload(m_sockFd);
+  if (m_stages.enabled() && !timestampReceives(m_sockFd))
+    perror("setsockopt SO_TIMESTAMPNS");
+  if (busyPollCpu != -1)
+    m_busyPoll.enable(m_sockFd, busyPollCpu);
+
+  memcpy(&m_serverAddr, p->ai_addr, p->ai_addrlen);
+  m_serverAddrLen = p->ai_addrlen;
+  freeaddrinfo(servInfo);
+}
+
+Uploader::~Uploader()
+{
+  for (auto client : m_clients)
+    delete client;
+  delete m_tracer;
+  close(m_sockFd);
+}
+
+/**
+ * @brief Last component of a path, empty for "." and ".." which do not name anything in a session
+ */
+static std::string lastComponent(std::string path)
+{
+  while (path.size() > 1 && path.back() == '/')
+    path.pop_back();
+  std::string name = path.substr(path.find_last_of('/') + 1);
+  return (name == "." || name == "..") ? "" : name;
+}
+
+/**
+ * @brief Queues a file for upload. Directories are walked recursively and their regular
+ * files are queued in name order.
+ *
+ * @return false if `path` does not exist or a directory can not be read
+ */
+bool Uploader::addPath(std::string path, std::string name)
+{
+  if (name.empty())
+    name = lastComponent(path);
+  if (path == "-" || isSyntheticSource(path))
+  {
+    queueFile(path, -1, name); // never striped
+    return true;
+  }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1)
+    return false;
+
+  if (!S_ISDIR(st.st_mode))
+  {
+    queueFile(path, S_ISREG(st.st_mode) ? st.st_size : -1, name);
+    return true;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr)
+    return false;
+
+  std::vector<std::string> entries;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr)
+  {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..")
+      entries.push_back(name);
+  }
+  closedir(dir);
+
+  std::sort(entries.begin(), entries.end());
+  for (auto &entry : entries)
+  {
+    std::string child = path + "/" + entry;
+    if (stat(child.c_str(), &st) == -1)
+      continue;
+    if (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))
+    {
+      if (!addPath(child, name.empty() ? entry : name + "/" + entry))
+        return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Queues the connections of one file. Regular files are split into up to m_stripes
+ * ranges of whole packets; files of unknown size (pipes, devices) are never split. With
+ * sessions a file that is not split goes into one, unless its size is unknown.
+ *
+ * @param size file size, -1 if unknown
+ * @param name of the file in a session
+ */
+void Uploader::queueFile(std::string fileName, off_t size, std::string name)
+{
+  off_t packets = (size + MAX_PAYLOAD_LENGTH - 1) / MAX_PAYLOAD_LENGTH;
+  int stripes = (size <= 0 || packets < m_stripes) ? std::max((off_t)1, packets) : m_stripes;
+  SessionEntry entry;
+  if (m_session && !m_resume && stripes == 1 && sessionEntry(fileName, name, entry))
+  {
+    m_sessionFiles.push_back(entry);
+    return;
+  }
+  if (size == -1 || stripes == 1)
+  {
+    m_pendingFiles.push_back({fileName, 0, -1, false, 0, m_resume, m_resume ? resumeToken(fileName) : 0, 0, m_compress});
+    return;
+  }
+
+  uint32_t transferId = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+  off_t stripeLength = ((packets + stripes - 1) / stripes) * MAX_PAYLOAD_LENGTH;
+  for (off_t offset = 0; offset < size; offset += stripeLength)
+  {
+    off_t length = std::min(stripeLength, size - offset);
+    m_pendingFiles.push_back({fileName, offset, length, true, transferId, false, 0, 0, m_compress});
+  }
+}
+
+/**
+ * @brief Describes a file for the record in front of it in a session: its length, permission
+ * bits and modification time as they are now. Synthetic sources get the current time.
+ *
+ * @return false if the file can not go into a session: streams, whose length is not known
+ * ahead, and names the server would refuse
+ */
+bool Uploader::sessionEntry(std::string fileName, std::string name, SessionEntry &entry)
+{
+  if (fileName == "-" || !isSessionName(name))
+    return false;
+  entry.path = fileName;
+  entry.file.name = name;
+  if (isSyntheticSource(fileName))
+  {
+    entry.file.length = parseSize(fileName.substr(GENERATOR_PREFIX.size()));
+    entry.file.mode = 0644;
+    entry.file.mtimeSeconds = time(nullptr);
+    entry.file.mtimeNanoseconds = 0;
+    return entry.file.length != -1;
+  }
+  struct stat st;
+  if (stat(fileName.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+    return false;
+  entry.file.length = st.st_size;
+  entry.file.mode = st.st_mode & 07777;
+  entry.file.mtimeSeconds = st.st_mtim.tv_sec;
+  entry.file.mtimeNanoseconds = st.st_mtim.tv_nsec;
+  return true;
+}
+
+/**
+ * @brief Spreads the files queued for sessions over up to m_maxActive sessions, every file
+ * going to the session with the fewest bytes so far, and queues the sessions
+ */
+void Uploader::queueSessions()
+{
+  int sessions = std::min((int)m_sessionFiles.size(), m_maxActive);
+  std::vector<UploadJob> jobs;
+  std::vector<off_t> bytes(sessions, 0);
+  for (int i = 0; i < sessions; i++)
+    jobs.push_back({"session:" + std::to_string(i + 1), 0, -1, false, 0, false, 0, 0, m_compress});
+  for (auto &entry : m_sessionFiles)
+  {
+    int lightest = std::min_element(bytes.begin(), bytes.end()) - bytes.begin();
+    jobs[lightest].sessionFiles.push_back(entry);
+    bytes[lightest] += SESSION_RECORD_FIXED_LEN + entry.file.name.size() + entry.file.length;
+  }
+  for (auto &job : jobs)
+    m_pendingFiles.push_back(job);
+  m_sessionFiles.clear();
+}
+
+/**
+ * @brief Token that identifies a resumable transfer at the server. Regular files and synthetic
+ * sources hash to the same token on every run, as long as the file is unchanged; streams can not
+ * be replayed and get a random token.
+ */
+uint64_t Uploader::resumeToken(std::string fileName)
+{
+  std::string identity;
+  struct stat st;
+  if (isSyntheticSource(fileName))
+    identity = fileName;
+  else if (fileName != "-" && stat(fileName.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+  {
+    char *path = realpath(fileName.c_str(), nullptr);
+    identity = std::string(path ? path : fileName.c_str()) + "/" + std::to_string(st.st_size) + "/" +
+               std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+    free(path);
+  }
+  else
+    return ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand();
+
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  for (unsigned char c : identity)
+    hash = (hash ^ c) * 1099511628211ULL;
+  return hash;
+}
+
+/**
+ * @brief Entry point for running client services
+ *
+ * Every iteration the clock is read once, timers of all connections are checked, every
+ * connection sends what its window allows and all packets waiting at the socket are handed to
+ * their connection. If no connection can send anything, the loop sleeps until the next packet
+ * or the earliest timer of any connection.
+ *
+ * @return 0 if every upload succeeded, 1 otherwise
+ */
+int Uploader::run()
+{
+  queueSessions();
+  while (!m_pendingFiles.empty() || !m_clients.empty())
+  {
+    m_now = std::chrono::steady_clock::now(); // one clock read per iteration
+    if (m_stages.enabled() && takeLatencyDumpRequest())
+      std::cerr << m_stages.table() << std::flush;
+    startPendingUploads();
+
+    for (auto client : m_clients)
+    {
+      client->setClock(m_now);
+      client->handleTimers();
+      drain(client);
+      client->sendData();
+      drain(client);
+    }
+
+    TCPPacket *p;
+    while ((p = recvPacket()) != nullptr)
+    {
+      dispatch(p);
+      delete p;
+      p = nullptr;
+    }
+    reapClosedUploads();
+    c_duration metricsInterval = std::chrono::duration_cast<c_duration>(std::chrono::duration<float>(METRICS_INTERVAL));
+    if (!m_metricsPath.empty() && m_now - m_metricsWrittenAt >= metricsInterval)
+      writeMetrics();
+
+    // nothing new can be sent until an ACK, a timeout or more stream data, so sleep instead of spinning
+    bool canSend = !m_pendingFiles.empty() && activeUploads() < m_maxActive;
+    c_time deadline = m_metricsPath.empty() ? c_time::max() : m_metricsWrittenAt + metricsInterval;
+    std::vector<int> sourceFds;
+    for (auto client : m_clients)
+    {
+      canSend = canSend || client->canSend();
+      deadline = std::min(deadline, client->nextDeadline());
+      if (client->pollFd() != -1)
+        sourceFds.push_back(client->pollFd());
+    }
+    if (!canSend && !m_clients.empty())
+      waitForPacket(deadline, sourceFds);
+  }
+  if (!m_metricsPath.empty()) // the totals of the whole run
+    writeMetrics();
+  if (m_stages.enabled())
+    std::cerr << m_stages.table() << std::flush;
+  return m_exitCode;
+}
+
+/**
+ * @brief Starts queued uploads until `maxActive` connections are active
+ */
+void Uploader::startPendingUploads()
+{
+  int active = activeUploads();
+  while (!m_pendingFiles.empty() && active < m_maxActive)
+  {
+    int initialSeqNum = nextInitialSeqNum();
+    if (initialSeqNum == -1) // the next SYN waits for a SYN-ACK to free a number
+      break;
+    UploadJob job = m_pendingFiles.front();
+    m_pendingFiles.pop_front();
+
+    DataSource *source = job.sessionFiles.empty() ? openDataSource(job.fileName, m_streamBufferBytes, m_prefetchChunks)
+                                                  : new SessionSource(job.sessionFiles, m_streamBufferBytes, m_prefetchChunks);
+    if (source == nullptr)
+    {
+      std::cerr << "ERROR: Unable to open file " << job.fileName << ": " << strerror(errno) << std::endl;
+      m_exitCode = 1;
+      continue;
+    }
+    if (job.compress)
+      source = new CompressedSource(source, job.offset, (job.length == -1) ? -1 : job.offset + job.length);
+    if (startUpload(job, source, initialSeqNum))
+      active++;
+  }
+}
+
+/**
+ * @brief Opens a connection for `job` that sends from `source` with the SYN at `initialSeqNum`,
+ * false if it can not
+ */
+bool Uploader::startUpload(UploadJob &job, DataSource *source, int initialSeqNum)
+{
+  if (initialSeqNum == -1)
+  {
+    std::cerr << "ERROR: No initial sequence number free for " << job.fileName << std::endl;
+    source->close();
+    delete source;
+    m_exitCode = 1;
+    return false;
+  }
+  ConnectionOptions options;
+  options.stripe = job.stripe;
+  options.transferId = job.transferId;
+  options.stripeOffset = job.offset;
+  options.resume = job.resume;
+  options.resumeToken = job.resumeToken;
+  options.compression = job.compress ? CODEC_ZLIB : CODEC_NONE;
+  options.checksums = m_checksums;
+  options.fecGroup = m_fecGroup;
+  options.session = !job.sessionFiles.empty();
+  if (!m_sharedKey.empty())
+  {
+    options.aead = preferredAeadCipher();
+    if (!aeadRandom(options.aeadRandom))
+    {
+      std::cerr << "ERROR: No random bytes for the encryption keys of " << job.fileName << std::endl;
+      source->close();
+      delete source;
+      m_exitCode = 1;
+      return false;
+    }
+  }
+
+  // a compressed connection sends the whole frame stream of its byte range
+  Client *client = new Client(source, job.fileName, initialSeqNum, job.compress ? 0 : job.offset, job.compress ? -1 : job.length, options,
+                              m_earlyData);
+  client->setClock(m_now);
+  client->setPacketLog(true);
+  client->setLatencyStages(&m_stages);
+  client->setSegmentationOffload(m_segmentationOffload);
+  client->setSharedKey(m_sharedKey);
+  client->start();
+  drain(client);
+  m_clients.push_back(client);
+  m_clientJobs[client] = job;
+  m_synSentClients[client->getInitialSeqNum()] = client;
+  m_connectionsOpened++;
+  return true;
+}
+
+/**
+ * @brief Hands a packet to its connection. SYN-ACKs carry the connection ID assigned by the
+ * server, so they are matched through the ACK of the initial sequence number instead.
+ */
+void Uploader::dispatch(TCPPacket *p)
+{
+  if (p->isSYN() && p->isACK())
+  {
+    int initialSeqNum = (p->getAckNum() + MAX_SEQ_NUM) % (MAX_SEQ_NUM + 1); // ack is ISN + 1
+    auto it = m_synSentClients.find(initialSeqNum);
+    if (it == m_synSentClients.end() || !it->second->verifySynAck(p))
+    {
+      // the ACK also covers any data carried in the SYN
+      it = m_synSentClients.begin();
+      while (it != m_synSentClients.end() && !it->second->verifySynAck(p))
+        it++;
+    }
+    if (it != m_synSentClients.end())
+    {
+      Client *client = it->second;
+      client->handlePacket(p);
+      drain(client);
+      if (client->getState() == CLIENT_ESTABLISHED)
+      {
+        m_synSentClients.erase(it);
+        m_connectionIdToClient[client->getConnectionId()] = client;
+      }
+      return;
+    }
+  }
+
+  auto it = m_connectionIdToClient.find(p->getConnId());
+  if (it != m_connectionIdToClient.end())
+  {
+    it->second->handlePacket(p);
+    drain(it->second);
+  }
+  // packets of unknown or already closed connections are dropped
+}
+
+/**
+ * @brief Takes out everything a call into `client` left for the driver: its datagrams are
+ * sent, its packets logged to the trace or stdout and its errors reported
+ */
+void Uploader::drain(Client *client)
+{
+  Transmit *t;
+  while ((t = client->pollTransmit()) != nullptr)
+    sendTransmit(t);
+  TraceRecord record;
+  while (client->pollLog(record))
+  {
+    if (m_tracer != nullptr)
+      m_tracer->record(record);
+    else
+      std::cout << traceLine(record) << std::endl;
+  }
+  std::string error;
+  while (client->pollError(error))
+    std::cerr << error << std::endl;
+}
+
+/**
+ * @brief Sends the datagrams of a run in one sendmsg, with UDP_SEGMENT set to their size if
+ * there are several. If the kernel or the device can not segment, they are sent one by one and
+ * so is everything any connection sends afterwards.
+ */
+void Uploader::sendTransmit(Transmit *t)
+{
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &m_serverAddr;
+  msg.msg_namelen = m_serverAddrLen;
+  msg.msg_iov = t->iov.data();
+  msg.msg_iovlen = t->iov.size();
+  char control[SEGMENT_SIZE_CONTROL_BYTES];
+  if (t->datagrams > 1)
+    setSegmentSize(&msg, control, t->segmentSize);
+  uint64_t stageStarted = m_stages.start();
+  int bytesSent = sendmsg(m_sockFd, &msg, 0);
+  m_stages.stop(CLIENT_SEND, stageStarted);
+  if (bytesSent == -1 && t->datagrams > 1 && isOffloadError(errno))
+  {
+    m_segmentationOffload = false;
+    for (auto client : m_clients)
+      client->setSegmentationOffload(false);
+    std::string run;
+    for (auto &iov : t->iov)
+      run.append((const char *)iov.iov_base, iov.iov_len);
+    for (size_t offset = 0; offset < run.size(); offset += t->segmentSize)
+      sendto(m_sockFd, run.data() + offset, std::min((size_t)t->segmentSize, run.size() - offset), 0, (struct sockaddr *)&m_serverAddr,
+             m_serverAddrLen);
+    return;
+  }
+  if (bytesSent == -1)
+    std::cerr << "ERROR: Packet send Error: " << strerror(errno) << std::endl;
+}
+
+/**
+ * @brief Frees every connection that has closed and records failures. A resumable transfer
+ * whose connection timed out is reopened with the same source instead, up to
+ * MAX_RESUME_ATTEMPTS times.
+ */
+void Uploader::reapClosedUploads()
+{
+  for (int i = 0; i < (int)m_clients.size();)
+  {
+    Client *client = m_clients[i];
+    if (client->getState() != CLIENT_CLOSED)
+    {
+      i++;
+      continue;
+    }
+
+    auto synIt = m_synSentClients.find(client->getInitialSeqNum());
+    if (synIt != m_synSentClients.end() && synIt->second == client)
+      m_synSentClients.erase(synIt);
+    auto connIt = m_connectionIdToClient.find(client->getConnectionId());
+    if (connIt != m_connectionIdToClient.end() && connIt->second == client)
+      m_connectionIdToClient.erase(connIt);
+
+    UploadJob job = m_clientJobs[client];
+    m_clientJobs.erase(client);
+    m_clients[i] = m_clients.back();
+    m_clients.pop_back();
+
+    if (job.resume && client->timedOut() && ++job.attempts <= MAX_RESUME_ATTEMPTS)
+    {
+      std::cerr << "Resuming " << job.fileName << " (attempt " << job.attempts << " of " << MAX_RESUME_ATTEMPTS << ")" << std::endl;
+      // the connection counted against maxActive, so its number leaves another one free
+      startUpload(job, client->takeSource(), nextInitialSeqNum());
+    }
+    else if (client->getExitCode() != 0)
+      m_exitCode = client->getExitCode();
+    m_closedMetrics.add(client->getMetrics());
+    delete client;
+  }
+}
+
+/**
+ * @brief Number of connections that count against the limit, i.e. everything except
+ * connections waiting out their final 2 seconds
+ */
+int Uploader::activeUploads()
+{
+  int active = 0;
+  for (auto client : m_clients)
+  {
+    if (client->getState() != CLIENT_TIME_WAIT)
+      active++;
+  }
+  return active;
+}
+
+/**
+ * @brief Initial sequence number for a new connection. The first connection uses
+ * INIT_CLIENT_SEQ_NUM, later ones count up from there so that concurrent handshakes can be
+ * told apart by the ACK number of their SYN-ACK. Since that ACK may also cover up to a payload
+ * of early data, numbers are kept more than MAX_PAYLOAD_LENGTH apart from every pending SYN.
+ * -1 if every number is that close to one, which takes more than MAX_ACTIVE_CONNECTIONS of them.
+ */
+int Uploader::nextInitialSeqNum()
+{
+  int initialSeqNum = m_nextInitialSeqNum;
+  for (int tried = 0; isNearPendingSyn(initialSeqNum); tried++)
+  {
+    if (tried > MAX_SEQ_NUM / (MAX_PAYLOAD_LENGTH + 1)) // went around the sequence space
+      return -1;
+    initialSeqNum = (initialSeqNum + MAX_PAYLOAD_LENGTH + 1) % (MAX_SEQ_NUM + 1);
+  }
+  m_nextInitialSeqNum = (initialSeqNum + MAX_PAYLOAD_LENGTH + 1) % (MAX_SEQ_NUM + 1);
+  return initialSeqNum;
+}
+
+/**
+ * @brief Whether the ACK range of a SYN from `initialSeqNum` would overlap that of a client
+ * still waiting for its SYN-ACK.
+ */
+bool Uploader::isNearPendingSyn(int initialSeqNum)
+{
+  for (auto &entry : m_synSentClients)
+  {
+    int distance = (initialSeqNum - entry.first + MAX_SEQ_NUM + 1) % (MAX_SEQ_NUM + 1);
+    if (distance <= MAX_PAYLOAD_LENGTH || MAX_SEQ_NUM + 1 - distance <= MAX_PAYLOAD_LENGTH)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Gives pointer to packet to read, if available in the socket
+ *
+ * @return Pointer to TCPPacket struct which the caller must delete to free the memory. If
+ * If socket is empty, return nullptr.
+ */
+TCPPacket *Uploader::recvPacket()
+{
+  char *buffer;
+  while (true) // anyone can send to the socket, datagrams that are not packets of ours are dropped
+  {
+    int bytes = m_reader.next(&buffer); // a segment left from the last receive
+    if (bytes == -1)
+    {
+      // nothing was available to read at the socket, so no new packet arrived
+      if (m_reader.receive(m_sockFd, 0, &m_stages, CLIENT_DELIVERY) == -1)
+        return nullptr;
+      bytes = m_reader.next(&buffer);
+    }
+    if (bytes < HEADER_LEN) // runt datagram, not a packet
+      continue;
+
+    // a packet of an encrypted connection that does not verify is dropped like a lost one
+    uint16_t connId;
+    memcpy(&connId, buffer + 8, sizeof(connId));
+    auto it = m_connectionIdToClient.find(ntohs(connId));
+    bool syn = buffer[11] & 2;
+    if (!syn && it != m_connectionIdToClient.end() && (bytes = it->second->openPacket(buffer, bytes)) == -1)
+      continue;
+
+    std::string stringBuffer = convertCStringtoStandardString(buffer, bytes);
+    TCPPacket *p = new TCPPacket(stringBuffer);
+    return p;
+  }
+}
+
+/**
+ * @brief Blocks until a packet is ready to be read from the socket, one of the starved stream
+ * sources has data, or `deadline` passes
+ *
+ * @return true if the socket is readable
+ */
+bool Uploader::waitForPacket(c_time deadline, std::vector<int> &sourceFds)
+{
+  std::chrono::nanoseconds timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - m_now);
+  if (timeout.count() <= 0)
+    return false;
+  // a loop that also waits for a data source blocks at once, the spin only watches the socket
+  if (m_busyPoll.enabled() && sourceFds.empty() && m_busyPoll.spin(m_sockFd, timeout.count()))
+    return true;
+
+  std::vector<struct pollfd> pfds(1 + sourceFds.size());
+  pfds[0].fd = m_sockFd;
+  pfds[0].events = POLLIN;
+  for (int i = 0; i < (int)sourceFds.size(); i++)
+  {
+    pfds[i + 1].fd = sourceFds[i];
+    pfds[i + 1].events = POLLIN;
+  }
+  struct timespec ts;
+  ts.tv_sec = timeout.count() / 1000000000;
+  ts.tv_nsec = timeout.count() % 1000000000;
+
+  int ret = ppoll(pfds.data(), pfds.size(), &ts, nullptr);
+  if (ret == -1 && errno != EINTR)
+  {
+    std::cerr << "ERROR: in ppoll " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  return ret > 0 && (pfds[0].revents & POLLIN);
+}
+
+/**
+ * @brief Replaces the metrics file with the counters and windows of every connection that is not
+ * closed yet and the totals since start
+ */
+void Uploader::writeMetrics()
+{
+  SenderMetrics total = m_closedMetrics;
+  std::vector<std::pair<std::string, SenderMetrics>> connections;
+  for (auto client : m_clients)
+  {
+    SenderMetrics metrics = client->getMetrics();
+    total.add(metrics);
+    connections.push_back(std::make_pair(connectionLabels(client), metrics));
+  }
+
+  MetricsText text;
+  text.family("confundo_client_connections_opened_total", "counter", "Connections opened since start, including resumed ones");
+  text.sample("confundo_client_connections_opened_total", "", m_connectionsOpened);
+  text.family("confundo_client_open_connections", "gauge", "Connections not closed yet");
+  text.sample("confundo_client_open_connections", "", m_clients.size());
+  text.family("confundo_client_pending_files", "gauge", "Uploads waiting for a connection");
+  text.sample("confundo_client_pending_files", "", m_pendingFiles.size());
+  text.counters("confundo_client", total, connections);
+
+  text.family("confundo_client_connection_cwnd_bytes", "gauge", "Congestion window");
+  for (auto client : m_clients)
+    text.sample("confundo_client_connection_cwnd_bytes", connectionLabels(client), client->getCwnd());
+  text.family("confundo_client_connection_ssthresh_bytes", "gauge", "Slow start threshold");
+  for (auto client : m_clients)
+    text.sample("confundo_client_connection_ssthresh_bytes", connectionLabels(client), client->getSsthresh());
+  text.family("confundo_client_connection_rwnd_bytes", "gauge", "Receive window advertised by the server");
+  for (auto client : m_clients)
+    text.sample("confundo_client_connection_rwnd_bytes", connectionLabels(client), client->getRwnd());
+  text.family("confundo_client_connection_srtt_seconds", "gauge", "Smoothed round trip time, 0 before the first sample");
+  for (auto client : m_clients)
+    text.sample("confundo_client_connection_srtt_seconds", connectionLabels(client), client->getSrtt());
+  text.family("confundo_client_connection_goodput_bytes_per_second", "gauge", "Bytes ACKed per second since the SYN");
+  for (auto client : m_clients)
+    text.sample("confundo_client_connection_goodput_bytes_per_second", connectionLabels(client), client->getGoodput());
+
+  if (!text.writeFile(m_metricsPath))
+    std::cerr << "ERROR: Unable to write the metrics file " << m_metricsPath << ": " << strerror(errno) << std::endl;
+  m_metricsWrittenAt = m_now;
+}
+
+/**
+ * @brief Labels of the samples of a connection: its id, 0 until the handshake, and its file
+ */
+std::string Uploader::connectionLabels(Client *client)
+{
+  return MetricsText::label("connection", std::to_string(client->getConnectionId())) + "," + MetricsText::label("file", client->getFileName());
+}
+
+#ifndef CONFUNDO_NO_MAIN
+void printUsage()
+{
+  std::cerr << "Usage: client [-j <max active connections>] [-n <stripes per file>] [-b <stream buffer bytes>] [-a <read-ahead chunks>] [-r] [-z] [-c] [-f <segments per parity>] [-0] [-S] [-m <metrics file>] [-t <trace file>] [-p] [-B <cpu>] [-g] [-k <shared key file>] <HOSTNAME-OR-IP> <PORT> <FILENAME-OR-DIRECTORY>..." << std::endl;
+  std::cerr << "  -a reads regular files that many 64K chunks ahead on a thread of their own instead of mapping them, at least " << MIN_PREFETCH_CHUNKS << std::endl;
+  std::cerr << "  -r makes transfers resumable: they continue where they stopped after a timeout or a rerun" << std::endl;
+  std::cerr << "  -z compresses the data with zlib, chunks that do not compress are sent as they are" << std::endl;
+  std::cerr << "  -c adds a CRC32C to every packet and confirms a digest of the data when closing" << std::endl;
+  std::cerr << "  -0 sends the first bytes of every file in its SYN, saving a round trip" << std::endl;
+  std::cerr << "  -S sends the files that are not striped over a few sessions that carry many files each instead of a connection per file" << std::endl;
+  std::cerr << "  -f sends an XOR parity packet for every group of at least that many segments, groups grow when losses are rare" << std::endl;
+  std::cerr << "  -m rewrites the file every second with the metrics of every connection in the Prometheus text format" << std::endl;
+  std::cerr << "  -t writes every packet to a binary trace for the analyzer instead of printing it" << std::endl;
+  std::cerr << "  -p prints latency histograms of the send and ACK paths to stderr at exit and on SIGUSR1" << std::endl;
+  std::cerr << "  -g sends and receives every packet with a system call of its own instead of a window at a time (UDP_SEGMENT and UDP_GRO)" << std::endl;
+  std::cerr << "  -B pins the event loop to that CPU and spins on the socket before blocking, for the lowest latency per packet" << std::endl;
+  std::cerr << "  FILENAME can be - for stdin, a pipe, or gen:<size>[K|M|G] for synthetic data" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  using namespace std;
+  int maxActive = DEFAULT_MAX_ACTIVE_CONNECTIONS;
+  int stripes = 1;
+  int streamBufferBytes = DEFAULT_STREAM_BUFFER_BYTES;
+  int prefetchChunks = 0;
+  bool resume = false;
+  bool compress = false;
+  bool checksums = false;
+  int fecGroup = 0;
+  bool earlyData = false;
+  string metricsPath;
+  string tracePath;
+  bool latency = false;
+  bool session = false;
+  int busyPollCpu = -1;
+  bool offload = true;
+  string sharedKey;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:n:b:a:rzcf:0Sm:t:pB:gk:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      maxActive = atoi(optarg);
+      if (maxActive <= 0 || maxActive > MAX_ACTIVE_CONNECTIONS)
+      {
+        cerr << "ERROR: Active connections must be between 1 and " << MAX_ACTIVE_CONNECTIONS << endl;
+        exit(1);
+      }
+      break;
+    case 'n':
+      stripes = atoi(optarg);
+      if (stripes <= 0 || stripes > MAX_STRIPES)
+      {
+        cerr << "ERROR: Number of stripes must be between 1 and " << MAX_STRIPES << endl;
+        exit(1);
+      }
+      break;
+    case 'b':
+      streamBufferBytes = parseSize(optarg);
+      if (streamBufferBytes < MAX_CWND_BYTES)
+      {
+        cerr << "ERROR: Stream buffer must hold at least " << MAX_CWND_BYTES << " bytes" << endl;
+        exit(1);
+      }
+      break;
+    case 'a':
+      prefetchChunks = atoi(optarg);
+      if (prefetchChunks < MIN_PREFETCH_CHUNKS)
+      {
+        cerr << "ERROR: Read-ahead needs at least " << MIN_PREFETCH_CHUNKS << " chunks" << endl;
+        exit(1);
+      }
+      break;
+    case 'r':
+      resume = true;
+      break;
+    case 'z':
+      compress = true;
+      break;
+    case 'c':
+      checksums = true;
+      break;
+    case '0':
+      earlyData = true;
+      break;
+    case 'S':
+      session = true;
+      break;
+    case 'm':
+      metricsPath = optarg;
+      break;
+    case 't':
+      tracePath = optarg;
+      break;
+    case 'p':
+      latency = true;
+      break;
+    case 'B':
+      busyPollCpu = atoi(optarg);
+      if (busyPollCpu < 0)
+      {
+        cerr << "ERROR: Incorrect CPU provided" << endl;
+        exit(1);
+      }
+      break;
+    case 'g':
+      offload = false;
+      break;
+    case 'k':
+      sharedKey = readSharedKey(optarg);
+      break;
+    case 'f':
+      fecGroup = atoi(optarg);
+      if (fecGroup < FEC_MIN_GROUP || fecGroup > FEC_MAX_GROUP)
+      {
+        cerr << "ERROR: Segments per parity packet must be between " << FEC_MIN_GROUP << " and " << FEC_MAX_GROUP << endl;
+        exit(1);
+      }
+      break;
+    default:
+      printUsage();
+      exit(1);
+    }
+  }
+
+  if (resume && stripes > 1)
+  {
+    cerr << "ERROR: Resumable transfers can not be striped" << endl;
+    exit(1);
+  }
+  if (resume && compress)
+  {
+    cerr << "ERROR: Compressed transfers can not be resumed" << endl;
+    exit(1);
+  }
+  if (resume && session)
+  {
+    cerr << "ERROR: Sessions can not be resumed" << endl;
+    exit(1);
+  }
+  if (!sharedKey.empty() && checksums)
+  {
+    cerr << "ERROR: Encrypted packets are authenticated, checksums can not be added" << endl;
+    exit(1);
+  }
+  if (!sharedKey.empty() && earlyData)
+  {
+    cerr << "ERROR: Encrypted transfers can not carry data in the SYN, it is sent in the clear" << endl;
+    exit(1);
+  }
+
+  if (argc - optind < 3)
+  {
+    cerr << "ERROR: Incorrect number of arguments provided!" << endl;
+    printUsage();
+    exit(1);
+  }
+
+  if (!(atoi(argv[optind + 1])))
+  {
+    cerr << "ERROR: Incorrect format of ports provided" << endl;
+    exit(1); //TODO: need to change and implement the exact exit functions with different exit codes.
+  }
+  int port = atoi(argv[optind + 1]);
+  if (port < 0 || port > 65535)
+  {
+    cerr << "ERROR: Incorrect port number provided" << endl;
+  }
+
+  Uploader uploader(argv[optind], argv[optind + 1], maxActive, stripes, streamBufferBytes, resume, compress, checksums, fecGroup, earlyData, metricsPath, tracePath, latency, session, prefetchChunks, busyPollCpu, offload, sharedKey);
+  for (int i = optind + 2; i < argc; i++)
+  {
+    if (!uploader.addPath(argv[i]))
+    {
+      cerr << "ERROR: Unable to open file " << argv[i] << ": " << strerror(errno) << endl;
+      exit(1);
+    }
+  }
+  return uploader.run();
+}
+#endif // CONFUNDO_NO_MAIN
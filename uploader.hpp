@@ -0,0 +1,152 @@
+#ifndef UPLOADER_HPP
+#define UPLOADER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "client.hpp"
+#include "metricstext.hpp"
+#include "tracefile.hpp"
+#include "streamsource.hpp"
+#include "sessionsource.hpp"
+#include "busypoll.hpp"
+#include "offload.hpp"
+#include "tcp.hpp"
+
+struct UploadJob // one connection worth of work
+{
+  std::string fileName;
+  off_t offset;   // first byte of the file to send
+  off_t length;   // bytes to send, -1 for up to the end of the file
+  bool stripe;    // part of a file split across several connections
+  uint32_t transferId;
+  bool resume;    // resumable, identified by resumeToken
+  uint64_t resumeToken;
+  int attempts;   // connections that timed out so far
+  bool compress;  // send zlib frames of the data instead of the data
+  std::vector<SessionEntry> sessionFiles; // the files a session carries, empty for a single file
+};
+
+/**
+ * Runs any number of uploads, one Client per file, over a single UDP socket in one event loop:
+ * the driver of the client side. It owns the socket and the clock, feeds both into the
+ * connections and sends and logs what they hand out, see Client.
+ * At most `maxActive` connections are opening or transferring at the same time; connections in
+ * their final 2 second wait do not count against the limit.
+ *
+ * With `stripes` > 1 every regular file is split into that many byte ranges which are sent in
+ * parallel over their own connections and put back together by the server.
+ *
+ * With `resume` every file carries a transfer token. A connection that times out is reopened
+ * with the same token and continues from the bytes the server already wrote; regular files get
+ * a token derived from their path, size and modification time so a rerun of the client resumes
+ * them as well.
+ *
+ * With `compress` every connection sends the data as zlib frames, encoded chunk by chunk ahead
+ * of the window by a CompressedSource, and the server decodes them before writing.
+ *
+ * With `session` every file that would be sent whole over a connection of its own (not a
+ * stripe, a stream or a resumable transfer) is carried by a session instead, i.e. a connection
+ * that sends many files one after the other behind records that name them. The files are
+ * spread over up to `maxActive` sessions of about the same size, so a handshake, a handwave
+ * and the final wait are paid once per session and every file but the first of a session
+ * starts with the congestion window the one before it left.
+ *
+ * With `prefetchChunks` every regular file is read that many chunks ahead of the window by a
+ * thread of its own instead of being mapped, so a read that misses the page cache stalls that
+ * thread and not the event loop, see prefetchsource.hpp.
+ *
+ * With a `busyPollCpu` other than -1 the event loop is pinned to that core and spins on the
+ * socket for a while before it blocks in ppoll(), see busypoll.hpp.
+ *
+ * With `offload`, where the kernel has UDP_SEGMENT, every connection hands the new packets of a
+ * window to the kernel as one buffer that it cuts into datagrams, so a window costs one trip
+ * through the stack instead of one per packet, and with UDP_GRO ACKs that arrived together are
+ * received together, see offload.hpp.
+ *
+ * With a `sharedKey` every connection agrees on keys derived from it in the SYN exchange and
+ * seals its packets with AES-GCM or ChaCha20-Poly1305, see aead.hpp.
+ *
+ * With `checksums` every connection protects its packets with a CRC32C trailer. With
+ * `fecGroup` it sends XOR parity for groups of at least that many segments. With `earlyData`
+ * the SYN of every connection carries its first bytes.
+ *
+ * With a `metricsPath` the counters of every connection and their totals are written to that
+ * file once per METRICS_INTERVAL, see metricstext.hpp. With a `tracePath` every connection records
+ * its packets in that binary trace instead of printing them, see tracefile.hpp. With `latency` the
+ * send and ACK paths of every connection are timed into histograms that are printed to stderr at
+ * the end of run() and on SIGUSR1, see latency.hpp.
+ */
+class Uploader
+{
+public:
+  Uploader(std::string hostname, std::string port, int maxActive, int stripes = 1, int streamBufferBytes = DEFAULT_STREAM_BUFFER_BYTES,
+           bool resume = false, bool compress = false,
+           bool checksums = false, int fecGroup = 0, bool earlyData = false, std::string metricsPath = "", std::string tracePath = "", bool latency = false,
+           bool session = false, int prefetchChunks = 0, int busyPollCpu = -1, bool offload = true, std::string sharedKey = "");
+  ~Uploader();
+  // queue a file, stream or synthetic source, or every regular file below a directory. In a
+  // session a file is named `name`, or the last component of its path, and files below a
+  // directory after their path from there
+  bool addPath(std::string path, std::string name = "");
+  int run();                      // returns the exit code: 0 if every upload succeeded
+
+private:
+  void queueFile(std::string fileName, off_t size, std::string name);
+  bool sessionEntry(std::string fileName, std::string name, SessionEntry &entry);
+  void queueSessions();
+  void startPendingUploads();
+  bool startUpload(UploadJob &job, DataSource *source, int initialSeqNum);
+  uint64_t resumeToken(std::string fileName);
+  void dispatch(TCPPacket *p);
+  void drain(Client *client);
+  void sendTransmit(Transmit *t);
+  void reapClosedUploads();
+  int activeUploads();
+  int nextInitialSeqNum();
+  bool isNearPendingSyn(int initialSeqNum);
+  TCPPacket *recvPacket();
+  bool waitForPacket(c_time deadline, std::vector<int> &sourceFds);
+  void writeMetrics();
+  std::string connectionLabels(Client *client);
+
+  int m_sockFd;
+  struct sockaddr_storage m_serverAddr;
+  socklen_t m_serverAddrLen;
+  int m_maxActive;
+  int m_stripes;
+  int m_streamBufferBytes;
+  bool m_resume;
+  bool m_compress;
+  bool m_checksums;
+  int m_fecGroup;
+  bool m_earlyData;
+  bool m_session;
+  int m_prefetchChunks;
+  bool m_segmentationOffload; // of the connections, UDP_SEGMENT
+  std::string m_sharedKey;    // every connection is encrypted if not empty
+  int m_nextInitialSeqNum;
+  int m_exitCode;
+  c_time m_now;
+  std::string m_metricsPath;
+  c_time m_metricsWrittenAt;
+  SenderMetrics m_closedMetrics; // sum over the connections that are gone
+  int64_t m_connectionsOpened;
+  Tracer *m_tracer; // shared by every connection, nullptr unless tracing
+  LatencyStages m_stages; // shared by every connection
+  BusyPoller m_busyPoll;
+  SegmentReader m_reader; // ACKs, with UDP_GRO several of them per receive
+
+  std::deque<UploadJob> m_pendingFiles;
+  std::vector<SessionEntry> m_sessionFiles; // files for the sessions, split among them by run()
+  std::vector<Client *> m_clients;                         // every connection that is not closed yet
+  std::unordered_map<Client *, UploadJob> m_clientJobs;     // job of every connection, to resume it
+  std::unordered_map<int, Client *> m_connectionIdToClient; // established connections
+  std::unordered_map<int, Client *> m_synSentClients;       // awaiting SYN-ACK, by initial sequence number
+};
+
+#endif // UPLOADER_HPP